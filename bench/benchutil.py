@@ -0,0 +1,16 @@
+# encoding: utf-8
+"""Helpers shared by the benchmark scripts."""
+
+import subprocess, time
+
+def time_best(exe, runs):
+    """The best wall time of running exe a few times, or None if it ever
+    exits with a nonzero status."""
+    best = None
+    for _ in range(runs):
+        start = time.time()
+        if subprocess.call([exe]) != 0:
+            return None
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
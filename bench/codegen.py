@@ -0,0 +1,129 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""Compare the speed of the code neatc generates with C.
+
+Every program in bench/codegen has a neat version, <program>.neat, and a
+C reference, <program>.c, written the same way:
+
+  fib      naive recursive Fibonacci
+  loops    three nested counting loops with a division
+  arith    a linear congruential generator folded into an accumulator
+  gcd      Euclid's algorithm over a grid of pairs
+  calls    Ackermann's function, for deep non-tail recursion
+
+The neat version is compiled to a native executable at every -O level,
+the C version once with $CC (default cc) at -O2, and the best wall time
+of a few runs is reported as a ratio to C. Calls with constant arguments
+are left to run time (-fno-const-eval), so that the generated code is
+measured, not the compile-time evaluator.
+
+The programs return 0 from main when they computed the right answer, so
+a miscompiled program is reported as a failure rather than timed.
+
+Ratios are checked against bench/codegen/baseline.json, and a ratio more
+than --tolerance above its baseline fails the run, as does a ratio with
+no baseline. --update-baseline records the current ratios instead.
+Baselines are only meaningful on the machine that recorded them, so
+record one with --update-baseline on the reference machine before
+checking against it.
+
+usage: bench/codegen.py [--neatc PATH] [--runs N] [--tolerance T]
+                        [--update-baseline] [program ...]
+"""
+
+import argparse, glob, json, os, shutil, subprocess, sys, tempfile
+from os.path import *
+from benchutil import time_best
+
+LEVELS = [0, 1, 2, 3]
+
+def build_neat(neatc, level, src, tmp):
+    name = '%s_O%d' % (splitext(basename(src))[0], level)
+    bc = join(tmp, name + '.bc')
+    exe = join(tmp, name)
+    opt = '-O%d' % level
+    subprocess.check_call([neatc, opt, '-fno-const-eval', '-o', bc, src])
+    subprocess.check_call([neatc, '-link', opt, bc, '-o', exe])
+    return exe
+
+def build_c(src, tmp):
+    exe = join(tmp, splitext(basename(src))[0] + '_c')
+    cc = os.environ.get('CC', 'cc')
+    # neat integers wrap around
+    subprocess.check_call([cc, '-O2', '-fwrapv', src, '-o', exe])
+    return exe
+
+def main():
+    root = dirname(abspath(__file__))
+    parser = argparse.ArgumentParser(description='Compare generated code with C.')
+    parser.add_argument('--neatc', default=join(dirname(root), 'neatc'))
+    parser.add_argument('--runs', type=int, default=5)
+    parser.add_argument('--tolerance', type=float, default=0.2,
+                        help='allowed slowdown over the baseline ratio (default: 0.2)')
+    parser.add_argument('--update-baseline', action='store_true')
+    parser.add_argument('programs', nargs='*')
+    args = parser.parse_args()
+
+    baseline_path = join(root, 'codegen', 'baseline.json')
+    baseline = {}
+    if exists(baseline_path):
+        with open(baseline_path) as f:
+            baseline = json.load(f)
+
+    programs = args.programs or sorted(splitext(basename(p))[0]
+                                       for p in glob.glob(join(root, 'codegen', '*.neat')))
+    print('%-16s%12s' % ('program', 'C') + ''.join('%11s' % ('-O%d' % l) for l in LEVELS))
+
+    tmp = tempfile.mkdtemp()
+    failed = regressed = missing = False
+    try:
+        for program in programs:
+            src = join(root, 'codegen', program)
+            c_time = time_best(build_c(src + '.c', tmp), args.runs)
+            row = '%-16s' % program
+            if c_time is None:
+                print(row + '%12s' % 'FAILED')
+                failed = True
+                continue
+            row += '%10.1fms' % (c_time * 1000)
+
+            ratios = {}
+            for level in LEVELS:
+                key = 'O%d' % level
+                t = time_best(build_neat(args.neatc, level, src + '.neat', tmp), args.runs)
+                if t is None:
+                    row += '%11s' % 'FAILED'
+                    failed = True
+                    continue
+                ratio = t / c_time
+                ratios[key] = round(ratio, 2)
+                expected = baseline.get(program, {}).get(key)
+                if args.update_baseline:
+                    row += '%9.2fx ' % ratio
+                elif expected is None:
+                    row += '%9.2fx?' % ratio
+                    missing = True
+                elif ratio > expected * (1 + args.tolerance):
+                    row += '%9.2fx!' % ratio
+                    regressed = True
+                else:
+                    row += '%9.2fx ' % ratio
+            print(row)
+            if args.update_baseline:
+                baseline[program] = ratios
+    finally:
+        shutil.rmtree(tmp)
+
+    if args.update_baseline:
+        with open(baseline_path, 'w') as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write('\n')
+        return 0
+    if regressed:
+        print('! slower than the baseline ratio by more than %d%%' % (args.tolerance * 100))
+    if missing:
+        print('? no baseline ratio; record one with --update-baseline')
+    return 1 if failed or regressed or missing else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
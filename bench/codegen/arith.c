@@ -0,0 +1,13 @@
+/* C reference for arith.neat. */
+
+int main(void) {
+  int x = 1;
+  int acc = 0;
+  int n = 100000000;
+  while (n) {
+    x = x * 1103515245 + 12345;
+    acc += x / 65536 - acc / 3;
+    n -= 1;
+  }
+  return acc != 5528;
+}
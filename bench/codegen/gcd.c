@@ -0,0 +1,24 @@
+/* C reference for gcd.neat. */
+
+static int gcd(int a, int b) {
+  while (b) {
+    int t = a - a / b * b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+int main(void) {
+  int total = 0;
+  int i = 1;
+  while (i < 2000) {
+    int j = 1;
+    while (j < 2000) {
+      total += gcd(i, j);
+      ++j;
+    }
+    ++i;
+  }
+  return total != 19430528;
+}
@@ -0,0 +1,19 @@
+/* C reference for loops.neat. */
+
+int main(void) {
+  int total = 0;
+  int i = 0;
+  while (i < 400) {
+    int j = 0;
+    while (j < 400) {
+      int k = 0;
+      while (k < 400) {
+        total += (i * j + k) / (k + 1);
+        ++k;
+      }
+      ++j;
+    }
+    ++i;
+  }
+  return total != -1081575872;
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""Time the expression parser on wide and deeply nested expressions.
+
+Each shape is generated at a few sizes and parsed with -fsyntax-only;
+the best parse time of a few runs, as reported by -stats, is printed:
+
+  wide     a + b * 2 - ... with n operators
+  parens   n nested parentheses around one operand
+  prefix   n nested negations
+  assign   n chained right-associative assignments
+  calls    n nested calls, f(f(f(...)))
+  index    n nested array indices, a[a[a[...]]]
+
+Pass --baseline with a neatc built from an older tree to compare against
+it; a compiler that crashes, typically by running out of stack on the
+deep shapes, is reported as such.
+
+usage: bench/parse.py [--neatc PATH] [--baseline PATH] [--runs N] [shape ...]
+"""
+
+import argparse, os, re, shutil, subprocess, sys, tempfile
+from os.path import *
+
+SIZES = [100, 1000, 10000]
+
+def wide(n):
+    terms = ['x']
+    for i in range(n):
+        terms.append('%s %d' % ('+-*/'[i % 4], i + 1))
+    return ' '.join(terms)
+
+SHAPES = [
+    ('wide', wide),
+    ('parens', lambda n: '(' * n + 'x' + ')' * n),
+    ('prefix', lambda n: '-' * n + 'x'),
+    ('assign', lambda n: ' = '.join(['x'] * (n + 1))),
+    ('calls', lambda n: 'f(' * n + 'x' + ')' * n),
+    ('index', lambda n: 'a[' * n + '0' + ']' * n),
+]
+
+def source(expr):
+    return 'fn f(x: int) -> int {\n  var a: int[4];\n  return %s;\n}\n' % expr
+
+def parse_time(neatc, path, runs):
+    best = None
+    for _ in range(runs):
+        proc = subprocess.Popen([neatc, '-fsyntax-only', '-stats', path],
+                                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        _, err = proc.communicate()
+        if proc.returncode < 0:
+            return 'CRASHED'
+        m = re.search(r'stats: parsed in ([0-9.]+) ms', err.decode())
+        if proc.returncode != 0 or not m:
+            return 'FAILED'
+        ms = float(m.group(1))
+        best = ms if best is None else min(best, ms)
+    return best
+
+def cell(result):
+    return '%12s' % result if isinstance(result, str) else '%10.2fms' % result
+
+def main():
+    root = dirname(abspath(__file__))
+    parser = argparse.ArgumentParser(description='Time the expression parser.')
+    parser.add_argument('--neatc', default=join(dirname(root), 'neatc'))
+    parser.add_argument('--baseline')
+    parser.add_argument('--runs', type=int, default=5)
+    parser.add_argument('shapes', nargs='*')
+    args = parser.parse_args()
+
+    compilers = [('neatc', args.neatc)]
+    if args.baseline:
+        compilers.append(('baseline', args.baseline))
+    shapes = [s for s in SHAPES if not args.shapes or s[0] in args.shapes]
+    print('%-16s' % 'shape' + ''.join('%12s' % name for name, _ in compilers))
+
+    tmp = tempfile.mkdtemp()
+    failed = False
+    try:
+        for name, make in shapes:
+            for n in SIZES:
+                path = join(tmp, '%s%d.neat' % (name, n))
+                with open(path, 'w') as f:
+                    f.write(source(make(n)))
+                row = '%-16s' % ('%s/%d' % (name, n))
+                for label, neatc in compilers:
+                    result = parse_time(neatc, path, args.runs)
+                    failed = failed or (label == 'neatc' and isinstance(result, str))
+                    row += cell(result)
+                print(row)
+    finally:
+        shutil.rmtree(tmp)
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""Compare scalar and explicit SIMD versions of kernels.
+
+Every kernel in bench/simd has a scalar version, <kernel>_scalar.neat,
+and one written with vec<N, T>, <kernel>_vec.neat. Both are compiled to
+native executables and the best wall time of a few runs is reported,
+with the speedup of the vector version:
+
+  dot      dot product of two int arrays
+  prefix   inclusive prefix sum of an int array
+
+The programs return 0 from main when they computed the right answer, so
+a miscompiled kernel is reported as a failure rather than timed.
+
+usage: bench/simd.py [--neatc PATH] [--runs N] [--march CPU] [kernel ...]
+"""
+
+import argparse, glob, os, shutil, subprocess, sys, tempfile
+from os.path import *
+from benchutil import time_best
+
+def build(neatc, march, src, tmp):
+    name = splitext(basename(src))[0]
+    bc = join(tmp, name + '.bc')
+    exe = join(tmp, name)
+    subprocess.check_call([neatc, '-O3', '-march=' + march, '-fwhole-program', '-o', bc, src])
+    subprocess.check_call([neatc, '-link', '-O3', '-march=' + march, bc, '-o', exe])
+    return exe
+
+def main():
+    root = dirname(abspath(__file__))
+    parser = argparse.ArgumentParser(description='Compare scalar and SIMD kernels.')
+    parser.add_argument('--neatc', default=join(dirname(root), 'neatc'))
+    parser.add_argument('--runs', type=int, default=5)
+    parser.add_argument('--march', default='native')
+    parser.add_argument('kernels', nargs='*')
+    args = parser.parse_args()
+
+    kernels = args.kernels or sorted(basename(p)[:-len('_scalar.neat')]
+                                     for p in glob.glob(join(root, 'simd', '*_scalar.neat')))
+    print('%-16s%12s%12s%10s' % ('kernel', 'scalar', 'vec', 'speedup'))
+
+    tmp = tempfile.mkdtemp()
+    failed = False
+    try:
+        for kernel in kernels:
+            times = []
+            for variant in ('scalar', 'vec'):
+                exe = build(args.neatc, args.march, join(root, 'simd', '%s_%s.neat' % (kernel, variant)), tmp)
+                times.append(time_best(exe, args.runs))
+
+            row = '%-16s' % kernel
+            for t in times:
+                row += '%12s' % 'FAILED' if t is None else '%10.1fms' % (t * 1000)
+            if None in times:
+                failed = True
+            else:
+                row += '%9.2fx' % (times[0] / times[1])
+            print(row)
+    finally:
+        shutil.rmtree(tmp)
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
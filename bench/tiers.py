@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""Compare the execution tiers of neatc -run.
+
+Every program in bench/tiers is run in each tier and the best wall time
+of a few runs is reported:
+
+  interp   everything in the bytecode interpreter (-fno-jit)
+  jit      everything compiled on its first call (-fjit-threshold=0)
+  tiered   interpreted until hot, then compiled (the default)
+
+The programs return 0 from main when they computed the right answer, so
+a tier that miscompiles is reported as a failure rather than timed.
+
+usage: bench/tiers.py [--neatc PATH] [--runs N] [program.neat ...]
+"""
+
+import argparse, glob, os, subprocess, sys, time
+from os.path import *
+
+TIERS = [
+    ('interp', ['-fno-jit']),
+    ('jit', ['-fjit-threshold=0']),
+    ('tiered', []),
+]
+
+def run(neatc, flags, path):
+    start = time.time()
+    status = subprocess.call([neatc, '-run'] + flags + [path])
+    return time.time() - start, status
+
+def main():
+    root = dirname(abspath(__file__))
+    parser = argparse.ArgumentParser(description='Compare the execution tiers of neatc -run.')
+    parser.add_argument('--neatc', default=join(dirname(root), 'neatc'))
+    parser.add_argument('--runs', type=int, default=5)
+    parser.add_argument('programs', nargs='*')
+    args = parser.parse_args()
+
+    programs = args.programs or sorted(glob.glob(join(root, 'tiers', '*.neat')))
+    print('%-16s' % 'program' + ''.join('%12s' % name for name, _ in TIERS))
+
+    failed = False
+    for path in programs:
+        row = '%-16s' % splitext(basename(path))[0]
+        for name, flags in TIERS:
+            best = None
+            for _ in range(args.runs):
+                elapsed, status = run(args.neatc, flags, path)
+                if status != 0:
+                    best = None
+                    break
+                best = elapsed if best is None else min(best, elapsed)
+            if best is None:
+                row += '%12s' % 'FAILED'
+                failed = True
+            else:
+                row += '%10.1fms' % (best * 1000)
+        print(row)
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
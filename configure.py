@@ -16,9 +16,12 @@ def call(*k):
     return subprocess.check_output(k).strip()
 
 llvm_config = find_llvm_config()
-cflags = '-std=c++11 ' + call(llvm_config, '--cflags')
+# position independent, so that the objects also make up libneat.so
+cflags = '-std=c++11 -pthread -fPIC ' + call(llvm_config, '--cflags')
 ldflags = call(llvm_config, '--ldflags') + ' ' + \
-    call(llvm_config, '--libs', 'core', 'object', 'scalaropts')
+    call(llvm_config, '--libs', 'core', 'object', 'scalaropts', 'ipo',
+         'vectorize', 'native', 'bitreader', 'bitwriter', 'linker',
+         'asmprinter', 'jit')
 
 n = ninja_syntax.Writer(open('build.ninja', 'w'))
 n.variable('builddir', 'build')
@@ -33,10 +36,18 @@ n.rule('cxx', command='$cxx -MMD -MF $out.d $cflags -c $in -o $out',
        description='cxx $in', depfile='$out.d')
 n.newline()
 
-n.rule('link', command='$cxx $in $ldflags -o $out',
+n.rule('link', command='$cxx $in $ldflags -pthread -o $out',
        description='link $out')
 n.newline()
 
+n.rule('shared', command='$cxx -shared $in $ldflags -pthread -o $out',
+       description='shared $out')
+n.newline()
+
+n.rule('ar', command='rm -f $out && ar crs $out $in',
+       description='ar $out')
+n.newline()
+
 n.rule('re2c', command='re2c -b -i --no-generation-date -o $out $in',
        description='re2c $out')
 n.newline()
@@ -46,11 +57,30 @@ def cxx(src):
     objs.extend(n.build('$builddir/%s.o' % src, 'cxx', 'src/%s.cc' % src))
 
 n.build('src/lexer.cc', 're2c', 'src/lexer.in.cc')
-for x in ['neatc', 'ast', 'lexer', 'parse', 'scope', 'util']:
+for x in ['ast', 'astcache', 'bounds', 'builtins', 'bytecode', 'consteval', 'debuginfo',
+          'instrument', 'lexer', 'link', 'module', 'neat', 'parse', 'perfmap', 'profile',
+          'scope', 'structs', 'target', 'tier', 'util']:
     cxx(x)
 
-n.build('neatc', 'link', objs)
-n.default('neatc')
+# runtime support library linked into programs built by neatc
+rtobjs = []
+for x in ['parallel', 'profile', 'region', 'trace']:
+    rtobjs.extend(n.build('$builddir/runtime/%s.o' % x, 'cxx',
+                          'runtime/%s.cc' % x))
+
+# the compiler as a library for embedding (src/neat.h); the JIT calls
+# into the parallel and region runtimes from within the process
+libobjs = objs + ['$builddir/runtime/parallel.o', '$builddir/runtime/region.o']
+n.build('libneat.a', 'ar', libobjs)
+n.build('libneat.so', 'shared', libobjs)
+n.newline()
+
+n.build('neatc', 'link', n.build('$builddir/neatc.o', 'cxx', 'src/neatc.cc') +
+        ['libneat.a'])
+n.newline()
+
+n.build('libneatrt.a', 'ar', rtobjs)
+n.default(['neatc', 'libneat.a', 'libneat.so', 'libneatrt.a'])
 n.newline()
 
 n.variable('configure_args', ' '.join(sys.argv[1:]))
@@ -0,0 +1,212 @@
+// Runtime support for parfor loops.
+//
+// A parfor loop calls neat_parfor with its bounds and its outlined body,
+// which runs the iterations of one chunk. The iterations are split evenly
+// between the threads of a pool, and each thread runs chunks taken from
+// the front of its own share. A thread that runs out steals the back half
+// of another thread's share, so an uneven loop still keeps every thread
+// busy until the end; small chunks are only taken near the end of a share,
+// where they matter for balance, not in the common case.
+//
+// The pool is created on first use with one thread per core, or as many
+// as NEAT_NUM_THREADS says, including the thread that starts the loop.
+// Its threads are never joined: they sleep between loops and are torn
+// down with the process.
+
+#include "parallel.h"
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <thread>
+
+namespace {
+  /** Chunks per thread, so that stealing can even out uneven iterations
+      without taking a lock for every iteration.
+  */
+  const int64_t kChunksPerThread = 16;
+
+  /** Whether this thread is running a parfor body. */
+  thread_local bool in_parfor = false;
+
+  /** The iterations a thread has yet to run. */
+  struct Share {
+    std::mutex mu_;
+    int64_t begin_;
+    int64_t end_;
+  };
+
+  class Pool {
+  public:
+    explicit Pool(unsigned threads);
+    void Run(int32_t lo, int32_t hi, neat_parfor_body body, void *env);
+
+  private:
+    void Worker(unsigned id);
+    void Work(unsigned id);
+    bool Take(unsigned id, int64_t& begin, int64_t& end);
+
+    unsigned threads_;
+    std::unique_ptr<Share[]> shares_;
+
+    /** Loops started by different threads of the program take turns. */
+    std::mutex run_;
+
+    /** Guards the current loop; workers wait on wake_ for the next
+        generation, and Run waits on done_ until none is busy.
+    */
+    std::mutex mu_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_;
+    unsigned busy_;
+
+    neat_parfor_body body_;
+    void *env_;
+    int64_t grain_;
+  };
+
+  Pool::Pool(unsigned threads)
+    : threads_(threads), shares_(new Share[threads]), generation_(0), busy_(0),
+      body_(NULL), env_(NULL), grain_(1) {
+    for (unsigned id = 1; id < threads_; ++id) {
+      std::thread(&Pool::Worker, this, id).detach();
+    }
+  }
+
+  void Pool::Run(int32_t lo, int32_t hi, neat_parfor_body body, void *env) {
+    std::lock_guard<std::mutex> serial(run_);
+    int64_t n = int64_t(hi) - lo;
+    grain_ = std::max<int64_t>(1, n / (threads_ * kChunksPerThread));
+    for (unsigned id = 0; id < threads_; ++id) {
+      std::lock_guard<std::mutex> guard(shares_[id].mu_);
+      shares_[id].begin_ = lo + n * id / threads_;
+      shares_[id].end_ = lo + n * (id + 1) / threads_;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(mu_);
+      body_ = body;
+      env_ = env;
+      busy_ = threads_ - 1;
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(mu_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+  }
+
+  void Pool::Worker(unsigned id) {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        wake_.wait(lock, [&] { return generation_ != seen; });
+        seen = generation_;
+      }
+
+      Work(id);
+
+      std::lock_guard<std::mutex> guard(mu_);
+      if (--busy_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  void Pool::Work(unsigned id) {
+    in_parfor = true;
+    int64_t begin, end;
+    while (Take(id, begin, end)) {
+      body_(env_, int32_t(begin), int32_t(end));
+    }
+    in_parfor = false;
+  }
+
+  /** Take the next chunk from the thread's own share, refilling the share
+      from another thread's when it is empty. False when no thread has
+      work left that is not already being run.
+  */
+  bool Pool::Take(unsigned id, int64_t& begin, int64_t& end) {
+    Share& own = shares_[id];
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> guard(own.mu_);
+        if (own.begin_ < own.end_) {
+          begin = own.begin_;
+          end = std::min(own.end_, begin + grain_);
+          own.begin_ = end;
+          return true;
+        }
+      }
+
+      // only one share is locked at a time, so thieves cannot deadlock
+      bool stole = false;
+      for (unsigned k = 1; k < threads_ && !stole; ++k) {
+        Share& victim = shares_[(id + k) % threads_];
+        std::lock_guard<std::mutex> guard(victim.mu_);
+        int64_t left = victim.end_ - victim.begin_;
+        if (left <= 0)
+          continue;
+        if (left <= grain_) {
+          begin = victim.begin_;
+          end = victim.end_;
+          victim.begin_ = end;
+          return true;
+        }
+        begin = victim.end_ - left / 2;
+        end = victim.end_;
+        victim.end_ = begin;
+        stole = true;
+      }
+      if (!stole)
+        return false;
+
+      std::lock_guard<std::mutex> guard(own.mu_);
+      own.begin_ = begin;
+      own.end_ = end;
+    }
+  }
+
+  unsigned PoolSize() {
+    if (const char *env = getenv("NEAT_NUM_THREADS")) {
+      int n = atoi(env);
+      if (n > 0)
+        return n;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  Pool *pool() {
+    // leaked: detached workers may still be waiting on it at exit
+    static Pool *pool = PoolSize() > 1 ? new Pool(PoolSize()) : NULL;
+    return pool;
+  }
+
+  std::mutex& reduction_lock() {
+    static std::mutex mu;
+    return mu;
+  }
+}
+
+extern "C" void neat_parfor(int32_t lo, int32_t hi, neat_parfor_body body, void *env) {
+  if (lo >= hi)
+    return;
+  Pool *p = in_parfor ? NULL : pool();
+  if (p)
+    p->Run(lo, hi, body, env);
+  else
+    body(env, lo, hi);
+}
+
+extern "C" void neat_parfor_lock() {
+  reduction_lock().lock();
+}
+
+extern "C" void neat_parfor_unlock() {
+  reduction_lock().unlock();
+}
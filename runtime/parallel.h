@@ -0,0 +1,21 @@
+#pragma once
+
+// Interface of the parfor runtime, called from generated code and mapped
+// into the JIT by neatc and libneat.
+
+#include <stdint.h>
+
+extern "C" {
+  /** Runs the iterations [lo, hi) of a parfor body. */
+  typedef void (*neat_parfor_body)(void *env, int32_t lo, int32_t hi);
+
+  /** Run body over [lo, hi) in chunks on the thread pool and return when
+      every chunk is done. The calling thread takes part. A parfor started
+      from within a body runs serially on the thread that started it.
+  */
+  void neat_parfor(int32_t lo, int32_t hi, neat_parfor_body body, void *env);
+
+  /** Guard the combining of reduction variables at the end of a chunk. */
+  void neat_parfor_lock();
+  void neat_parfor_unlock();
+}
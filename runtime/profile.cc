@@ -0,0 +1,143 @@
+
+// Runtime support for -fprofile-generate.
+//
+// Instrumented modules register their counter tables from a module
+// constructor. When the program exits, the counters are merged into the
+// profile file. The format is plain text so that it can be inspected and
+// diffed:
+//
+//   neat-profile 1
+//   <function> <hash> <n> <count0> ... <countn-1>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct neat_prof_function {
+  const char *name;
+  uint64_t hash;
+  uint64_t *counters;
+  uint32_t num_counters;
+};
+
+namespace {
+  struct Registration {
+    const neat_prof_function *fns_;
+    uint32_t n_;
+    std::string path_;
+  };
+
+  struct Record {
+    Record() : hash_(0) {}
+    uint64_t hash_;
+    std::vector<uint64_t> counts_;
+  };
+
+  typedef std::map<std::string, Record> Records;
+
+  std::mutex& lock() {
+    static std::mutex mu;
+    return mu;
+  }
+
+  std::vector<Registration>& registrations() {
+    static std::vector<Registration> regs;
+    return regs;
+  }
+
+  void ReadProfile(const std::string& path, Records& records) {
+    FILE *fd = fopen(path.c_str(), "r");
+    if (!fd) return;
+
+    unsigned version;
+    if (fscanf(fd, "neat-profile %u", &version) != 1 || version != 1) {
+      fclose(fd);
+      return;
+    }
+
+    char name[4096];
+    unsigned long long hash, n, count;
+    while (fscanf(fd, "%4095s %llu %llu", name, &hash, &n) == 3) {
+      Record record;
+      record.hash_ = hash;
+      for (unsigned long long i = 0; i < n && fscanf(fd, "%llu", &count) == 1; ++i) {
+        record.counts_.push_back(count);
+      }
+      if (record.counts_.size() != n)
+        break;
+      records[name] = record;
+    }
+    fclose(fd);
+  }
+
+  bool WriteProfile(const std::string& path, const Records& records) {
+    std::string tmp = path + ".tmp";
+    FILE *fd = fopen(tmp.c_str(), "w");
+    if (!fd) return false;
+
+    fprintf(fd, "neat-profile 1\n");
+    for (auto& entry : records) {
+      const Record& record = entry.second;
+      fprintf(fd, "%s %llu %llu", entry.first.c_str(),
+              (unsigned long long) record.hash_,
+              (unsigned long long) record.counts_.size());
+      for (uint64_t count : record.counts_) {
+        fprintf(fd, " %llu", (unsigned long long) count);
+      }
+      fputc('\n', fd);
+    }
+
+    bool ok = !ferror(fd);
+    ok = fclose(fd) == 0 && ok;
+    return ok && rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  void WriteProfiles() {
+    std::lock_guard<std::mutex> guard(lock());
+
+    // group the registrations by the file they are written to, so each
+    // file is read and written once
+    std::map<std::string, std::vector<const Registration*>> files;
+    const char *env = getenv("NEAT_PROFILE_FILE");
+    for (auto& reg : registrations()) {
+      files[env ? std::string(env) : reg.path_].push_back(&reg);
+    }
+
+    for (auto& file : files) {
+      Records records;
+      ReadProfile(file.first, records);
+
+      for (auto reg : file.second) {
+        for (uint32_t i = 0; i < reg->n_; ++i) {
+          const neat_prof_function& fn = reg->fns_[i];
+          Record& record = records[fn.name];
+          if (record.hash_ != fn.hash || record.counts_.size() != fn.num_counters) {
+            // stale or new: replace the previous counts outright
+            record.hash_ = fn.hash;
+            record.counts_.assign(fn.num_counters, 0);
+          }
+          for (uint32_t j = 0; j < fn.num_counters; ++j) {
+            record.counts_[j] += fn.counters[j];
+          }
+        }
+      }
+
+      if (!WriteProfile(file.first, records))
+        fprintf(stderr, "neat: could not write profile '%s'\n", file.first.c_str());
+    }
+  }
+}
+
+extern "C" void __neat_prof_register(const neat_prof_function *fns, uint32_t n,
+                                     const char *path) {
+  std::lock_guard<std::mutex> guard(lock());
+  if (registrations().empty())
+    atexit(WriteProfiles);
+
+  Registration reg = { fns, n, path };
+  registrations().push_back(reg);
+}
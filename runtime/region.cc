@@ -0,0 +1,146 @@
+// Runtime support for regions.
+//
+// A region allocates by bumping a pointer through a chunk, inline in the
+// generated code; this file only runs when a chunk is full. Chunks come
+// in power-of-two size classes from kMinChunk up, and a chunk given back
+// when its region ends is kept on the free list of its class for the
+// next region that needs one, so a program that opens and closes regions
+// in a loop stops calling malloc after the first few iterations.
+//
+// Memory handed out by a region is zeroed, like every other variable in
+// neat. New chunks come zeroed from calloc, and a chunk is zeroed again
+// up to the point its region used it before it goes on a free list.
+//
+// An allocation of more than a quarter of the smallest chunk gets a
+// chunk of its own, so that it does not cut short the chunk the region
+// is bumping through.
+
+#include "region.h"
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct neat_chunk {
+  neat_chunk *next_;
+  /** Bytes in the chunk, including this header. */
+  uint64_t size_;
+  /** The end of the part of the chunk the region used. */
+  char *used_;
+  unsigned class_;
+  /** Keeps the data that follows aligned to 16 bytes. */
+  unsigned pad_;
+};
+
+namespace {
+  const uint64_t kMinChunk = 64 << 10;
+  const unsigned kClasses = 32;
+
+  /** Free chunks kept per class; more are returned to the system. */
+  const unsigned kMaxFree = 16;
+
+  /** Larger requests are certainly a negative length converted to
+      unsigned, or a bug; either way there is no memory for them.
+  */
+  const uint64_t kMaxAlloc = kMinChunk << (kClasses - 2);
+
+  struct FreeLists {
+    std::mutex mu_;
+    neat_chunk *chunks_[kClasses];
+    unsigned counts_[kClasses];
+  };
+
+  FreeLists& free_lists() {
+    // leaked, since regions may still be freed by threads running at exit
+    static FreeLists *lists = new FreeLists();
+    return *lists;
+  }
+
+  char *Data(neat_chunk *chunk) {
+    return reinterpret_cast<char*>(chunk + 1);
+  }
+
+  neat_chunk *Take(uint64_t size) {
+    unsigned c = 0;
+    while ((kMinChunk << c) - sizeof(neat_chunk) < size) {
+      ++c;
+    }
+
+    FreeLists& lists = free_lists();
+    {
+      std::lock_guard<std::mutex> guard(lists.mu_);
+      if (neat_chunk *chunk = lists.chunks_[c]) {
+        lists.chunks_[c] = chunk->next_;
+        --lists.counts_[c];
+        return chunk;
+      }
+    }
+
+    uint64_t bytes = kMinChunk << c;
+    neat_chunk *chunk = static_cast<neat_chunk*>(calloc(1, bytes));
+    if (!chunk) {
+      fprintf(stderr, "neat: out of memory allocating a region chunk of %llu bytes\n",
+              (unsigned long long) bytes);
+      abort();
+    }
+    chunk->size_ = bytes;
+    chunk->class_ = c;
+    return chunk;
+  }
+
+  void Give(neat_chunk *chunk) {
+    memset(Data(chunk), 0, chunk->used_ - Data(chunk));
+    FreeLists& lists = free_lists();
+    {
+      std::lock_guard<std::mutex> guard(lists.mu_);
+      unsigned c = chunk->class_;
+      if (lists.counts_[c] < kMaxFree) {
+        chunk->next_ = lists.chunks_[c];
+        lists.chunks_[c] = chunk;
+        ++lists.counts_[c];
+        return;
+      }
+    }
+    free(chunk);
+  }
+}
+
+extern "C" void *neat_region_refill(neat_region *r, uint64_t size) {
+  if (size > kMaxAlloc) {
+    fprintf(stderr, "neat: cannot allocate %llu bytes from a region\n",
+            (unsigned long long) size);
+    abort();
+  }
+
+  neat_chunk *chunk = Take(size);
+  char *data = Data(chunk);
+  chunk->used_ = data + size;
+
+  // a large allocation goes behind the current chunk, which the region
+  // keeps bumping through
+  if (size > kMinChunk / 4 && r->chunks_) {
+    chunk->next_ = r->chunks_->next_;
+    r->chunks_->next_ = chunk;
+    return data;
+  }
+
+  if (r->chunks_)
+    r->chunks_->used_ = r->cur_;
+  chunk->next_ = r->chunks_;
+  r->chunks_ = chunk;
+  r->cur_ = data + size;
+  r->end_ = reinterpret_cast<char*>(chunk) + chunk->size_;
+  return data;
+}
+
+extern "C" void neat_region_free(neat_region *r) {
+  if (r->chunks_)
+    r->chunks_->used_ = r->cur_;
+  for (neat_chunk *chunk = r->chunks_; chunk; ) {
+    neat_chunk *next = chunk->next_;
+    Give(chunk);
+    chunk = next;
+  }
+  r->cur_ = r->end_ = NULL;
+  r->chunks_ = NULL;
+}
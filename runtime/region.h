@@ -0,0 +1,30 @@
+#pragma once
+
+// Interface of the region allocator, called from generated code and
+// mapped into the JIT by neatc and libneat.
+
+#include <stdint.h>
+
+extern "C" {
+  struct neat_chunk;
+
+  /** A region, as laid out in the frame of the function that opens it.
+      Generated code bumps cur_ inline while the allocation fits before
+      end_, and calls neat_region_refill when it does not. A region
+      starts out zeroed.
+  */
+  struct neat_region {
+    char *cur_;
+    char *end_;
+    /** The chunks the region has taken, the current one first. */
+    neat_chunk *chunks_;
+  };
+
+  /** Allocate size bytes of zeroed memory, aligned to 16 bytes, from a
+      new chunk. size is a multiple of 16.
+  */
+  void *neat_region_refill(neat_region *r, uint64_t size);
+
+  /** Give every chunk of the region back for reuse, and leave it empty. */
+  void neat_region_free(neat_region *r);
+}
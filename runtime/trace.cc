@@ -0,0 +1,216 @@
+
+// Runtime support for -finstrument-functions.
+//
+// Every thread records timestamped entry and exit events into its own
+// ring buffer. The owning thread is the only writer of the head and a
+// background thread is the only writer of the tail, so recording an
+// event takes no locks: a thread-local load, a timestamp read and a
+// store. When a ring is full the event is dropped rather than blocking
+// the program; the number of dropped events is written to the trace.
+//
+// The background thread drains the rings periodically and appends the
+// events to a Chrome trace-event JSON file, which can be loaded in
+// chrome://tracing or Perfetto. The file is neat-trace-<pid>.json unless
+// NEAT_TRACE_FILE is set.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+  /** Timestamps with the top bit set are exit events. */
+  const uint64_t kExitFlag = 1ULL << 63;
+
+  /** Events per thread. Must be a power of two. */
+  const uint64_t kRingSize = 1 << 16;
+
+  struct Event {
+    uint64_t tsc_;
+    const char *name_;
+  };
+
+  struct Ring {
+    Ring(uint32_t tid) : head_(0), tail_(0), tid_(tid), dropped_(0) {}
+
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> tail_;
+    uint32_t tid_;
+    uint64_t dropped_;
+    Event events_[kRingSize];
+  };
+
+  inline uint64_t ReadTSC() {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t(hi) << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+  }
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Tracer {
+    Tracer();
+
+    Ring *Attach();
+    void Run();
+    void Drain(bool final);
+    void Shutdown();
+
+    std::mutex mu_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::vector<Ring*> rings_;
+    std::thread flusher_;
+
+    FILE *out_;
+    bool first_event_;
+
+    // timestamp calibration: ticks are converted to microseconds using
+    // the rate measured between startup and the latest drain
+    uint64_t tsc0_;
+    Clock::time_point time0_;
+    double ticks_per_us_;
+  };
+
+  Tracer *tracer = NULL;
+  std::once_flag tracer_once;
+  __thread Ring *thread_ring = NULL;
+
+  void Shutdown() {
+    tracer->Shutdown();
+  }
+
+  Tracer::Tracer()
+    : stop_(false), out_(NULL), first_event_(true),
+      tsc0_(ReadTSC()), time0_(Clock::now()), ticks_per_us_(0) {
+    std::string path;
+    if (const char *env = getenv("NEAT_TRACE_FILE")) {
+      path = env;
+    } else {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "neat-trace-%d.json", (int) getpid());
+      path = buf;
+    }
+
+    out_ = fopen(path.c_str(), "w");
+    if (!out_) {
+      fprintf(stderr, "neat: could not open trace file '%s'\n", path.c_str());
+      return;
+    }
+    fprintf(out_, "{\"traceEvents\":[\n");
+
+    flusher_ = std::thread(&Tracer::Run, this);
+    atexit(::Shutdown);
+  }
+
+  Ring *Tracer::Attach() {
+    if (!out_)
+      return NULL;
+
+    std::lock_guard<std::mutex> guard(mu_);
+    Ring *ring = new Ring(rings_.size() + 1);
+    rings_.push_back(ring);
+    return ring;
+  }
+
+  void Tracer::Run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stop_) {
+      wake_.wait_for(lock, std::chrono::milliseconds(20));
+      Drain(false);
+    }
+  }
+
+  /** Write out every event recorded so far. Called with mu_ held. */
+  void Tracer::Drain(bool final) {
+    uint64_t ticks = ReadTSC() - tsc0_;
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - time0_).count();
+    if (us > 0 && ticks > 0)
+      ticks_per_us_ = ticks / us;
+    if (ticks_per_us_ <= 0)
+      ticks_per_us_ = 1;
+
+    int pid = getpid();
+    for (auto ring : rings_) {
+      uint64_t head = ring->head_.load(std::memory_order_acquire);
+      uint64_t tail = ring->tail_.load(std::memory_order_relaxed);
+      for (; tail != head; ++tail) {
+        const Event& e = ring->events_[tail & (kRingSize-1)];
+        bool exit = e.tsc_ & kExitFlag;
+        uint64_t tsc = e.tsc_ & ~kExitFlag;
+        double ts = tsc > tsc0_ ? (tsc - tsc0_) / ticks_per_us_ : 0;
+
+        fprintf(out_, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                first_event_ ? "" : ",\n", e.name_, exit ? 'E' : 'B', ts, pid, ring->tid_);
+        first_event_ = false;
+      }
+      ring->tail_.store(tail, std::memory_order_release);
+
+      if (final && ring->dropped_) {
+        fprintf(out_, "%s{\"name\":\"dropped_events\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+                "\"args\":{\"count\":%llu}}", first_event_ ? "" : ",\n", pid, ring->tid_,
+                (unsigned long long) ring->dropped_);
+        first_event_ = false;
+      }
+    }
+    fflush(out_);
+  }
+
+  void Tracer::Shutdown() {
+    {
+      std::lock_guard<std::mutex> guard(mu_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    flusher_.join();
+
+    std::lock_guard<std::mutex> guard(mu_);
+    Drain(true);
+    fprintf(out_, "\n]}\n");
+    fclose(out_);
+    out_ = NULL;
+  }
+
+  inline void RecordEvent(const char *name, uint64_t flag) {
+    Ring *ring = thread_ring;
+    if (!ring) {
+      std::call_once(tracer_once, [] { tracer = new Tracer; });
+      ring = thread_ring = tracer->Attach();
+      if (!ring)
+        return;
+    }
+
+    uint64_t head = ring->head_.load(std::memory_order_relaxed);
+    if (head - ring->tail_.load(std::memory_order_acquire) >= kRingSize) {
+      ++ring->dropped_;
+      return;
+    }
+
+    Event& e = ring->events_[head & (kRingSize-1)];
+    e.tsc_ = ReadTSC() | flag;
+    e.name_ = name;
+    ring->head_.store(head + 1, std::memory_order_release);
+  }
+}
+
+extern "C" void __neat_trace_enter(const char *name) {
+  RecordEvent(name, 0);
+}
+
+extern "C" void __neat_trace_exit(const char *name) {
+  RecordEvent(name, kExitFlag);
+}
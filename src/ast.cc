@@ -1,56 +1,966 @@
 
 #include "ast.h"
+#include "builtins.h"
+#include "codegen.h"
+#include "consteval.h"
+#include "debuginfo.h"
+#include "instrument.h"
+#include "module.h"
+#include "parse.h"
+#include "profile.h"
 #include "scope.h"
+#include "structs.h"
+#include <llvm/GlobalVariable.h>
+#include <llvm/Intrinsics.h>
+#include <llvm/Metadata.h>
 #include <llvm/PassManager.h>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/MDBuilder.h>
 #include <llvm/Transforms/Scalar.h>
+#include <algorithm>
+#include <limits>
+#include <set>
 using std::shared_ptr;
 using namespace llvm;
 
+namespace {
+  /** Allocate a local in the entry block, so that a declaration in a
+      loop body reuses the same slot on every iteration and the slot can
+      be promoted to a register.
+  */
+  AllocaInst *CreateEntryAlloca(IRBuilder<>& irb, Type *type) {
+    BasicBlock& entry = irb.GetInsertBlock()->getParent()->getEntryBlock();
+    IRBuilder<> builder(&entry, entry.begin());
+    return builder.CreateAlloca(type);
+  }
+
+  /** Whether a type is the address of an array or struct, the way
+      those are passed as arguments.
+  */
+  bool IsAggregatePointer(Type *type) {
+    PointerType *ptr = dyn_cast<PointerType>(type);
+    return ptr && ptr->getElementType()->isAggregateType();
+  }
+
+  Type *PointeeType(Value *ptr) {
+    return cast<PointerType>(ptr->getType())->getElementType();
+  }
+
+  /** Whether a type is an unsized array, T[], which is the address of
+      its first element.
+  */
+  bool IsUnsizedArray(Type *type) {
+    PointerType *ptr = dyn_cast<PointerType>(type);
+    return ptr && !ptr->getElementType()->isAggregateType() &&
+           !ptr->getElementType()->isFunctionTy();
+  }
+
+  /** The address of an array or struct given the address of a local,
+      an element or field of another array or struct, or an argument,
+      whose slot holds the address of the caller's array or struct. NULL
+      if it is neither.
+  */
+  Value *AggregateAddress(IRBuilder<>& irb, Value *ptr) {
+    if (!ptr)
+      return NULL;
+    Type *type = PointeeType(ptr);
+    if (IsAggregatePointer(type))
+      return irb.CreateLoad(ptr);
+    return type->isAggregateType() ? ptr : NULL;
+  }
+
+  Value *AggregateAddress(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, ast::Expression *expr) {
+    return AggregateAddress(irb, expr->lvalue(irb, m, scope));
+  }
+
+  /** A vector with every lane set to a scalar. */
+  Value *Splat(IRBuilder<>& irb, Value *scalar, unsigned width) {
+    Value *undef = UndefValue::get(VectorType::get(scalar->getType(), width));
+    Value *vec = irb.CreateInsertElement(undef, scalar, irb.getInt32(0));
+    Value *zeros = ConstantAggregateZero::get(VectorType::get(irb.getInt32Ty(), width));
+    return irb.CreateShuffleVector(vec, undef, zeros);
+  }
+
+  /** Convert a value for storing into a location of a type: a scalar is
+      splatted to every lane of a vector. NULL, with an error, if the
+      types do not match.
+  */
+  Value *Coerce(IRBuilder<>& irb, shared_ptr<Scope> scope, Value *val, Type *type) {
+    if (!val || val->getType() == type)
+      return val;
+    VectorType *vec = dyn_cast<VectorType>(type);
+    if (vec && val->getType() == vec->getElementType())
+      return Splat(irb, val, vec->getNumElements());
+    scope->context().errs_.Error("expected a value of type " + TypeName(type) +
+                                 ", not " + TypeName(val->getType()));
+    return NULL;
+  }
+
+  /** Element-wise arithmetic on ints, floats and vectors of them. A
+      scalar operand of a vector operation applies to every lane.
+  */
+  Value *Arithmetic(IRBuilder<>& irb, shared_ptr<Scope> scope, char op, Value *LHS, Value *RHS) {
+    if (!LHS || !RHS)
+      return NULL;
+    if (LHS->getType()->isVectorTy())
+      RHS = Coerce(irb, scope, RHS, LHS->getType());
+    else
+      LHS = Coerce(irb, scope, LHS, RHS->getType());
+    if (!LHS || !RHS)
+      return NULL;
+    if (!LHS->getType()->isIntOrIntVectorTy() && !LHS->getType()->isFPOrFPVectorTy()) {
+      scope->context().errs_.Error("arithmetic needs ints, floats or vectors, not " +
+                                   TypeName(LHS->getType()));
+      return NULL;
+    }
+
+    bool fp = LHS->getType()->isFPOrFPVectorTy();
+    switch (op) {
+      case '+': return fp ? irb.CreateFAdd(LHS, RHS) : irb.CreateAdd(LHS, RHS);
+      case '-': return fp ? irb.CreateFSub(LHS, RHS) : irb.CreateSub(LHS, RHS);
+      case '*': return fp ? irb.CreateFMul(LHS, RHS) : irb.CreateMul(LHS, RHS);
+      case '/': return fp ? irb.CreateFDiv(LHS, RHS) : irb.CreateSDiv(LHS, RHS);
+    }
+    return NULL;
+  }
+
+  /** Every element and field type is at least 4 bytes and aligned to at
+      least 4 bytes on the targets we support.
+  */
+  const unsigned kAggregateAlign = 4;
+
+  /** Zero a whole array or struct with a single memset. */
+  void ZeroAggregate(IRBuilder<>& irb, Value *dst) {
+    Type *type = cast<PointerType>(dst->getType())->getElementType();
+    irb.CreateMemSet(dst, irb.getInt8(0), ConstantExpr::getSizeOf(type), kAggregateAlign);
+  }
+
+  /** Copy a whole array or struct with a single memcpy. The source must
+      have the same type as the destination.
+  */
+  bool CopyAggregate(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Value *dst, ast::Expression *src) {
+    Type *type = cast<PointerType>(dst->getType())->getElementType();
+    Value *from = AggregateAddress(irb, m, scope, src);
+    if (!from || from->getType() != dst->getType()) {
+      scope->context().errs_.Error("expected a value of type " + TypeName(type));
+      return false;
+    }
+    if (from != dst)
+      irb.CreateMemCpy(dst, from, ConstantExpr::getSizeOf(type), kAggregateAlign);
+    return true;
+  }
+
+  /** Record an assignment to a variable in the known ranges. */
+  void Assigned(shared_ptr<Scope> scope, ast::Expression *lhs, ast::Expression *rhs) {
+    ast::Variable *var = dynamic_cast<ast::Variable*>(lhs);
+    if (var)
+      scope->context().function_.ranges_.Assign(scope->get(var->ident_), rhs, *scope);
+  }
+
+  /** Record that a variable moved by a constant, or by an unknown amount
+      when delta is NULL.
+  */
+  void Stepped(shared_ptr<Scope> scope, ast::Expression *lhs, int64_t sign, ast::Expression *delta) {
+    ast::Variable *var = dynamic_cast<ast::Variable*>(lhs);
+    if (!var)
+      return;
+    RangeFacts& ranges = scope->context().function_.ranges_;
+    ast::IntegerLiteral *lit = dynamic_cast<ast::IntegerLiteral*>(delta);
+    if (lit)
+      ranges.Add(scope->get(var->ident_), sign * lit->value_);
+    else
+      ranges.Forget(scope->get(var->ident_));
+  }
+
+  /** The integer and floating-point predicates of a comparison operator.
+      Returns false if oper does not compare.
+  */
+  bool Predicates(StringRef oper, CmpInst::Predicate& ipred, CmpInst::Predicate& fpred) {
+    static const struct {
+      const char *oper_;
+      CmpInst::Predicate ipred_;
+      CmpInst::Predicate fpred_;
+    } kComparisons[] = {
+      { "==", CmpInst::ICMP_EQ, CmpInst::FCMP_OEQ },
+      { "!=", CmpInst::ICMP_NE, CmpInst::FCMP_UNE },
+      { "<", CmpInst::ICMP_SLT, CmpInst::FCMP_OLT },
+      { "<=", CmpInst::ICMP_SLE, CmpInst::FCMP_OLE },
+      { ">", CmpInst::ICMP_SGT, CmpInst::FCMP_OGT },
+      { ">=", CmpInst::ICMP_SGE, CmpInst::FCMP_OGE },
+    };
+    for (auto& cmp : kComparisons) {
+      if (oper == cmp.oper_) {
+        ipred = cmp.ipred_;
+        fpred = cmp.fpred_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Compare two values, giving an i1, or a vector of them for each
+      lane of vectors. As in arithmetic, a scalar compared with a vector
+      is compared with every lane; other operands must be ints, floats or
+      vectors of the same type.
+  */
+  Value *CompareBits(IRBuilder<>& irb, shared_ptr<Scope> scope, CmpInst::Predicate ipred,
+                     CmpInst::Predicate fpred, Value *LHS, Value *RHS) {
+    if (!LHS || !RHS)
+      return NULL;
+    if (LHS->getType()->isVectorTy())
+      RHS = Coerce(irb, scope, RHS, LHS->getType());
+    else
+      LHS = Coerce(irb, scope, LHS, RHS->getType());
+    if (!LHS || !RHS)
+      return NULL;
+    if (!LHS->getType()->isIntOrIntVectorTy() && !LHS->getType()->isFPOrFPVectorTy()) {
+      scope->context().errs_.Error("comparisons need ints, floats or vectors, not " +
+                                   TypeName(LHS->getType()));
+      return NULL;
+    }
+    return LHS->getType()->isFPOrFPVectorTy() ? irb.CreateFCmp(fpred, LHS, RHS)
+                                              : irb.CreateICmp(ipred, LHS, RHS);
+  }
+
+  /** Compare two values, giving an int 0 or 1, or a vector of them for
+      each lane of vectors.
+  */
+  Value *Compare(IRBuilder<>& irb, shared_ptr<Scope> scope, CmpInst::Predicate ipred,
+                 CmpInst::Predicate fpred, Value *LHS, Value *RHS) {
+    Value *cmp = CompareBits(irb, scope, ipred, fpred, LHS, RHS);
+    if (!cmp)
+      return NULL;
+    Type *type = irb.getInt32Ty();
+    if (VectorType *vec = dyn_cast<VectorType>(cmp->getType()))
+      type = VectorType::get(type, vec->getNumElements());
+    return irb.CreateZExt(cmp, type);
+  }
+
+  /** Whether a scalar condition holds, as an i1: an int or float that is
+      not zero. Returns NULL for other types.
+  */
+  Value *Truth(IRBuilder<>& irb, shared_ptr<Scope> scope, Value *val) {
+    Type *type = val->getType();
+    if (type->isIntegerTy())
+      return irb.CreateICmpNE(val, Constant::getNullValue(type));
+    if (type->isFloatingPointTy())
+      return irb.CreateFCmpUNE(val, Constant::getNullValue(type));
+    scope->context().errs_.Error("a condition must be an int or a float, not '" +
+                                 TypeName(type) + "'");
+    return NULL;
+  }
+
+  /** Branch on the truth of a condition's value, with one conditional
+      branch.
+  */
+  BranchInst *BranchOnValue(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope,
+                            ast::Expression *cond, BasicBlock *t, BasicBlock *f) {
+    Value *val = cond->Codegen(irb, m, scope);
+    Value *bit = val ? Truth(irb, scope, val) : NULL;
+    return irb.CreateCondBr(bit ? bit : irb.getFalse(), t, f);
+  }
+
+  /** Branch to t if a condition holds and to f if not. A comparison
+      branches on its i1 directly, ! swaps the targets, and each operand
+      of && and || gets a branch of its own, so the right one is only
+      evaluated when the left one did not decide; no truth value is
+      computed just to be tested again.
+  */
+  void Branch(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, ast::Expression *cond,
+              BasicBlock *t, BasicBlock *f) {
+    if (auto op = dynamic_cast<ast::UnaryOperation*>(cond)) {
+      if (op->oper_ == "!") {
+        Branch(irb, m, scope, op->expr_.get(), f, t);
+        return;
+      }
+    }
+
+    auto op = dynamic_cast<ast::BinaryOperation*>(cond);
+    bool and_ = op && op->oper_ == "&&";
+    if (and_ || (op && op->oper_ == "||")) {
+      BasicBlock *rhs = BasicBlock::Create(irb.getContext(), "", irb.GetInsertBlock()->getParent());
+      Branch(irb, m, scope, op->LHS_.get(), and_ ? rhs : t, and_ ? f : rhs);
+      irb.SetInsertPoint(rhs);
+
+      // the right operand runs knowing how the left one turned out, as
+      // in i < n && a[i] > 0; whether it ran at all is not known after
+      RangeFacts& ranges = scope->context().function_.ranges_;
+      RangeFacts before = ranges;
+      ranges.Restrict(op->LHS_.get(), *scope, and_);
+      Branch(irb, m, scope, op->RHS_.get(), t, f);
+      ranges.Join(before);
+      return;
+    }
+
+    CmpInst::Predicate ipred, fpred;
+    if (op && Predicates(op->oper_, ipred, fpred)) {
+      Value *LHS = op->LHS_->Codegen(irb, m, scope);
+      Value *RHS = op->RHS_->Codegen(irb, m, scope);
+      Value *bit = CompareBits(irb, scope, ipred, fpred, LHS, RHS);
+      if (bit && bit->getType()->isVectorTy()) {
+        scope->context().errs_.Error("a condition must be an int or a float, not a vector");
+        bit = NULL;
+      }
+      irb.CreateCondBr(bit ? bit : irb.getFalse(), t, f);
+      return;
+    }
+
+    BranchOnValue(irb, m, scope, cond, t, f);
+  }
+
+  /** The constant an address is in, or NULL. */
+  GlobalVariable *ConstantAt(Value *ptr) {
+    GlobalVariable *g = ptr ? dyn_cast<GlobalVariable>(GetUnderlyingObject(ptr)) : NULL;
+    return g && g->isConstant() ? g : NULL;
+  }
+
+  /** An address that may be assigned, or NULL, with an error, for one
+      in a constant.
+  */
+  Value *Writable(shared_ptr<Scope> scope, Value *ptr) {
+    if (GlobalVariable *g = ConstantAt(ptr)) {
+      scope->context().errs_.Error("'" + g->getName().str() + "' is a constant");
+      return NULL;
+    }
+    return ptr;
+  }
+
+  /** Load from an address. A constant at a constant address, such as
+      an element of a table at a literal index, folds to its value.
+  */
+  Value *Load(IRBuilder<>& irb, Value *ptr) {
+    if (Constant *c = dyn_cast<Constant>(ptr)) {
+      if (Constant *val = ConstantFoldLoadFromConstPtr(c))
+        return val;
+    }
+    return irb.CreateLoad(ptr);
+  }
+
+  /** Assign an expression to a location: arrays and structs are copied
+      whole.
+  */
+  Value *Store(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Value *ptr, ast::Expression *expr) {
+    if (!Writable(scope, ptr))
+      return NULL;
+    if (PointeeType(ptr)->isAggregateType()) {
+      CopyAggregate(irb, m, scope, ptr, expr);
+      return NULL;
+    }
+    Value *val = Coerce(irb, scope, expr->Codegen(irb, m, scope), PointeeType(ptr));
+    if (val)
+      irb.CreateStore(val, ptr);
+    return val;
+  }
+
+  /** The address of a field of the struct at ptr. NULL, with an error,
+      if it is not a struct or has no such field.
+  */
+  Value *FieldAddress(IRBuilder<>& irb, shared_ptr<Scope> scope, Value *ptr, StringRef field) {
+    if (!ptr)
+      return NULL;
+    uint64_t n;
+    const StructInfo *info = StructOf(PointeeType(ptr), n);
+    if (!info || n) {
+      scope->context().errs_.Error("only structs have fields");
+      return NULL;
+    }
+    int slot = info->Slot(field);
+    if (slot < 0) {
+      scope->context().errs_.Error("'" + info->name_ + "' has no field '" + field.str() + "'");
+      return NULL;
+    }
+    return irb.CreateStructGEP(ptr, slot);
+  }
+
+  /** Generate an argument for a parameter. Arrays and structs are
+      passed by address and must match the parameter's type exactly.
+  */
+  Value *CallArgument(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, ast::Expression *expr, Type *param) {
+    if (!IsAggregatePointer(param))
+      return expr->Codegen(irb, m, scope);
+
+    Type *type = cast<PointerType>(param)->getElementType();
+    Value *addr = AggregateAddress(irb, m, scope, expr);
+    if (!addr || addr->getType() != param) {
+      scope->context().errs_.Error("expected an argument of type " + TypeName(type));
+      return NULL;
+    }
+    // the callee may write to its argument, so it gets a copy of a
+    // constant; the copy is in the caller's frame, which keeps the call
+    // out of tail position like passing a local array does
+    if (ConstantAt(addr)) {
+      Value *copy = CreateEntryAlloca(irb, type);
+      irb.CreateMemCpy(copy, addr, ConstantExpr::getSizeOf(type), kAggregateAlign);
+      return copy;
+    }
+    return addr;
+  }
+
+  typedef std::vector<std::unique_ptr<ast::Statement>> Statements;
+
+  /** Collect the names of the variables an expression or statement
+      refers to. Names that turn out to be functions, or variables local
+      to the statement, are filtered out by the caller's scope.
+  */
+  void Referenced(const ast::Expression *expr, std::set<std::string>& names) {
+    if (!expr)
+      return;
+    if (auto var = dynamic_cast<const ast::Variable*>(expr)) {
+      names.insert(var->ident_.str());
+    } else if (auto op = dynamic_cast<const ast::UnaryOperation*>(expr)) {
+      Referenced(op->expr_.get(), names);
+    } else if (auto op = dynamic_cast<const ast::BinaryOperation*>(expr)) {
+      Referenced(op->LHS_.get(), names);
+      Referenced(op->RHS_.get(), names);
+    } else if (auto call = dynamic_cast<const ast::CallOperation*>(expr)) {
+      Referenced(call->expr_.get(), names);
+      for (auto& arg : call->args_)
+        Referenced(arg.get(), names);
+    } else if (auto index = dynamic_cast<const ast::IndexOperation*>(expr)) {
+      Referenced(index->expr_.get(), names);
+      Referenced(index->index_.get(), names);
+    } else if (auto field = dynamic_cast<const ast::FieldAccess*>(expr)) {
+      Referenced(field->expr_.get(), names);
+    }
+  }
+
+  void Referenced(const Statements& stmts, std::set<std::string>& names) {
+    for (auto& stmt : stmts) {
+      if (auto var = dynamic_cast<const ast::VariableAssignment*>(stmt.get())) {
+        Referenced(var->expr_.get(), names);
+      } else if (auto expr = dynamic_cast<const ast::ExpressionStatement*>(stmt.get())) {
+        Referenced(expr->expr_.get(), names);
+      } else if (auto if_ = dynamic_cast<const ast::If*>(stmt.get())) {
+        Referenced(if_->expr_.get(), names);
+        Referenced(if_->then_stmts_, names);
+        Referenced(if_->else_stmts_, names);
+      } else if (auto switch_ = dynamic_cast<const ast::Switch*>(stmt.get())) {
+        Referenced(switch_->expr_.get(), names);
+        for (auto& c : switch_->cases_)
+          Referenced(c.stmts_, names);
+        Referenced(switch_->default_stmts_, names);
+      } else if (auto while_ = dynamic_cast<const ast::While*>(stmt.get())) {
+        Referenced(while_->expr_.get(), names);
+        Referenced(while_->stmts_, names);
+      } else if (auto parfor = dynamic_cast<const ast::Parfor*>(stmt.get())) {
+        Referenced(parfor->lo_.get(), names);
+        Referenced(parfor->hi_.get(), names);
+        for (auto& reduction : parfor->reductions_)
+          names.insert(reduction.var_.str());
+        Referenced(parfor->stmts_, names);
+      } else if (auto region = dynamic_cast<const ast::Region*>(stmt.get())) {
+        Referenced(region->stmts_, names);
+      } else if (auto ret = dynamic_cast<const ast::Return*>(stmt.get())) {
+        Referenced(ret->expr_.get(), names);
+      }
+    }
+  }
+
+  /** Report statements that would leave a parfor body other than by
+      finishing an iteration: a return, or a break outside of a loop
+      nested in the body. A nested parfor checks its own body.
+  */
+  bool CheckParforBody(const Statements& stmts, bool in_loop, Messages& errs) {
+    for (auto& stmt : stmts) {
+      if (dynamic_cast<const ast::Return*>(stmt.get())) {
+        errs.Error("return is not allowed in a parfor body");
+        return false;
+      } else if (!in_loop && dynamic_cast<const ast::Break*>(stmt.get())) {
+        errs.Error("break is not allowed in a parfor body outside of a nested loop");
+        return false;
+      } else if (auto if_ = dynamic_cast<const ast::If*>(stmt.get())) {
+        if (!CheckParforBody(if_->then_stmts_, in_loop, errs) ||
+            !CheckParforBody(if_->else_stmts_, in_loop, errs))
+          return false;
+      } else if (auto switch_ = dynamic_cast<const ast::Switch*>(stmt.get())) {
+        for (auto& c : switch_->cases_) {
+          if (!CheckParforBody(c.stmts_, in_loop, errs))
+            return false;
+        }
+        if (!CheckParforBody(switch_->default_stmts_, in_loop, errs))
+          return false;
+      } else if (auto while_ = dynamic_cast<const ast::While*>(stmt.get())) {
+        if (!CheckParforBody(while_->stmts_, true, errs))
+          return false;
+      } else if (auto region = dynamic_cast<const ast::Region*>(stmt.get())) {
+        if (!CheckParforBody(region->stmts_, in_loop, errs))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  /** The value a reduction starts from, which leaves any value it is
+      combined with unchanged.
+  */
+  Constant *Identity(Type *type, StringRef oper) {
+    Type *elem = type->getScalarType();
+    bool fp = elem->isFloatingPointTy();
+    double inf = std::numeric_limits<double>::infinity();
+    Constant *c;
+    if (oper == "+")
+      c = Constant::getNullValue(elem);
+    else if (oper == "*")
+      c = fp ? ConstantFP::get(elem, 1.0) : ConstantInt::get(elem, 1);
+    else if (fp)
+      c = ConstantFP::get(elem, oper == "min" ? inf : -inf);
+    else if (oper == "min")
+      c = ConstantInt::get(elem->getContext(), APInt::getSignedMaxValue(elem->getIntegerBitWidth()));
+    else
+      c = ConstantInt::get(elem->getContext(), APInt::getSignedMinValue(elem->getIntegerBitWidth()));
+
+    if (VectorType *vec = dyn_cast<VectorType>(type))
+      return ConstantVector::getSplat(vec->getNumElements(), c);
+    return c;
+  }
+
+  /** Free the regions opened since the first `from` of the open ones,
+      innermost first, before leaving them by a jump.
+  */
+  void FreeRegions(IRBuilder<>& irb, Module& m, const CodegenContext::FunctionState& state,
+                   size_t from) {
+    for (size_t i = state.regions_.size(); i > from; --i) {
+      FreeRegion(irb, m, state.regions_[i - 1]);
+    }
+  }
+
+  /** The regions opened in the innermost loop. */
+  size_t LoopRegions(const CodegenContext::FunctionState& state) {
+    return state.loop_regions_.empty() ? 0 : state.loop_regions_.back();
+  }
+
+  /** Whether an argument is, or points into, memory the caller was
+      passed as one of its own parameters, which outlives the caller.
+  */
+  bool FromParameter(Value *arg, const CodegenContext::FunctionState& state) {
+    LoadInst *load = dyn_cast<LoadInst>(GetUnderlyingObject(arg));
+    return load && std::find(state.args_.begin(), state.args_.end(),
+                             load->getPointerOperand()) != state.args_.end();
+  }
+
+  /** Why a call with these arguments can be neither a tail call nor a
+      jump back to the top of the caller, or NULL if it can. An array or
+      struct of the caller's frame, including the copy a constant is
+      passed as, is gone once the caller returns, and a jump reuses its
+      slot for the next iteration. Memory allocated from
+      a region the caller opened is freed before either, so no pointer
+      that may come from one can be passed while a region is open.
+  */
+  const char *TailCallBlocker(const std::vector<Value*>& args,
+                              const CodegenContext::FunctionState& state) {
+    for (Value *arg : args) {
+      if (!arg->getType()->isPointerTy() || FromParameter(arg, state))
+        continue;
+      if (IsAggregatePointer(arg->getType()))
+        return "it passes the address of a local array or struct, or a copy of a constant";
+      if (!state.regions_.empty())
+        return "it may pass memory of a region that is freed first";
+    }
+    return NULL;
+  }
+
+  /** Generate a statement, attributing its code to the statement's line
+      when emitting line tables.
+  */
+  void Generate(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, ast::Statement& stmt) {
+    CodegenContext& context = scope->context();
+    if (context.debug_info_)
+      DebugInfo::SetLine(irb, context.function_.debug_scope_, stmt.line_);
+    stmt.Codegen(irb, m, scope);
+  }
+
+  /** One case of a switch: the values that select it and its body. */
+  struct SwitchCase {
+    std::vector<int> values_;
+    const Statements *stmts_;
+  };
+
+  /** Generate a switch on an int value, for a switch statement or a
+      chain of ifs. Each case, and the default, starts from the ranges
+      known before the switch, and a case selected by a variable's values
+      knows the variable is within them. An if chain counts as the same
+      switch in profiles, with a counter per case and the default.
+  */
+  void GenerateSwitch(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Value *value,
+                      const ast::Expression *subject, const std::vector<SwitchCase>& cases,
+                      const Statements& default_stmts) {
+    LLVMContext& ctx = irb.getContext();
+    llvm::Function *f = irb.GetInsertBlock()->getParent();
+    BasicBlock *default_ = BasicBlock::Create(ctx, "default");
+    BasicBlock *end = BasicBlock::Create(ctx);
+
+    unsigned num_values = 0;
+    for (auto& c : cases) {
+      num_values += c.values_.size();
+    }
+    SwitchInst *sw = irb.CreateSwitch(value, default_, num_values);
+
+    auto variable = dynamic_cast<const ast::Variable*>(subject);
+    Value *var = variable ? scope->get(variable->ident_) : NULL;
+
+    RangeFacts& ranges = scope->context().function_.ranges_;
+    RangeFacts before = ranges;
+    RangeFacts after;
+    bool falls = false;
+
+    Profile *profile = scope->context().profile_;
+    std::vector<unsigned> counters(1);
+    for (size_t i = 0; i <= cases.size(); ++i) {
+      // the default comes last
+      const SwitchCase *c = i < cases.size() ? &cases[i] : NULL;
+      BasicBlock *block = c ? BasicBlock::Create(ctx, "case") : default_;
+      f->getBasicBlockList().push_back(block);
+      irb.SetInsertPoint(block);
+
+      unsigned counter = profile ? profile->Counter(irb, Profile::SWITCH_CASE) : 0;
+      ranges = before;
+      if (c) {
+        for (int v : c->values_) {
+          sw->addCase(irb.getInt32(v), block);
+          counters.push_back(counter);
+        }
+        if (var) {
+          auto bounds = std::minmax_element(c->values_.begin(), c->values_.end());
+          ranges.Set(var, *bounds.first, *bounds.second);
+        }
+      } else {
+        counters[0] = counter;
+      }
+
+      auto caseScope = scope->derive();
+      for (auto& stmt : c ? *c->stmts_ : default_stmts) {
+        Generate(irb, m, caseScope, *stmt);
+      }
+
+      // only the cases that reach the end contribute to what is known
+      // after the switch
+      if (irb.GetInsertBlock()->getTerminator() == NULL) {
+        irb.CreateBr(end);
+        if (falls)
+          after.Join(ranges);
+        else
+          after = ranges;
+        falls = true;
+      }
+    }
+    if (profile)
+      profile->SwitchWeights(sw, counters);
+    ranges = falls ? after : before;
+
+    f->getBasicBlockList().push_back(end);
+    irb.SetInsertPoint(end);
+  }
+
+  /** The value of an integer literal, which may be negated. */
+  bool LiteralValue(const ast::Expression *expr, int& value) {
+    if (auto lit = dynamic_cast<const ast::IntegerLiteral*>(expr)) {
+      value = lit->value_;
+      return true;
+    }
+    auto op = dynamic_cast<const ast::UnaryOperation*>(expr);
+    if (!op || op->oper_ != "-" || !LiteralValue(op->expr_.get(), value))
+      return false;
+    value = -value;
+    return true;
+  }
+
+  /** Whether a condition compares one variable with literals, x == 1 or
+      x == 1 || x == 2, adding the literals to values. name is the
+      variable, or empty if it is not known yet.
+  */
+  bool ChainCondition(const ast::Expression *cond, StringRef& name, std::vector<int>& values) {
+    auto op = dynamic_cast<const ast::BinaryOperation*>(cond);
+    if (!op)
+      return false;
+    if (op->oper_ == "||")
+      return ChainCondition(op->LHS_.get(), name, values) &&
+             ChainCondition(op->RHS_.get(), name, values);
+    if (op->oper_ != "==")
+      return false;
+
+    const ast::Expression *lhs = op->LHS_.get();
+    const ast::Expression *rhs = op->RHS_.get();
+    if (dynamic_cast<const ast::Variable*>(rhs))
+      std::swap(lhs, rhs);
+    auto var = dynamic_cast<const ast::Variable*>(lhs);
+    int value;
+    if (!var || !LiteralValue(rhs, value) || (!name.empty() && var->ident_ != name))
+      return false;
+    name = var->ident_;
+    values.push_back(value);
+    return true;
+  }
+
+  /** Fewer ifs in a chain are left to generate as branches. */
+  const size_t kMinSwitchChain = 3;
+
+  /** Find a chain of ifs, each the only statement in the else of the one
+      before, comparing one variable with literals. A value compared
+      again further down the chain can never get there, so it only
+      selects the first case; a case left without values is dropped. The
+      default is the else of the last if of the chain.
+  */
+  bool SwitchChain(const ast::If& first, StringRef& name, std::vector<SwitchCase>& cases,
+                   const Statements *&default_stmts) {
+    std::set<int> seen;
+    size_t links = 0;
+    const ast::If *link = &first;
+    std::vector<int> values;
+    if (!ChainCondition(link->expr_.get(), name, values))
+      return false;
+    for (;;) {
+      ++links;
+      SwitchCase c;
+      for (int v : values) {
+        if (seen.insert(v).second)
+          c.values_.push_back(v);
+      }
+      c.stmts_ = &link->then_stmts_;
+      if (!c.values_.empty())
+        cases.push_back(c);
+
+      const Statements& rest = link->else_stmts_;
+      link = rest.size() == 1 ? dynamic_cast<const ast::If*>(rest[0].get()) : NULL;
+      values.clear();
+      if (!link || !ChainCondition(link->expr_.get(), name, values)) {
+        default_stmts = &rest;
+        return links >= kMinSwitchChain;
+      }
+    }
+  }
+
+  /** Entry points of runtime/parallel.cc. */
+  const char *const kParforRun = "neat_parfor";
+  const char *const kParforLock = "neat_parfor_lock";
+  const char *const kParforUnlock = "neat_parfor_unlock";
+
+  void CallRuntime(IRBuilder<>& irb, Module& m, const char *name) {
+    Constant *f = m.getOrInsertFunction(name, FunctionType::get(irb.getVoidTy(), false));
+    irb.CreateCall(f);
+  }
+}
+
 namespace ast {
+  void Expression::FreeChildren() {
+    // each node is emptied before it is destroyed, so its destructor
+    // finds nothing left to free
+    std::vector<std::unique_ptr<Expression>> stack;
+    TakeChildren(stack);
+    while (!stack.empty()) {
+      std::unique_ptr<Expression> node = std::move(stack.back());
+      stack.pop_back();
+      node->TakeChildren(stack);
+    }
+  }
+
+  void UnaryOperation::TakeChildren(std::vector<std::unique_ptr<Expression>>& stack) {
+    if (expr_)
+      stack.push_back(std::move(expr_));
+  }
+
+  void BinaryOperation::TakeChildren(std::vector<std::unique_ptr<Expression>>& stack) {
+    if (LHS_)
+      stack.push_back(std::move(LHS_));
+    if (RHS_)
+      stack.push_back(std::move(RHS_));
+  }
+
+  void IndexOperation::TakeChildren(std::vector<std::unique_ptr<Expression>>& stack) {
+    if (expr_)
+      stack.push_back(std::move(expr_));
+    if (index_)
+      stack.push_back(std::move(index_));
+  }
+
+  void FieldAccess::TakeChildren(std::vector<std::unique_ptr<Expression>>& stack) {
+    if (expr_)
+      stack.push_back(std::move(expr_));
+  }
+
+  void CallOperation::TakeChildren(std::vector<std::unique_ptr<Expression>>& stack) {
+    if (expr_)
+      stack.push_back(std::move(expr_));
+    for (auto& arg : args_) {
+      if (arg)
+        stack.push_back(std::move(arg));
+    }
+    args_.clear();
+  }
+
   void Program::Codegen(Module& m, shared_ptr<Scope> scope) {
+    // constants before functions, so that every function can use them,
+    // and imports before constants, so that a constant cannot take the
+    // name of an imported function
+    scope->context().globals_ = scope.get();
+    for (auto& stmt : stmts_) {
+      if (dynamic_cast<Import*>(stmt.get()))
+        stmt->Codegen(m, scope);
+    }
+    for (auto& stmt : stmts_) {
+      if (dynamic_cast<ConstDecl*>(stmt.get()))
+        stmt->Codegen(m, scope);
+    }
     for (auto& stmt : stmts_) {
-      stmt->Codegen(m, scope);
+      if (!dynamic_cast<Import*>(stmt.get()) && !dynamic_cast<ConstDecl*>(stmt.get()))
+        stmt->Codegen(m, scope);
+    }
+  }
+
+  void ConstDecl::Codegen(Module& m, shared_ptr<Scope> scope) {
+    if (m.getFunction(name_) || scope->has(name_)) {
+      scope->context().errs_.Error("'" + name_.str() + "' is already defined");
+      return;
+    }
+
+    Type *i32 = Type::getInt32Ty(m.getContext());
+    Constant *init;
+    if (ArrayType *array = dyn_cast<ArrayType>(type_)) {
+      std::vector<Constant*> elems;
+      for (int value : values_) {
+        elems.push_back(ConstantInt::get(i32, value));
+      }
+      elems.resize(array->getNumElements(), ConstantInt::get(i32, 0));
+      init = ConstantArray::get(array, elems);
+    } else {
+      init = ConstantInt::get(i32, values_[0]);
     }
+
+    // nothing outside the module refers to it, and nothing compares its
+    // address, so identical constants can share one copy; the suffix
+    // keeps its symbol apart from functions, which are looked up by name
+    GlobalVariable *g = new GlobalVariable(m, type_, true, GlobalValue::PrivateLinkage, init,
+                                           name_ + ".const");
+    g->setUnnamedAddr(true);
+    scope->define(name_, g);
+  }
+
+  void Import::Codegen(Module& m, shared_ptr<Scope> scope) {
+    const ModuleGraph *imports = scope->context().imports_;
+    const Interface *iface = imports ? imports->Find(path_) : NULL;
+    if (iface)
+      iface->Declare(m, scope->context().errs_);
   }
 
   void Function::Codegen(Module& m, shared_ptr<Scope> scope) {
+    if (ConstantAt(scope->get(name_))) {
+      scope->context().errs_.Error("'" + name_.str() + "' is already defined");
+      return;
+    }
+
     LLVMContext& ctx = m.getContext();
-    FunctionType *prototype = FunctionType::get(rettype_ ? rettype_ : Type::getVoidTy(ctx), type_args_, false);
+    std::vector<Type*> params;
+    for (Type *type : type_args_) {
+      params.push_back(ParameterType(type));
+    }
+    FunctionType *prototype = FunctionType::get(rettype_ ? rettype_ : Type::getVoidTy(ctx), params, false);
     llvm::Function *f = static_cast<llvm::Function*>(m.getOrInsertFunction(name_, prototype));
+    if (!scope->context().options_.IsExported(name_)) {
+      f->setLinkage(GlobalValue::InternalLinkage);
+      f->setCallingConv(CallingConv::Fast);
+    }
 
     IRBuilder<> irb(BasicBlock::Create(ctx, "entry", f));
+    Profile *profile = scope->context().profile_;
+    if (profile)
+      profile->BeginFunction(irb, f);
+
+    CodegenContext::FunctionState& state = scope->context().function_;
+    state = CodegenContext::FunctionState();
+    state.f_ = f;
+    if (DebugInfo *debug_info = scope->context().debug_info_) {
+      state.debug_scope_ = debug_info->BeginFunction(f, line_);
+      DebugInfo::SetLine(irb, state.debug_scope_, line_);
+    }
+
     auto innerScope = scope->derive();
     llvm::Function::arg_iterator args = f->arg_begin();
     for (auto& name : name_args_) {
       llvm::Value *v = args++;
+      llvm::AllocaInst *arg = NULL;
       if (!name.empty()) {
         v->setName(name);
-        llvm::AllocaInst *arg = irb.CreateAlloca(v->getType());
+        arg = irb.CreateAlloca(v->getType());
         irb.CreateStore(v, arg);
         innerScope->define(name, arg);
       }
+      state.args_.push_back(arg);
     }
 
+    // tail recursion jumps here; if it is never used, the CFG
+    // simplification below folds the block back into the entry block
+    state.body_ = BasicBlock::Create(ctx, "body", f);
+    irb.CreateBr(state.body_);
+    irb.SetInsertPoint(state.body_);
+
     for (auto& stmt : stmts_) {
-      stmt->Codegen(irb, m, innerScope);
+      Generate(irb, m, innerScope, *stmt);
     }
 
     if (irb.GetInsertBlock()->getTerminator() == NULL)
       irb.CreateRetVoid();
 
+    if (profile)
+      profile->EndFunction();
+
+    if (ShouldInstrument(scope->context().options_, name_))
+      InstrumentFunction(*f);
+    state = CodegenContext::FunctionState();
+
     llvm::FunctionPassManager pm(&m);
     pm.add(llvm::createCFGSimplificationPass());
     pm.run(*f);
   }
 
   void VariableAssignment::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
-    LLVMContext& ctx = irb.getContext();
-    llvm::AllocaInst *inst = irb.CreateAlloca(Type::getInt32Ty(ctx));
-    irb.CreateStore(expr_->Codegen(irb, m, scope), inst);
-    scope->define(name_, inst);
+    Type *type = type_ ? type_ : irb.getInt32Ty();
+    if (type == RegionType(irb.getContext())) {
+      scope->context().errs_.Error("regions are opened with region blocks, not declared");
+      return;
+    }
+    if (ConstantAt(scope->get(name_))) {
+      scope->context().errs_.Error("'" + name_.str() + "' is a constant");
+      return;
+    }
+    llvm::AllocaInst *inst = CreateEntryAlloca(irb, type);
+
+    if (type->isAggregateType()) {
+      // zero with a single memset, or copy another one with a memcpy
+      IntegerLiteral *lit = dynamic_cast<IntegerLiteral*>(expr_.get());
+      if (!expr_ || (lit && lit->value_ == 0))
+        ZeroAggregate(irb, inst);
+      else if (!CopyAggregate(irb, m, scope, inst, expr_.get()))
+        return;
+    } else {
+      Value *val = expr_ ? expr_->Codegen(irb, m, scope) : Constant::getNullValue(type);
+      val = Coerce(irb, scope, val, type);
+      if (!val)
+        return;
+      irb.CreateStore(val, inst);
+    }
+
+    if (scope->define(name_, inst) && type->isIntegerTy(32)) {
+      IntegerLiteral zero(0);
+      scope->context().function_.ranges_.Assign(inst, expr_ ? expr_.get() : &zero, *scope);
+    }
   }
 
   void If::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    // a chain over an int variable, rather than a function of that name
+    StringRef name;
+    std::vector<SwitchCase> cases;
+    const Statements *default_stmts = NULL;
+    if (scope->context().options_.if_to_switch_ &&
+        SwitchChain(*this, name, cases, default_stmts) && !m.getFunction(name)) {
+      Value *var = scope->get(name);
+      if (var && PointeeType(var)->isIntegerTy(32)) {
+        Variable subject(name);
+        GenerateSwitch(irb, m, scope, irb.CreateLoad(var), &subject, cases, *default_stmts);
+        return;
+      }
+    }
+
     LLVMContext& ctx = irb.getContext();
     llvm::Function *f = irb.GetInsertBlock()->getParent();
     BasicBlock *if_ = BasicBlock::Create(ctx, "", f);
@@ -61,36 +971,81 @@ namespace ast {
     irb.CreateBr(if_);
     irb.SetInsertPoint(if_);
 
-    Value *expr = expr_->Codegen(irb, m, scope);
-    Value *cond = irb.CreateICmpNE(expr, ConstantInt::get(expr->getType(), 0));
-    irb.CreateCondBr(cond, then, else_);
+    // profile counters and weights belong to a single branch
+    Profile *profile = scope->context().profile_;
+    BranchInst *br = NULL;
+    if (profile)
+      br = BranchOnValue(irb, m, scope, expr_.get(), then, else_);
+    else
+      Branch(irb, m, scope, expr_.get(), then, else_);
 
     f->getBasicBlockList().push_back(then);
     irb.SetInsertPoint(then);
 
+    unsigned then_count = profile ? profile->Counter(irb, Profile::IF_THEN) : 0;
+
+    // each branch starts from the ranges known before the if, narrowed
+    // by the condition
+    RangeFacts& ranges = scope->context().function_.ranges_;
+    RangeFacts before = ranges;
+    ranges.Restrict(expr_.get(), *scope, true);
+
     auto thenScope = scope->derive();
     for (auto& stmt : then_stmts_) {
-      stmt->Codegen(irb, m, thenScope);
+      Generate(irb, m, thenScope, *stmt);
     }
 
-    if (then->getTerminator() == NULL)
+    // a nested statement may have moved the insertion point out of then
+    bool then_falls = irb.GetInsertBlock()->getTerminator() == NULL;
+    if (then_falls)
       irb.CreateBr(end);
+    RangeFacts after_then = ranges;
+    ranges = before;
+    ranges.Restrict(expr_.get(), *scope, false);
 
     f->getBasicBlockList().push_back(else_);
     irb.SetInsertPoint(else_);
 
+    if (profile) {
+      unsigned else_count = profile->Counter(irb, Profile::IF_ELSE);
+      profile->BranchWeights(br, then_count, else_count);
+    }
+
     auto elseScope = scope->derive();
     for (auto& stmt : else_stmts_) {
-      stmt->Codegen(irb, m, elseScope);
+      Generate(irb, m, elseScope, *stmt);
     }
 
-    if (else_->getTerminator() == NULL)
+    bool else_falls = irb.GetInsertBlock()->getTerminator() == NULL;
+    if (else_falls)
       irb.CreateBr(end);
 
+    // only the branches that reach the end contribute to what is known
+    // after the if
+    if (then_falls && else_falls)
+      ranges.Join(after_then);
+    else if (then_falls)
+      ranges = after_then;
+
     f->getBasicBlockList().push_back(end);
     irb.SetInsertPoint(end);
   }
 
+  void Switch::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    Value *value = expr_ ? expr_->Codegen(irb, m, scope) : NULL;
+    if (!value || !value->getType()->isIntegerTy(32)) {
+      scope->context().errs_.Error("switch expects an int");
+      return;
+    }
+
+    std::vector<SwitchCase> cases;
+    for (auto& c : cases_) {
+      SwitchCase sc = { c.values_, &c.stmts_ };
+      cases.push_back(sc);
+    }
+    GenerateSwitch(irb, m, scope, value, expr_.get(), cases, default_stmts_);
+  }
+
   void While::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
     LLVMContext& ctx = irb.getContext();
     llvm::Function *f = irb.GetInsertBlock()->getParent();
@@ -98,43 +1053,330 @@ namespace ast {
     BasicBlock *then = BasicBlock::Create(ctx);
     BasicBlock *end = BasicBlock::Create(ctx);
 
+    // LLVM 3.1 has neither llvm.loop hints nor a loop vectorizer, and its
+    // unroller reads no metadata, so the hints are still emitted but
+    // have no effect
+    if (unroll_ || vectorize_)
+      scope->context().errs_.Warning("warning: line " + utostr(line_) +
+                                     ": @unroll and @vectorize are ignored by this LLVM version");
+
     irb.CreateBr(start);
     irb.SetInsertPoint(start);
 
-    Value *expr = expr_->Codegen(irb, m, scope);
-    Value *cond = irb.CreateICmpNE(expr, ConstantInt::get(expr->getType(), 0));
-    irb.CreateCondBr(cond, then, end);
+    LoopRanges ranges(scope->context().function_.ranges_, *this, *scope);
+    // profile counters and weights belong to a single branch
+    Profile *profile = scope->context().profile_;
+    BranchInst *br = NULL;
+    if (profile)
+      br = BranchOnValue(irb, m, scope, expr_.get(), then, end);
+    else
+      Branch(irb, m, scope, expr_.get(), then, end);
 
     f->getBasicBlockList().push_back(then);
     irb.SetInsertPoint(then);
+    ranges.EnterBody();
+
+    unsigned body_count = profile ? profile->Counter(irb, Profile::WHILE_BODY) : 0;
 
-    auto innerScope = scope->derive(then, end);
+    // continue re-evaluates the condition
+    CodegenContext::FunctionState& state = scope->context().function_;
+    state.loop_regions_.push_back(state.regions_.size());
+    auto innerScope = scope->derive(start, end);
     for (auto& stmt : stmts_) {
-      stmt->Codegen(irb, m, innerScope);
+      Generate(irb, m, innerScope, *stmt);
+    }
+    state.loop_regions_.pop_back();
+    if (irb.GetInsertBlock()->getTerminator() == NULL) {
+      BranchInst *latch = irb.CreateBr(start);
+      if (MDNode *hints = LoopMetadata(ctx))
+        latch->setMetadata("llvm.loop", hints);
+    }
+
+    if (profile) {
+      unsigned exit_count = profile->EdgeCounter(br, 1, Profile::WHILE_EXIT);
+      profile->BranchWeights(br, body_count, exit_count);
+    }
+
+    f->getBasicBlockList().push_back(end);
+    irb.SetInsertPoint(end);
+    ranges.Exit();
+  }
+
+  MDNode *While::LoopMetadata(LLVMContext& ctx) const {
+    if (!unroll_ && !vectorize_)
+      return NULL;
+
+    // loop metadata refers to itself as its first operand so that
+    // identical hints on different loops are never merged together
+    MDNode *tmp = MDNode::getTemporary(ctx, ArrayRef<Value*>());
+    std::vector<Value*> ops;
+    ops.push_back(tmp);
+
+    Type *i32 = Type::getInt32Ty(ctx);
+    if (unroll_) {
+      Value *hint[] = { MDString::get(ctx, "llvm.loop.unroll.count"),
+                        ConstantInt::get(i32, unroll_) };
+      ops.push_back(MDNode::get(ctx, hint));
+    }
+    if (vectorize_) {
+      Value *hint[] = { MDString::get(ctx, "llvm.loop.vectorize.enable"),
+                        ConstantInt::getTrue(ctx) };
+      ops.push_back(MDNode::get(ctx, hint));
+    }
+    if (vectorize_ > 1) {
+      Value *hint[] = { MDString::get(ctx, "llvm.loop.vectorize.width"),
+                        ConstantInt::get(i32, vectorize_) };
+      ops.push_back(MDNode::get(ctx, hint));
+    }
+
+    MDNode *loop = MDNode::get(ctx, ops);
+    loop->replaceOperandWith(0, loop);
+    MDNode::deleteTemporary(tmp);
+    return loop;
+  }
+
+  void Parfor::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    CodegenContext& context = scope->context();
+    Messages& errs = context.errs_;
+    Type *i32 = irb.getInt32Ty();
+
+    if (scope->has(var_)) {
+      errs.Error("parfor variable '" + var_.str() + "' is already defined");
+      return;
+    }
+    if (!CheckParforBody(stmts_, false, errs))
+      return;
+    for (auto& reduction : reductions_) {
+      Value *var = scope->get(reduction.var_);
+      if (!var || PointeeType(var)->isAggregateType() || IsAggregatePointer(PointeeType(var)) ||
+          ConstantAt(var)) {
+        errs.Error("'" + reduction.var_.str() + "' is not a variable that can be reduced");
+        return;
+      }
+    }
+
+    ParforRanges ranges(context.function_.ranges_, *this, *scope);
+    Value *lo = lo_->Codegen(irb, m, scope);
+    Value *hi = hi_->Codegen(irb, m, scope);
+    if (!lo || !hi)
+      return;
+    if (lo->getType() != i32 || hi->getType() != i32) {
+      errs.Error("the bounds of a parfor must be ints");
+      return;
+    }
+
+    // the body reaches the variables of this function through an
+    // environment holding their addresses
+    std::set<std::string> names;
+    Referenced(stmts_, names);
+    for (auto& reduction : reductions_)
+      names.insert(reduction.var_.str());
+
+    std::vector<std::string> captures;
+    std::vector<Type*> fields;
+    for (auto& name : names) {
+      // constants are reached directly
+      Value *var = scope->get(name);
+      if (var && !ConstantAt(var)) {
+        // allocating bumps the region's pointer without a lock, so
+        // threads can only allocate from regions of their own
+        Type *region = RegionType(irb.getContext());
+        Type *type = PointeeType(var);
+        if (type == region || type == PointerType::getUnqual(region)) {
+          errs.Error("region '" + name + "' cannot be used in a parfor body; "
+                     "open a region inside the body instead");
+          return;
+        }
+        captures.push_back(name);
+        fields.push_back(var->getType());
+      }
+    }
+    StructType *env_type = StructType::get(irb.getContext(), fields);
+    AllocaInst *env = CreateEntryAlloca(irb, env_type);
+    for (size_t i = 0; i < captures.size(); ++i) {
+      irb.CreateStore(scope->get(captures[i]), irb.CreateStructGEP(env, i));
+    }
+
+    llvm::Function *body = Outline(m, scope, captures, env_type, ranges);
+    Type *i8ptr = irb.getInt8PtrTy();
+    Type *params[] = { i32, i32, body->getType(), i8ptr };
+    Constant *run = m.getOrInsertFunction(kParforRun, FunctionType::get(irb.getVoidTy(), params, false));
+    Value *args[] = { lo, hi, body, irb.CreateBitCast(env, i8ptr) };
+    irb.CreateCall(run, args);
+    ranges.Exit();
+  }
+
+  /** Generate the body as a function that runs the iterations [lo, hi),
+      void f(i8 *env, int lo, int hi), then go back to generating the
+      enclosing function.
+  */
+  llvm::Function *Parfor::Outline(Module& m, shared_ptr<Scope> scope,
+                                  const std::vector<std::string>& captures,
+                                  StructType *env_type, const ParforRanges& ranges) {
+    CodegenContext& context = scope->context();
+    LLVMContext& ctx = m.getContext();
+    Type *i32 = Type::getInt32Ty(ctx);
+    Type *params[] = { Type::getInt8PtrTy(ctx), i32, i32 };
+    FunctionType *type = FunctionType::get(Type::getVoidTy(ctx), params, false);
+    llvm::Function *f = llvm::Function::Create(type, GlobalValue::InternalLinkage,
+                                               context.function_.f_->getName() + ".parfor", &m);
+
+    CodegenContext::FunctionState outer = context.function_;
+    Profile *profile = context.profile_;
+    context.function_ = CodegenContext::FunctionState();
+    context.function_.f_ = f;
+    context.profile_ = NULL;
+
+    llvm::Function::arg_iterator args = f->arg_begin();
+    Value *env_arg = args++;
+    Value *lo = args++;
+    Value *hi = args++;
+    env_arg->setName("env");
+    lo->setName("lo");
+    hi->setName("hi");
+
+    IRBuilder<> irb(BasicBlock::Create(ctx, "entry", f));
+    if (context.debug_info_) {
+      context.function_.debug_scope_ = context.debug_info_->BeginFunction(f, line_);
+      DebugInfo::SetLine(irb, context.function_.debug_scope_, line_);
+    }
+    Value *env = irb.CreateBitCast(env_arg, env_type->getPointerTo());
+
+    // reductions accumulate into private copies, combined into the
+    // shared variables once the chunk is done
+    struct Partial {
+      StringRef oper_;
+      Value *shared_;
+      AllocaInst *partial_;
+    };
+    auto inner = context.globals_ ? context.globals_->derive() : shared_ptr<Scope>(new Scope(&context));
+    std::vector<Partial> partials;
+    for (size_t i = 0; i < captures.size(); ++i) {
+      Value *var = irb.CreateLoad(irb.CreateStructGEP(env, i), captures[i]);
+      for (auto& reduction : reductions_) {
+        if (reduction.var_ != captures[i])
+          continue;
+        Type *elem = PointeeType(var);
+        AllocaInst *partial = irb.CreateAlloca(elem);
+        irb.CreateStore(Identity(elem, reduction.oper_), partial);
+        Partial p = { reduction.oper_, var, partial };
+        partials.push_back(p);
+        var = partial;
+        break;
+      }
+      inner->define(captures[i], var);
+    }
+
+    AllocaInst *iv = irb.CreateAlloca(i32, 0, var_);
+    irb.CreateStore(lo, iv);
+    inner->define(var_, iv);
+
+    BasicBlock *cond = BasicBlock::Create(ctx, "", f);
+    BasicBlock *then = BasicBlock::Create(ctx, "", f);
+    BasicBlock *latch = BasicBlock::Create(ctx);
+    BasicBlock *end = BasicBlock::Create(ctx);
+
+    irb.CreateBr(cond);
+    irb.SetInsertPoint(cond);
+    irb.CreateCondBr(irb.CreateICmpSLT(irb.CreateLoad(iv), hi), then, end);
+
+    irb.SetInsertPoint(then);
+    ranges.EnterBody(context.function_.ranges_, iv);
+
+    // continue moves on to the next iteration
+    auto bodyScope = inner->derive(latch, end);
+    for (auto& stmt : stmts_) {
+      Generate(irb, m, bodyScope, *stmt);
     }
     if (irb.GetInsertBlock()->getTerminator() == NULL)
-      irb.CreateBr(start);
+      irb.CreateBr(latch);
+
+    // i < hi, so the increment cannot overflow
+    f->getBasicBlockList().push_back(latch);
+    irb.SetInsertPoint(latch);
+    irb.CreateStore(irb.CreateNSWAdd(irb.CreateLoad(iv), irb.getInt32(1)), iv);
+    irb.CreateBr(cond);
 
     f->getBasicBlockList().push_back(end);
     irb.SetInsertPoint(end);
+    if (!partials.empty()) {
+      CallRuntime(irb, m, kParforLock);
+      for (auto& p : partials) {
+        Value *total = CombineReduction(irb, p.oper_, irb.CreateLoad(p.shared_),
+                                        irb.CreateLoad(p.partial_));
+        irb.CreateStore(total, p.shared_);
+      }
+      CallRuntime(irb, m, kParforUnlock);
+    }
+    irb.CreateRetVoid();
+
+    context.function_ = outer;
+    context.profile_ = profile;
+
+    llvm::FunctionPassManager pm(&m);
+    pm.add(llvm::createCFGSimplificationPass());
+    pm.run(*f);
+    return f;
+  }
+
+  void Region::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    CodegenContext::FunctionState& state = scope->context().function_;
+    auto innerScope = scope->derive();
+    AllocaInst *region = CreateEntryAlloca(irb, RegionType(irb.getContext()));
+    if (!innerScope->define(name_, region)) {
+      scope->context().errs_.Error("'" + name_.str() + "' is already defined");
+      return;
+    }
+    irb.CreateStore(Constant::getNullValue(PointeeType(region)), region);
+
+    state.regions_.push_back(region);
+    for (auto& stmt : stmts_) {
+      Generate(irb, m, innerScope, *stmt);
+    }
+    state.regions_.pop_back();
+    if (irb.GetInsertBlock()->getTerminator() == NULL)
+      FreeRegion(irb, m, region);
+  }
+
+  void ExpressionStatement::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    // the only place builtins without a value can be called
+    CallOperation *call = dynamic_cast<CallOperation*>(expr_.get());
+    Variable *callee = call ? dynamic_cast<Variable*>(call->expr_.get()) : NULL;
+    if (callee && IsStatementBuiltin(callee->ident_)) {
+      CodegenBuiltin(callee->ident_, *call, irb, m, scope);
+      return;
+    }
+    (void) expr_->Codegen(irb, m, scope);
   }
 
   void Return::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
-    irb.CreateRet(expr_ ? expr_->Codegen(irb, m, scope) : NULL);
+    if (CallOperation *call = dynamic_cast<CallOperation*>(expr_.get())) {
+      call->CodegenTail(irb, m, scope);
+      return;
+    }
+    Value *val = expr_ ? expr_->Codegen(irb, m, scope) : NULL;
+    FreeRegions(irb, m, scope->context().function_, 0);
+    irb.CreateRet(val);
   }
 
   void Break::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
     // TODO: signal an error when break is used incorrectly
     const Scope::Block *block = scope->block();
-    if (block)
+    const CodegenContext::FunctionState& state = scope->context().function_;
+    if (block) {
+      FreeRegions(irb, m, state, LoopRegions(state));
       irb.CreateBr(block->second);
+    }
   }
 
   void Continue::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
     // TODO: signal an error when continue is used incorrectly
     const Scope::Block *block = scope->block();
-    if (block)
+    const CodegenContext::FunctionState& state = scope->context().function_;
+    if (block) {
+      FreeRegions(irb, m, state, LoopRegions(state));
       irb.CreateBr(block->first);
+    }
   }
 
   Value *IntegerLiteral::Codegen(IRBuilder<>& irb, Module&, shared_ptr<Scope>) {
@@ -146,11 +1388,11 @@ namespace ast {
     if (f)
       return f;
 
-    auto val = lvalue(scope);
-    return val ? irb.CreateLoad(val) : NULL;
+    auto val = lvalue(irb, m, scope);
+    return val ? Load(irb, val) : NULL;
   }
 
-  AllocaInst *Variable::lvalue(std::shared_ptr<Scope> scope) const {
+  Value *Variable::lvalue(IRBuilder<>&, Module&, shared_ptr<Scope> scope) {
     return scope->get(ident_);
   }
 
@@ -163,93 +1405,399 @@ namespace ast {
           case 0:
             return expr_->Codegen(irb, m, scope);
           case '+': {
-            AllocaInst *ptr = expr_->lvalue(scope);
+            Value *ptr = Writable(scope, expr_->lvalue(irb, m, scope));
             if (!ptr) return NULL;
-            Value *val = irb.CreateAdd(expr_->Codegen(irb, m, scope), irb.getInt32(1));
+            Value *val = Arithmetic(irb, scope, '+', irb.CreateLoad(ptr), irb.getInt32(1));
+            if (!val) return NULL;
             irb.CreateStore(val, ptr);
+            IntegerLiteral one(1);
+            Stepped(scope, expr_.get(), 1, &one);
             return val;
           }
         }
       case '-':
         switch (ch2) {
-          case 0:
-            return irb.CreateNeg(expr_->Codegen(irb, m, scope));
+          case 0: {
+            Value *val = expr_->Codegen(irb, m, scope);
+            if (!val) return NULL;
+            return val->getType()->isFPOrFPVectorTy() ? irb.CreateFNeg(val) : irb.CreateNeg(val);
+          }
           case '-': {
-            AllocaInst *ptr = expr_->lvalue(scope);
+            Value *ptr = Writable(scope, expr_->lvalue(irb, m, scope));
             if (!ptr) return NULL;
-            Value *val = irb.CreateSub(expr_->Codegen(irb, m, scope), irb.getInt32(1));
+            Value *val = Arithmetic(irb, scope, '-', irb.CreateLoad(ptr), irb.getInt32(1));
+            if (!val) return NULL;
             irb.CreateStore(val, ptr);
+            IntegerLiteral one(1);
+            Stepped(scope, expr_.get(), -1, &one);
             return val;
           }
         }
+        return NULL;
+      case '!': {
+        // logical not, lane by lane for vectors
+        Value *val = expr_->Codegen(irb, m, scope);
+        if (!val) return NULL;
+        return Compare(irb, scope, CmpInst::ICMP_EQ, CmpInst::FCMP_OEQ, val,
+                       Constant::getNullValue(val->getType()));
+      }
     }
     return NULL;
   }
 
   Value *BinaryOperation::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    CmpInst::Predicate ipred, fpred;
+    if (Predicates(oper_, ipred, fpred)) {
+      Value *LHS = LHS_->Codegen(irb, m, scope);
+      Value *RHS = RHS_->Codegen(irb, m, scope);
+      return Compare(irb, scope, ipred, fpred, LHS, RHS);
+    }
+
+    if (oper_ == "&&" || oper_ == "||") {
+      // branch as a condition would, then merge the outcomes into 1 or 0
+      llvm::Function *f = irb.GetInsertBlock()->getParent();
+      BasicBlock *t = BasicBlock::Create(irb.getContext(), "", f);
+      BasicBlock *e = BasicBlock::Create(irb.getContext(), "", f);
+      BasicBlock *end = BasicBlock::Create(irb.getContext(), "", f);
+      Branch(irb, m, scope, this, t, e);
+      irb.SetInsertPoint(t);
+      irb.CreateBr(end);
+      irb.SetInsertPoint(e);
+      irb.CreateBr(end);
+      irb.SetInsertPoint(end);
+      PHINode *phi = irb.CreatePHI(irb.getInt32Ty(), 2);
+      phi->addIncoming(irb.getInt32(1), t);
+      phi->addIncoming(irb.getInt32(0), e);
+      return phi;
+    }
+
     char ch1 = oper_[0];
     char ch2 = oper_.size() > 1 ? oper_[1] : 0;
     switch (ch1) {
       case '+':
-        switch (ch2) {
-          case 0: {
-            Value *LHS = LHS_->Codegen(irb, m, scope);
-            Value *RHS = RHS_->Codegen(irb, m, scope);
-            return irb.CreateAdd(LHS, RHS);
-          }
-          case '=': {
-            AllocaInst *ptr = LHS_->lvalue(scope);
-            if (!ptr) return NULL;
-            Value *val = irb.CreateAdd(LHS_->Codegen(irb, m, scope),
-                                       RHS_->Codegen(irb, m, scope));
-            irb.CreateStore(val, ptr);
-            return val;
-          }
-        }
       case '-':
+      case '*':
+      case '/':
         switch (ch2) {
           case 0: {
             Value *LHS = LHS_->Codegen(irb, m, scope);
             Value *RHS = RHS_->Codegen(irb, m, scope);
-            return irb.CreateSub(LHS, RHS);
+            return Arithmetic(irb, scope, ch1, LHS, RHS);
           }
           case '=': {
-            AllocaInst *ptr = LHS_->lvalue(scope);
+            Value *ptr = Writable(scope, LHS_->lvalue(irb, m, scope));
             if (!ptr) return NULL;
-            Value *val = irb.CreateSub(LHS_->Codegen(irb, m, scope),
-                                       RHS_->Codegen(irb, m, scope));
+            Value *val = Arithmetic(irb, scope, ch1, irb.CreateLoad(ptr),
+                                    RHS_->Codegen(irb, m, scope));
+            if (!val) return NULL;
             irb.CreateStore(val, ptr);
+            if (ch1 == '+' || ch1 == '-')
+              Stepped(scope, LHS_.get(), ch1 == '+' ? 1 : -1, RHS_.get());
+            else
+              Stepped(scope, LHS_.get(), 0, NULL);
             return val;
           }
         }
+        return NULL;
       case '=':
         switch (ch2) {
           case 0: {
-            AllocaInst *ptr = LHS_->lvalue(scope);
+            if (IndexOperation *index = dynamic_cast<IndexOperation*>(LHS_.get()))
+              return index->Assign(irb, m, scope, RHS_.get());
+            Value *ptr = LHS_->lvalue(irb, m, scope);
             if (!ptr) return NULL;
-            Value *RHS = RHS_->Codegen(irb, m, scope);
-            irb.CreateStore(RHS, ptr);
-            return RHS;
-          }
-          case '=': {
-            Value *LHS = LHS_->Codegen(irb, m, scope);
-            Value *RHS = RHS_->Codegen(irb, m, scope);
-            return irb.CreateICmpEQ(LHS, RHS);
+            Value *val = Store(irb, m, scope, ptr, RHS_.get());
+            Assigned(scope, LHS_.get(), RHS_.get());
+            return val;
           }
         }
+        return NULL;
     }
     return NULL;
   }
 
+  Value *IndexOperation::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    // a lane of a vector variable or element, or of a vector value
+    Value *ptr = expr_->lvalue(irb, m, scope);
+    Value *vec = NULL;
+    if (ptr && PointeeType(ptr)->isVectorTy())
+      vec = irb.CreateLoad(ptr);
+    else if (!ptr)
+      vec = expr_->Codegen(irb, m, scope);
+    if (vec && IsUnsizedArray(vec->getType())) {
+      ptr = Unsized(irb, m, scope, vec);
+      return ptr ? irb.CreateLoad(ptr) : NULL;
+    }
+    if (vec) {
+      VectorType *type = dyn_cast<VectorType>(vec->getType());
+      if (!type) {
+        scope->context().errs_.Error("only arrays and vectors can be indexed");
+        return NULL;
+      }
+      Value *lane = Index(irb, m, scope, type);
+      return lane ? irb.CreateExtractElement(vec, lane) : NULL;
+    }
+
+    ptr = Element(irb, m, scope, ptr);
+    return ptr ? Load(irb, ptr) : NULL;
+  }
+
+  Value *IndexOperation::lvalue(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    Value *ptr = expr_->lvalue(irb, m, scope);
+    if (ptr && PointeeType(ptr)->isVectorTy()) {
+      scope->context().errs_.Error("a lane of a vector can only be read or assigned");
+      return NULL;
+    }
+    return Element(irb, m, scope, ptr);
+  }
+
+  Value *IndexOperation::Assign(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Expression *value) {
+    Value *ptr = expr_->lvalue(irb, m, scope);
+    if (!ptr || !PointeeType(ptr)->isVectorTy()) {
+      ptr = Element(irb, m, scope, ptr);
+      return ptr ? Store(irb, m, scope, ptr, value) : NULL;
+    }
+
+    VectorType *type = cast<VectorType>(PointeeType(ptr));
+    Value *lane = Index(irb, m, scope, type);
+    if (!lane)
+      return NULL;
+    Value *val = Coerce(irb, scope, value->Codegen(irb, m, scope), type->getElementType());
+    if (!val)
+      return NULL;
+    irb.CreateStore(irb.CreateInsertElement(irb.CreateLoad(ptr), val, lane), ptr);
+    return val;
+  }
+
+  Value *IndexOperation::Field(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, StringRef field) {
+    Value *array = AggregateAddress(irb, expr_->lvalue(irb, m, scope));
+    uint64_t n;
+    const StructInfo *info = array ? StructOf(PointeeType(array), n) : NULL;
+    if (!info || !n)
+      return FieldAddress(irb, scope, Element(irb, m, scope, array), field);
+
+    // element i of field f is element i of the array of f
+    int slot = info->Slot(field);
+    if (slot < 0) {
+      scope->context().errs_.Error("'" + info->name_ + "' has no field '" + field.str() + "'");
+      return NULL;
+    }
+    Value *column = irb.CreateStructGEP(array, slot);
+    Value *index = Index(irb, m, scope, PointeeType(column));
+    if (!index)
+      return NULL;
+    Value *indices[] = { irb.getInt32(0), index };
+    return irb.CreateInBoundsGEP(column, indices);
+  }
+
+  Value *IndexOperation::Element(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Value *ptr) {
+    if (ptr && IsUnsizedArray(PointeeType(ptr)))
+      return Unsized(irb, m, scope, irb.CreateLoad(ptr));
+
+    Value *array = AggregateAddress(irb, ptr);
+    uint64_t n;
+    if (array && StructOf(PointeeType(array), n) && n) {
+      scope->context().errs_.Error("elements of " + TypeName(PointeeType(array)) +
+                                   " are stored field by field, and can only be used a field at a time");
+      return NULL;
+    }
+    if (!array || !PointeeType(array)->isArrayTy()) {
+      scope->context().errs_.Error("only arrays and vectors can be indexed");
+      return NULL;
+    }
+    Value *index = Index(irb, m, scope, PointeeType(array));
+    if (!index)
+      return NULL;
+    Value *indices[] = { irb.getInt32(0), index };
+    return irb.CreateInBoundsGEP(array, indices);
+  }
+
+  Value *IndexOperation::Unsized(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Value *base) {
+    Value *index = index_->Codegen(irb, m, scope);
+    if (!index || !index->getType()->isIntegerTy(32)) {
+      scope->context().errs_.Error("index must be an int");
+      return NULL;
+    }
+    return irb.CreateInBoundsGEP(base, index);
+  }
+
+  Value *IndexOperation::Index(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope, Type *type) {
+    CodegenContext& context = scope->context();
+    uint64_t size = isa<ArrayType>(type) ? cast<ArrayType>(type)->getNumElements()
+                                         : cast<VectorType>(type)->getNumElements();
+
+    IntegerLiteral *lit = dynamic_cast<IntegerLiteral*>(index_.get());
+    if (lit && (lit->value_ < 0 || uint64_t(lit->value_) >= size)) {
+      context.errs_.Error("index " + std::to_string(lit->value_) +
+                          " is out of bounds for " + TypeName(type));
+      return NULL;
+    }
+
+    Value *index = index_->Codegen(irb, m, scope);
+    if (!index || !index->getType()->isIntegerTy(32)) {
+      context.errs_.Error("index must be an int");
+      return NULL;
+    }
+
+    CodegenContext::FunctionState& state = context.function_;
+    if (!context.options_.bounds_check_) {
+      // unchecked
+    } else if (state.ranges_.InBounds(index_.get(), *scope, size)) {
+      ++context.bounds_checks_removed_;
+    } else {
+      // one unsigned compare rejects negative indices too; every failed
+      // check in the function shares a single trap
+      ++context.bounds_checks_;
+      LLVMContext& ctx = irb.getContext();
+      llvm::Function *f = irb.GetInsertBlock()->getParent();
+      if (!state.trap_) {
+        state.trap_ = BasicBlock::Create(ctx, "trap", f);
+        IRBuilder<> trap(state.trap_);
+        trap.CreateCall(Intrinsic::getDeclaration(&m, Intrinsic::trap));
+        trap.CreateUnreachable();
+      }
+      BasicBlock *ok = BasicBlock::Create(ctx, "", f);
+      Value *in_bounds = irb.CreateICmpULT(index, irb.getInt32(size));
+      BranchInst *br = irb.CreateCondBr(in_bounds, ok, state.trap_);
+      br->setMetadata(LLVMContext::MD_prof, MDBuilder(ctx).createBranchWeights(2000, 1));
+      irb.SetInsertPoint(ok);
+    }
+
+    return index;
+  }
+
+  Value *FieldAccess::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    Value *ptr = lvalue(irb, m, scope);
+    return ptr ? irb.CreateLoad(ptr) : NULL;
+  }
+
+  Value *FieldAccess::lvalue(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    if (IndexOperation *index = dynamic_cast<IndexOperation*>(expr_.get()))
+      return index->Field(irb, m, scope, field_);
+    return FieldAddress(irb, scope, AggregateAddress(irb, m, scope, expr_.get()), field_);
+  }
+
   llvm::Value *CallOperation::Codegen(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    Variable *callee = dynamic_cast<Variable*>(expr_.get());
+    if (callee && IsStatementBuiltin(callee->ident_)) {
+      scope->context().errs_.Error("'" + callee->ident_.str() +
+                                   "' has no value and can only be called as a statement");
+      return NULL;
+    }
+    if (callee && IsBuiltin(callee->ident_))
+      return CodegenBuiltin(callee->ident_, *this, irb, m, scope);
+
     llvm::Function *f = llvm::dyn_cast<llvm::Function>(expr_->Codegen(irb, m, scope));
     if (!f || f->getArgumentList().size() != args_.size())
       return NULL;
 
+    if (ConstEval *consteval = scope->context().consteval_) {
+      std::vector<int32_t> values;
+      for (auto& expr : args_) {
+        int value;
+        if (!LiteralValue(expr.get(), value))
+          break;
+        values.push_back(value);
+      }
+
+      int32_t result;
+      if (values.size() == args_.size() && consteval->Evaluate(f->getName(), values, result))
+        return irb.getInt32(result);
+    }
+
     std::vector<llvm::Value*> args;
+    llvm::Function::arg_iterator param = f->arg_begin();
     for (auto& expr : args_) {
-      args.push_back(expr->Codegen(irb, m, scope));
+      Value *arg = CallArgument(irb, m, scope, expr.get(), (param++)->getType());
+      if (!arg)
+        return NULL;
+      args.push_back(arg);
+    }
+    CallInst *call = irb.CreateCall(f, args);
+    call->setCallingConv(f->getCallingConv());
+    return call;
+  }
+
+  void CallOperation::CodegenTail(IRBuilder<>& irb, Module& m, shared_ptr<Scope> scope) {
+    CodegenContext& context = scope->context();
+    const CodegenContext::FunctionState& state = context.function_;
+    llvm::Function *caller = irb.GetInsertBlock()->getParent();
+    llvm::Function *f = dyn_cast_or_null<llvm::Function>(expr_->Codegen(irb, m, scope));
+
+    Value *val = NULL;
+    const char *reason = NULL;
+    if (f && f == state.f_ && state.body_ && args_.size() == state.args_.size()) {
+      // evaluate every argument before storing any of them, since the
+      // arguments may refer to the current parameter values
+      std::vector<llvm::Value*> args;
+      llvm::Function::arg_iterator param = f->arg_begin();
+      for (auto& expr : args_) {
+        Value *arg = CallArgument(irb, m, scope, expr.get(), (param++)->getType());
+        if (!arg)
+          return;
+        args.push_back(arg);
+      }
+      reason = TailCallBlocker(args, state);
+      if (!reason) {
+        for (size_t i = 0; i < args.size(); ++i) {
+          if (state.args_[i])
+            irb.CreateStore(args[i], state.args_[i]);
+        }
+        FreeRegions(irb, m, state, 0);
+        irb.CreateBr(state.body_);
+        return;
+      }
+      // an ordinary call then, with the arguments already evaluated
+      CallInst *call = irb.CreateCall(f, args);
+      call->setCallingConv(f->getCallingConv());
+      val = call;
+    } else {
+      val = Codegen(irb, m, scope);
+    }
+
+    CallInst *call = dyn_cast_or_null<CallInst>(val);
+    Variable *callee = dynamic_cast<Variable*>(expr_.get());
+    if (reason) {
+      // neither converted nor marked
+    } else if (val && (isa<Constant>(val) || (callee && IsBuiltin(callee->ident_)))) {
+      // evaluated at compile time, or a builtin; nothing is left to call
+    } else if (!call) {
+      reason = "the callee is not a known function";
+    } else if (call->getType() != caller->getReturnType()) {
+      reason = "its result type does not match the caller's";
+    } else {
+      std::vector<Value*> args(call->op_begin(), call->op_begin() + call->getNumArgOperands());
+      reason = TailCallBlocker(args, state);
+      if (!reason) {
+        // a tail call that does not return its result as is, or whose
+        // calling conventions differ, can still be marked but is not
+        // guaranteed to be lowered as a jump
+        call->setTailCall();
+        if (f->getCallingConv() != CallingConv::Fast ||
+            caller->getCallingConv() != CallingConv::Fast)
+          reason = "the caller and callee do not both use fastcc (see -fwhole-program)";
+      }
     }
-    return f ? irb.CreateCall(f, args) : NULL;
+
+    // the result is computed before the regions it may use are freed,
+    // which leaves the call no longer in tail position
+    if (!state.regions_.empty()) {
+      FreeRegions(irb, m, state, 0);
+      if (call)
+        call->setTailCall(false);
+      if (!reason)
+        reason = "regions are freed after the call";
+    }
+
+    if (reason && context.options_.warn_tail_calls_) {
+      std::string callee = f ? f->getName().str() : std::string("<expression>");
+      context.errs_.Warning("warning: tail call from '" + caller->getName().str() +
+                            "' to '" + callee + "' was not converted: " + reason);
+    }
+
+    if (val && !caller->getReturnType()->isVoidTy())
+      irb.CreateRet(val);
+    else
+      irb.CreateRetVoid();
   }
 }
@@ -7,7 +7,9 @@
 #include <string.h>
 #include <vector>
 
+struct ParforRanges;
 struct Scope;
+struct StructInfo;
 
 namespace ast {
   struct TopLevel {
@@ -16,14 +18,32 @@ namespace ast {
   };
 
   struct Statement {
+    Statement() : line_(0) {}
     virtual ~Statement() {}
     virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>) = 0;
+
+    /** The source line the statement starts on, for debug info; 0 when
+        unknown.
+    */
+    unsigned line_;
   };
 
   struct Expression {
     virtual ~Expression() {}
     virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>) = 0;
-    virtual llvm::AllocaInst *lvalue(std::shared_ptr<Scope>) const { return NULL; }
+    /** The address the expression refers to, or NULL if it cannot be
+        assigned.
+    */
+    virtual llvm::Value *lvalue(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>) { return NULL; }
+
+    /** Move the operands of the node onto a stack, leaving it a leaf. */
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&) {}
+
+  protected:
+    /** Destroy the operands without recursing, so a tree of any depth
+        can be freed. Nodes with operands call it from their destructors.
+    */
+    void FreeChildren();
   };
 
   struct Program : TopLevel {
@@ -32,22 +52,63 @@ namespace ast {
     void Append(std::unique_ptr<TopLevel> stmt) { stmts_.push_back(std::move(stmt)); }
   };
 
+  struct Import : TopLevel {
+    std::string path_;
+    Import(llvm::StringRef path) : path_(path) {}
+    virtual void Codegen(llvm::Module&, std::shared_ptr<Scope>);
+  };
+
   struct Function : TopLevel {
     llvm::StringRef name_;
     llvm::Type *rettype_;
     std::vector<llvm::StringRef> name_args_;
     std::vector<llvm::Type*> type_args_;
     std::vector<std::unique_ptr<Statement>> stmts_;
-    Function(llvm::StringRef name) : name_(name), rettype_(NULL) {}
+    /** The line of the declaration. */
+    unsigned line_;
+    Function(llvm::StringRef name) : name_(name), rettype_(NULL), line_(0) {}
     virtual void Codegen(llvm::Module&, std::shared_ptr<Scope>);
     void Append(std::unique_ptr<Statement> stmt) { stmts_.push_back(std::move(stmt)); }
   };
 
+  /** A struct declaration. The struct is declared while parsing, since
+      types are resolved then, so there is nothing left to generate.
+  */
+  struct StructDecl : TopLevel {
+    const StructInfo *info_;
+    StructDecl(const StructInfo *info) : info_(info) {}
+    virtual void Codegen(llvm::Module&, std::shared_ptr<Scope>) {}
+  };
+
+  /** A constant: an int, const n = 5;, or an array of ints,
+      const t: int[4] = [1, 2, 3, 4]; or const t = [1, 2, 3, 4];. An
+      array declared larger than its values is filled up with zeros.
+
+      Constants are generated as private constant globals with
+      unnamed_addr, in read-only data, where the optimizer merges
+      identical tables. Every function can read them; reading an int
+      constant, or an element of an array at a constant index, folds to
+      the value. They cannot be assigned, and an array passed to a
+      function is passed as a copy.
+  */
+  struct ConstDecl : TopLevel {
+    llvm::StringRef name_;
+    /** int, or an array of ints. */
+    llvm::Type *type_;
+    std::vector<int> values_;
+    ConstDecl(llvm::StringRef name, llvm::Type *type) : name_(name), type_(type) {}
+    virtual void Codegen(llvm::Module&, std::shared_ptr<Scope>);
+  };
+
   struct VariableAssignment : Statement {
     llvm::StringRef name_;
+    /** The declared type, or NULL for an int. expr_ may be NULL when a
+        type is declared, and the variable starts out zeroed.
+    */
+    llvm::Type *type_;
     std::unique_ptr<Expression> expr_;
     VariableAssignment(llvm::StringRef name, std::unique_ptr<Expression> expr)
-      : name_(name), expr_(std::move(expr)) {}
+      : name_(name), type_(NULL), expr_(std::move(expr)) {}
     virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
   };
 
@@ -55,9 +116,7 @@ namespace ast {
     std::unique_ptr<Expression> expr_;
     ExpressionStatement(std::unique_ptr<Expression> expr)
       : expr_(std::move(expr)) {}
-    virtual void Codegen(llvm::IRBuilder<>& irb, llvm::Module& m, std::shared_ptr<Scope> scope) {
-      (void) expr_->Codegen(irb, m, scope);
-    }
+    virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
   };
 
   struct If : Statement {
@@ -70,10 +129,92 @@ namespace ast {
     void AppendElse(std::unique_ptr<Statement> stmt) { else_stmts_.push_back(std::move(stmt)); }
   };
 
+  /** switch expr { case 1, 2: ... default: ... } over an int, generated
+      as an LLVM switch that the backends turn into a jump table, bit
+      tests or a balanced tree of compares. Case values are distinct
+      literals. Cases do not fall through, and break and continue in
+      them refer to the enclosing loop. Without a default, a value no
+      case lists does nothing.
+  */
+  struct Switch : Statement {
+    struct Case {
+      std::vector<int> values_;
+      std::vector<std::unique_ptr<Statement>> stmts_;
+    };
+    std::unique_ptr<Expression> expr_;
+    std::vector<Case> cases_;
+    std::vector<std::unique_ptr<Statement>> default_stmts_;
+    Switch(std::unique_ptr<Expression> expr) : expr_(std::move(expr)) {}
+    virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+  };
+
   struct While : Statement {
     std::unique_ptr<Expression> expr_;
     std::vector<std::unique_ptr<Statement>> stmts_;
-    While(std::unique_ptr<Expression> expr) : expr_(std::move(expr)) {}
+    /** Loop hints from @unroll(n) and @vectorize(n). Zero means no hint.
+        A vectorize hint of 1 enables vectorization with the default width.
+        They are emitted as llvm.loop metadata, which LLVM 3.1 ignores, so
+        giving one only draws a warning for now.
+    */
+    unsigned unroll_;
+    unsigned vectorize_;
+    While(std::unique_ptr<Expression> expr)
+      : expr_(std::move(expr)), unroll_(0), vectorize_(0) {}
+    virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    void Append(std::unique_ptr<Statement> stmt) { stmts_.push_back(std::move(stmt)); }
+    llvm::MDNode *LoopMetadata(llvm::LLVMContext&) const;
+  };
+
+  /** A loop whose iterations may run in parallel:
+
+        parfor i in lo..hi reduce(+: sum) { ... }
+
+      runs the body for each i from lo up to but not including hi. The
+      body is outlined into a function that runs a chunk of the
+      iterations, and the chunks are spread over the threads of the
+      runtime in runtime/parallel.cc. Variables of the enclosing function
+      are shared by every iteration, except reduction variables: each
+      chunk accumulates into a copy that starts from the identity of the
+      operator, and combines it into the variable when the chunk is done.
+
+      Iterations must not depend on each other. A return is not allowed
+      in the body, and neither is a break that is not in a nested loop.
+  */
+  struct Parfor : Statement {
+    struct Reduction {
+      /** +, *, min or max. */
+      llvm::StringRef oper_;
+      llvm::StringRef var_;
+    };
+
+    llvm::StringRef var_;
+    std::unique_ptr<Expression> lo_, hi_;
+    std::vector<Reduction> reductions_;
+    std::vector<std::unique_ptr<Statement>> stmts_;
+    Parfor(llvm::StringRef var, std::unique_ptr<Expression> lo, std::unique_ptr<Expression> hi)
+      : var_(var), lo_(std::move(lo)), hi_(std::move(hi)) {}
+    virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    void Append(std::unique_ptr<Statement> stmt) { stmts_.push_back(std::move(stmt)); }
+
+  private:
+    llvm::Function *Outline(llvm::Module&, std::shared_ptr<Scope>,
+                            const std::vector<std::string>& captures, llvm::StructType *env,
+                            const ParforRanges& ranges);
+  };
+
+  /** A block whose allocations are freed together when it ends:
+
+        region r { var a: int[] = alloc(r, n); ... }
+
+      alloc bumps a pointer through chunks that the runtime in
+      runtime/region.cc hands out and takes back for reuse. Leaving the
+      block by break, continue or return frees the region too; memory
+      allocated from it must not be used after that.
+  */
+  struct Region : Statement {
+    llvm::StringRef name_;
+    std::vector<std::unique_ptr<Statement>> stmts_;
+    Region(llvm::StringRef name) : name_(name) {}
     virtual void Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
     void Append(std::unique_ptr<Statement> stmt) { stmts_.push_back(std::move(stmt)); }
   };
@@ -102,7 +243,7 @@ namespace ast {
     llvm::StringRef ident_;
     Variable(llvm::StringRef ident) : ident_(ident) {}
     virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
-    virtual llvm::AllocaInst *lvalue(std::shared_ptr<Scope> scope) const;
+    virtual llvm::Value *lvalue(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
   };
 
   struct UnaryOperation : Expression {
@@ -110,7 +251,9 @@ namespace ast {
     std::unique_ptr<Expression> expr_;
     UnaryOperation(llvm::StringRef oper, std::unique_ptr<Expression> expr)
       : oper_(oper), expr_(std::move(expr)) {}
+    ~UnaryOperation() { FreeChildren(); }
     virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&);
   };
 
   struct BinaryOperation : Expression {
@@ -118,7 +261,52 @@ namespace ast {
     std::unique_ptr<Expression> LHS_, RHS_;
     BinaryOperation(llvm::StringRef oper, std::unique_ptr<Expression> LHS, std::unique_ptr<Expression> RHS)
       : oper_(oper), LHS_(std::move(LHS)), RHS_(std::move(RHS)) {}
+    ~BinaryOperation() { FreeChildren(); }
     virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&);
+  };
+
+  /** An element of a fixed-size array, or a lane of a vector. Unless
+      -fno-bounds-check is given, an index that is not known to be in
+      bounds is checked at runtime and traps when it is not. Elements of
+      unsized arrays (T[], from alloc) are not checked, since their
+      length is not known.
+  */
+  struct IndexOperation : Expression {
+    std::unique_ptr<Expression> expr_, index_;
+    IndexOperation(std::unique_ptr<Expression> expr, std::unique_ptr<Expression> index)
+      : expr_(std::move(expr)), index_(std::move(index)) {}
+    ~IndexOperation() { FreeChildren(); }
+    virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual llvm::Value *lvalue(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&);
+
+    /** Generate an assignment to the element or lane. Lanes have no
+        address, so they are assigned by inserting into the vector.
+    */
+    llvm::Value *Assign(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>, Expression *value);
+
+    /** The address of a field of the element. Elements of @soa arrays
+        have no address of their own, but each of their fields does.
+    */
+    llvm::Value *Field(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>, llvm::StringRef field);
+
+  private:
+    llvm::Value *Element(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>, llvm::Value *ptr);
+    llvm::Value *Unsized(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>, llvm::Value *base);
+    llvm::Value *Index(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>, llvm::Type *type);
+  };
+
+  /** A field of a struct, s.field. */
+  struct FieldAccess : Expression {
+    std::unique_ptr<Expression> expr_;
+    llvm::StringRef field_;
+    FieldAccess(std::unique_ptr<Expression> expr, llvm::StringRef field)
+      : expr_(std::move(expr)), field_(field) {}
+    ~FieldAccess() { FreeChildren(); }
+    virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual llvm::Value *lvalue(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&);
   };
 
   struct CallOperation : Expression {
@@ -126,6 +314,14 @@ namespace ast {
     std::vector<std::unique_ptr<Expression>> args_;
     CallOperation(std::unique_ptr<Expression> expr)
       : expr_(std::move(expr)) {}
+    ~CallOperation() { FreeChildren(); }
     virtual llvm::Value *Codegen(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
+    virtual void TakeChildren(std::vector<std::unique_ptr<Expression>>&);
+
+    /** Generate the call as the operand of a return statement.
+        Self recursion becomes a jump back to the top of the function and
+        any other call is marked as a tail call.
+    */
+    void CodegenTail(llvm::IRBuilder<>&, llvm::Module&, std::shared_ptr<Scope>);
   };
 }
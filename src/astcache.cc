@@ -0,0 +1,602 @@
+
+#include "astcache.h"
+#include "ast.h"
+#include "parse.h"
+#include "structs.h"
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+using llvm::StringRef;
+
+namespace {
+  const char kMagic[8] = { 'N', 'E', 'A', 'T', 'A', 'S', 'T', 8 };
+
+  /** Node kinds, with what each node holds and the children following it. */
+  enum Kind {
+    NONE,        // a missing expression
+    IMPORT,      // str: path
+    STRUCT,      // str: name, a: fields, b: @soa, c: @ordered; fields
+    FIELD,       // str: name, type: type
+    CONST,       // str: name, type: type, a: values; values as INTs
+    FUNCTION,    // str: name, type: return type if c, a: args, b: statements
+    ARG,         // str: name, type: type
+    VAR,         // str: name, type: type if c; expression or NONE
+    EXPR_STMT,   // expression
+    IF,          // a: then statements, b: else statements; condition, then, else
+    WHILE,       // a: statements, b: unroll, c: vectorize; condition, statements
+    PARFOR,      // str: variable, a: statements, b: reductions; lo, hi, reductions, statements
+    REDUCTION,   // str: operator, type: variable
+    REGION,      // str: name, a: statements; statements
+    SWITCH,      // a: cases, b: default statements; value, cases, default
+    CASE,        // a: values, b: statements; values as INTs, statements
+    RETURN,      // expression or NONE
+    BREAK,
+    CONTINUE,
+    INT,         // a: value
+    VARIABLE,    // str: identifier
+    UNARY,       // str: operator; operand
+    BINARY,      // str: operator; left, right
+    CALL,        // a: arguments; callee, arguments
+    INDEX,       // array, index
+    FIELD_ACCESS, // str: field; struct
+    NUM_KINDS
+  };
+
+  typedef AstCache::Node Node;
+  typedef AstCache::Ref Ref;
+
+  class Writer {
+  public:
+    Writer() : ok_(true) {}
+
+    void Program(const ast::Program& program);
+    bool ok() const { return ok_; }
+    const vector<Node>& nodes() const { return nodes_; }
+    const string& strtab() const { return strtab_; }
+
+  private:
+    typedef vector<unique_ptr<ast::Statement>> Statements;
+
+    Ref Intern(StringRef str);
+    Node& Add(Kind kind, StringRef str = StringRef());
+    void Statement(const ast::Statement *stmt);
+    void StatementNodes(const ast::Statement *stmt);
+    void Block(const Statements& stmts);
+    void Expression(const ast::Expression *expr);
+
+    vector<Node> nodes_;
+    string strtab_;
+    unordered_map<string, Ref> strings_;
+    bool ok_;
+  };
+
+  Ref Writer::Intern(StringRef str) {
+    auto iter = strings_.find(str.str());
+    if (iter != strings_.end())
+      return iter->second;
+    Ref ref = { uint32_t(strtab_.size()), uint32_t(str.size()) };
+    strtab_.append(str.data(), str.size());
+    strings_[str.str()] = ref;
+    return ref;
+  }
+
+  Node& Writer::Add(Kind kind, StringRef str) {
+    Node node;
+    memset(&node, 0, sizeof(node));
+    node.kind_ = kind;
+    node.str_ = Intern(str);
+    nodes_.push_back(node);
+    return nodes_.back();
+  }
+
+  void Writer::Program(const ast::Program& program) {
+    for (auto& stmt : program.stmts_) {
+      if (auto import = dynamic_cast<const ast::Import*>(stmt.get())) {
+        Add(IMPORT, import->path_);
+      } else if (auto decl = dynamic_cast<const ast::StructDecl*>(stmt.get())) {
+        const StructInfo *info = decl->info_;
+        Node& node = Add(STRUCT, info->name_);
+        node.a_ = info->names_.size();
+        node.b_ = info->soa_;
+        node.c_ = info->ordered_;
+        for (size_t i = 0; i < info->names_.size(); ++i) {
+          Ref type = Intern(TypeName(info->types_[i]));
+          Add(FIELD, info->names_[i]).type_ = type;
+        }
+      } else if (auto decl = dynamic_cast<const ast::ConstDecl*>(stmt.get())) {
+        Ref type = Intern(TypeName(decl->type_));
+        Node& node = Add(CONST, decl->name_);
+        node.type_ = type;
+        node.a_ = decl->values_.size();
+        for (int value : decl->values_) {
+          Add(INT).a_ = value;
+        }
+      } else if (auto f = dynamic_cast<const ast::Function*>(stmt.get())) {
+        Node& node = Add(FUNCTION, f->name_);
+        node.line_ = f->line_;
+        node.a_ = f->type_args_.size();
+        node.b_ = f->stmts_.size();
+        node.c_ = f->rettype_ != NULL;
+        if (f->rettype_)
+          node.type_ = Intern(TypeName(f->rettype_));
+
+        for (size_t i = 0; i < f->type_args_.size(); ++i) {
+          Ref type = Intern(TypeName(f->type_args_[i]));
+          Add(ARG, f->name_args_[i]).type_ = type;
+        }
+        Block(f->stmts_);
+      } else {
+        ok_ = false;
+      }
+    }
+  }
+
+  void Writer::Block(const Statements& stmts) {
+    for (auto& stmt : stmts) {
+      Statement(stmt.get());
+    }
+  }
+
+  void Writer::Statement(const ast::Statement *stmt) {
+    size_t first = nodes_.size();
+    StatementNodes(stmt);
+    if (nodes_.size() > first)
+      nodes_[first].line_ = stmt->line_;
+  }
+
+  void Writer::StatementNodes(const ast::Statement *stmt) {
+    if (auto var = dynamic_cast<const ast::VariableAssignment*>(stmt)) {
+      Node& node = Add(VAR, var->name_);
+      node.c_ = var->type_ != NULL;
+      if (var->type_)
+        node.type_ = Intern(TypeName(var->type_));
+      Expression(var->expr_.get());
+    } else if (auto expr = dynamic_cast<const ast::ExpressionStatement*>(stmt)) {
+      Add(EXPR_STMT);
+      Expression(expr->expr_.get());
+    } else if (auto if_ = dynamic_cast<const ast::If*>(stmt)) {
+      Node& node = Add(IF);
+      node.a_ = if_->then_stmts_.size();
+      node.b_ = if_->else_stmts_.size();
+      Expression(if_->expr_.get());
+      Block(if_->then_stmts_);
+      Block(if_->else_stmts_);
+    } else if (auto switch_ = dynamic_cast<const ast::Switch*>(stmt)) {
+      Node& node = Add(SWITCH);
+      node.a_ = switch_->cases_.size();
+      node.b_ = switch_->default_stmts_.size();
+      Expression(switch_->expr_.get());
+      for (auto& c : switch_->cases_) {
+        Node& case_ = Add(CASE);
+        case_.a_ = c.values_.size();
+        case_.b_ = c.stmts_.size();
+        for (int value : c.values_) {
+          Add(INT).a_ = value;
+        }
+        Block(c.stmts_);
+      }
+      Block(switch_->default_stmts_);
+    } else if (auto while_ = dynamic_cast<const ast::While*>(stmt)) {
+      Node& node = Add(WHILE);
+      node.a_ = while_->stmts_.size();
+      node.b_ = while_->unroll_;
+      node.c_ = while_->vectorize_;
+      Expression(while_->expr_.get());
+      Block(while_->stmts_);
+    } else if (auto parfor = dynamic_cast<const ast::Parfor*>(stmt)) {
+      Node& node = Add(PARFOR, parfor->var_);
+      node.a_ = parfor->stmts_.size();
+      node.b_ = parfor->reductions_.size();
+      Expression(parfor->lo_.get());
+      Expression(parfor->hi_.get());
+      for (auto& reduction : parfor->reductions_) {
+        Ref var = Intern(reduction.var_);
+        Add(REDUCTION, reduction.oper_).type_ = var;
+      }
+      Block(parfor->stmts_);
+    } else if (auto region = dynamic_cast<const ast::Region*>(stmt)) {
+      Add(REGION, region->name_).a_ = region->stmts_.size();
+      Block(region->stmts_);
+    } else if (auto ret = dynamic_cast<const ast::Return*>(stmt)) {
+      Add(RETURN);
+      Expression(ret->expr_.get());
+    } else if (dynamic_cast<const ast::Break*>(stmt)) {
+      Add(BREAK);
+    } else if (dynamic_cast<const ast::Continue*>(stmt)) {
+      Add(CONTINUE);
+    } else {
+      ok_ = false;
+    }
+  }
+
+  void Writer::Expression(const ast::Expression *expr) {
+    if (!expr) {
+      Add(NONE);
+    } else if (auto lit = dynamic_cast<const ast::IntegerLiteral*>(expr)) {
+      Add(INT).a_ = lit->value_;
+    } else if (auto var = dynamic_cast<const ast::Variable*>(expr)) {
+      Add(VARIABLE, var->ident_);
+    } else if (auto op = dynamic_cast<const ast::UnaryOperation*>(expr)) {
+      Add(UNARY, op->oper_);
+      Expression(op->expr_.get());
+    } else if (auto op = dynamic_cast<const ast::BinaryOperation*>(expr)) {
+      Add(BINARY, op->oper_);
+      Expression(op->LHS_.get());
+      Expression(op->RHS_.get());
+    } else if (auto call = dynamic_cast<const ast::CallOperation*>(expr)) {
+      Add(CALL).a_ = call->args_.size();
+      Expression(call->expr_.get());
+      for (auto& arg : call->args_) {
+        Expression(arg.get());
+      }
+    } else if (auto index = dynamic_cast<const ast::IndexOperation*>(expr)) {
+      Add(INDEX);
+      Expression(index->expr_.get());
+      Expression(index->index_.get());
+    } else if (auto field = dynamic_cast<const ast::FieldAccess*>(expr)) {
+      Add(FIELD_ACCESS, field->field_);
+      Expression(field->expr_.get());
+    } else {
+      ok_ = false;
+    }
+  }
+
+  class Reader {
+  public:
+    Reader(const Node *nodes, size_t n, const char *strtab, llvm::LLVMContext& ctx)
+      : nodes_(nodes), n_(n), next_(0), strtab_(strtab), ctx_(ctx), ok_(true) {}
+
+    unique_ptr<ast::Program> Program();
+
+  private:
+    const Node *Next();
+    bool Count(int32_t count);
+    StringRef Str(const Ref& ref) const { return StringRef(strtab_ + ref.offset_, ref.size_); }
+
+    unique_ptr<ast::TopLevel> TopLevel();
+    unique_ptr<ast::TopLevel> Struct(const Node *node);
+    unique_ptr<ast::TopLevel> Const(const Node *node);
+    unique_ptr<ast::Statement> Statement();
+    unique_ptr<ast::Statement> Statement(const Node *node);
+    unique_ptr<ast::Expression> Expression();
+
+    const Node *nodes_;
+    size_t n_;
+    size_t next_;
+    const char *strtab_;
+    llvm::LLVMContext& ctx_;
+    bool ok_;
+  };
+
+  const Node *Reader::Next() {
+    if (next_ >= n_) {
+      ok_ = false;
+      return NULL;
+    }
+    return &nodes_[next_++];
+  }
+
+  /** Check a child count against the nodes left, so a corrupt count
+      fails instead of looping.
+  */
+  bool Reader::Count(int32_t count) {
+    if (count < 0 || size_t(count) > n_ - next_)
+      ok_ = false;
+    return ok_;
+  }
+
+  unique_ptr<ast::Program> Reader::Program() {
+    auto program = unique_ptr<ast::Program>(new ast::Program);
+    while (ok_ && next_ < n_) {
+      auto stmt = TopLevel();
+      if (stmt)
+        program->Append(move(stmt));
+    }
+    return ok_ ? move(program) : NULL;
+  }
+
+  unique_ptr<ast::TopLevel> Reader::TopLevel() {
+    const Node *node = Next();
+    if (!node)
+      return NULL;
+
+    if (node->kind_ == IMPORT)
+      return unique_ptr<ast::TopLevel>(new ast::Import(Str(node->str_)));
+    if (node->kind_ == STRUCT)
+      return Struct(node);
+    if (node->kind_ == CONST)
+      return Const(node);
+
+    if (node->kind_ != FUNCTION || !Count(node->a_) || !Count(node->b_)) {
+      ok_ = false;
+      return NULL;
+    }
+
+    auto f = unique_ptr<ast::Function>(new ast::Function(Str(node->str_)));
+    f->line_ = node->line_;
+    if (node->c_) {
+      f->rettype_ = LookupType(ctx_, Str(node->type_));
+      ok_ = ok_ && f->rettype_;
+    }
+
+    for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+      const Node *arg = Next();
+      llvm::Type *type = arg && arg->kind_ == ARG ? LookupType(ctx_, Str(arg->type_)) : NULL;
+      if (!type) {
+        ok_ = false;
+        break;
+      }
+      f->name_args_.push_back(Str(arg->str_));
+      f->type_args_.push_back(type);
+    }
+
+    for (int32_t i = 0; ok_ && i < node->b_; ++i) {
+      f->Append(Statement());
+    }
+    return ok_ ? move(f) : NULL;
+  }
+
+  /** Declare a struct again in the context the AST is read into. */
+  unique_ptr<ast::TopLevel> Reader::Struct(const Node *node) {
+    if (!Count(node->a_))
+      return NULL;
+
+    vector<string> names;
+    vector<llvm::Type*> types;
+    for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+      const Node *field = Next();
+      llvm::Type *type = field && field->kind_ == FIELD ? LookupType(ctx_, Str(field->type_)) : NULL;
+      if (!type) {
+        ok_ = false;
+        return NULL;
+      }
+      names.push_back(Str(field->str_).str());
+      types.push_back(type);
+    }
+
+    const StructInfo *info = DeclareStruct(ctx_, Str(node->str_), names, types, node->b_, node->c_);
+    if (!info) {
+      ok_ = false;
+      return NULL;
+    }
+    return unique_ptr<ast::TopLevel>(new ast::StructDecl(info));
+  }
+
+  unique_ptr<ast::TopLevel> Reader::Const(const Node *node) {
+    llvm::Type *type = LookupType(ctx_, Str(node->type_));
+    if (!type || !Count(node->a_)) {
+      ok_ = false;
+      return NULL;
+    }
+
+    auto decl = unique_ptr<ast::ConstDecl>(new ast::ConstDecl(Str(node->str_), type));
+    for (int32_t i = 0; i < node->a_; ++i) {
+      const Node *value = Next();
+      if (!value || value->kind_ != INT) {
+        ok_ = false;
+        return NULL;
+      }
+      decl->values_.push_back(value->a_);
+    }
+    return move(decl);
+  }
+
+  unique_ptr<ast::Statement> Reader::Statement() {
+    const Node *node = Next();
+    if (!node)
+      return NULL;
+    auto stmt = Statement(node);
+    if (stmt)
+      stmt->line_ = node->line_;
+    return stmt;
+  }
+
+  unique_ptr<ast::Statement> Reader::Statement(const Node *node) {
+    switch (node->kind_) {
+      case VAR: {
+        llvm::Type *type = NULL;
+        if (node->c_) {
+          type = LookupType(ctx_, Str(node->type_));
+          if (!type) {
+            ok_ = false;
+            return NULL;
+          }
+        }
+        auto var = unique_ptr<ast::VariableAssignment>(
+            new ast::VariableAssignment(Str(node->str_), Expression()));
+        var->type_ = type;
+        return move(var);
+      }
+      case EXPR_STMT:
+        return unique_ptr<ast::Statement>(new ast::ExpressionStatement(Expression()));
+      case IF: {
+        if (!Count(node->a_) || !Count(node->b_))
+          return NULL;
+        auto if_ = unique_ptr<ast::If>(new ast::If(Expression()));
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          if_->AppendThen(Statement());
+        }
+        for (int32_t i = 0; ok_ && i < node->b_; ++i) {
+          if_->AppendElse(Statement());
+        }
+        return move(if_);
+      }
+      case SWITCH: {
+        if (!Count(node->a_) || !Count(node->b_))
+          return NULL;
+        auto switch_ = unique_ptr<ast::Switch>(new ast::Switch(Expression()));
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          const Node *case_ = Next();
+          if (!case_ || case_->kind_ != CASE || !Count(case_->a_) || !Count(case_->b_)) {
+            ok_ = false;
+            return NULL;
+          }
+          switch_->cases_.push_back(ast::Switch::Case());
+          ast::Switch::Case& c = switch_->cases_.back();
+          for (int32_t j = 0; ok_ && j < case_->a_; ++j) {
+            const Node *value = Next();
+            if (!value || value->kind_ != INT) {
+              ok_ = false;
+              return NULL;
+            }
+            c.values_.push_back(value->a_);
+          }
+          for (int32_t j = 0; ok_ && j < case_->b_; ++j) {
+            c.stmts_.push_back(Statement());
+          }
+        }
+        for (int32_t i = 0; ok_ && i < node->b_; ++i) {
+          switch_->default_stmts_.push_back(Statement());
+        }
+        return move(switch_);
+      }
+      case WHILE: {
+        if (!Count(node->a_))
+          return NULL;
+        auto while_ = unique_ptr<ast::While>(new ast::While(Expression()));
+        while_->unroll_ = node->b_;
+        while_->vectorize_ = node->c_;
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          while_->Append(Statement());
+        }
+        return move(while_);
+      }
+      case PARFOR: {
+        if (!Count(node->a_) || !Count(node->b_))
+          return NULL;
+        auto lo = Expression();
+        auto hi = Expression();
+        auto parfor = unique_ptr<ast::Parfor>(new ast::Parfor(Str(node->str_), move(lo), move(hi)));
+        for (int32_t i = 0; ok_ && i < node->b_; ++i) {
+          const Node *reduction = Next();
+          if (!reduction || reduction->kind_ != REDUCTION) {
+            ok_ = false;
+            return NULL;
+          }
+          ast::Parfor::Reduction r = { Str(reduction->str_), Str(reduction->type_) };
+          parfor->reductions_.push_back(r);
+        }
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          parfor->Append(Statement());
+        }
+        return move(parfor);
+      }
+      case REGION: {
+        if (!Count(node->a_))
+          return NULL;
+        auto region = unique_ptr<ast::Region>(new ast::Region(Str(node->str_)));
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          region->Append(Statement());
+        }
+        return move(region);
+      }
+      case RETURN:
+        return unique_ptr<ast::Statement>(new ast::Return(Expression()));
+      case BREAK:
+        return unique_ptr<ast::Statement>(new ast::Break);
+      case CONTINUE:
+        return unique_ptr<ast::Statement>(new ast::Continue);
+    }
+    ok_ = false;
+    return NULL;
+  }
+
+  unique_ptr<ast::Expression> Reader::Expression() {
+    const Node *node = Next();
+    if (!node)
+      return NULL;
+
+    switch (node->kind_) {
+      case NONE:
+        return NULL;
+      case INT:
+        return unique_ptr<ast::Expression>(new ast::IntegerLiteral(node->a_));
+      case VARIABLE:
+        return unique_ptr<ast::Expression>(new ast::Variable(Str(node->str_)));
+      case UNARY: {
+        StringRef oper = Str(node->str_);
+        return unique_ptr<ast::Expression>(new ast::UnaryOperation(oper, Expression()));
+      }
+      case BINARY: {
+        StringRef oper = Str(node->str_);
+        auto LHS = Expression();
+        auto RHS = Expression();
+        return unique_ptr<ast::Expression>(new ast::BinaryOperation(oper, move(LHS), move(RHS)));
+      }
+      case CALL: {
+        if (!Count(node->a_))
+          return NULL;
+        auto call = unique_ptr<ast::CallOperation>(new ast::CallOperation(Expression()));
+        for (int32_t i = 0; ok_ && i < node->a_; ++i) {
+          call->args_.push_back(Expression());
+        }
+        return move(call);
+      }
+      case INDEX: {
+        auto array = Expression();
+        auto index = Expression();
+        return unique_ptr<ast::Expression>(new ast::IndexOperation(move(array), move(index)));
+      }
+      case FIELD_ACCESS: {
+        StringRef field = Str(node->str_);
+        return unique_ptr<ast::Expression>(new ast::FieldAccess(Expression(), field));
+      }
+    }
+    ok_ = false;
+    return NULL;
+  }
+}
+
+unique_ptr<AstCache> AstCache::Map(const string& path, uint64_t hash) {
+  auto cache = unique_ptr<AstCache>(new AstCache);
+  if (!cache->file_.Map(path) || cache->file_.size() < sizeof(Header))
+    return NULL;
+  return cache->Validate(hash) ? move(cache) : NULL;
+}
+
+bool AstCache::Write(const ast::Program& program, uint64_t hash, const string& path) {
+  Writer writer;
+  writer.Program(program);
+  if (!writer.ok())
+    return false;
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, kMagic, sizeof(kMagic));
+  header.hash_ = hash;
+  header.num_nodes_ = writer.nodes().size();
+  header.strtab_size_ = writer.strtab().size();
+
+  string buf;
+  buf.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  buf.append(reinterpret_cast<const char*>(writer.nodes().data()),
+             writer.nodes().size() * sizeof(Node));
+  buf.append(writer.strtab());
+  return WriteFileAtomic(path, buf);
+}
+
+unique_ptr<ast::Program> AstCache::Read(llvm::LLVMContext& ctx) const {
+  Reader reader(nodes(), header().num_nodes_, strtab(), ctx);
+  return reader.Program();
+}
+
+bool AstCache::Validate(uint64_t hash) const {
+  const Header& h = header();
+  if (memcmp(h.magic_, kMagic, sizeof(kMagic)) != 0 || h.hash_ != hash)
+    return false;
+
+  uint64_t expected = sizeof(Header) + uint64_t(h.num_nodes_) * sizeof(Node) + h.strtab_size_;
+  if (expected != file_.size())
+    return false;
+
+  auto valid = [&](const Ref& ref) {
+    return uint64_t(ref.offset_) + ref.size_ <= h.strtab_size_;
+  };
+  for (uint32_t i = 0; i < h.num_nodes_; ++i) {
+    const Node& node = nodes()[i];
+    if (node.kind_ >= NUM_KINDS || !valid(node.str_) || !valid(node.type_))
+      return false;
+  }
+  return true;
+}
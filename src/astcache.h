@@ -0,0 +1,81 @@
+#pragma once
+
+#include "util.h"
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+namespace llvm {
+  class LLVMContext;
+}
+
+namespace ast {
+  struct Program;
+}
+
+/** A binary cache of a parsed program, so an unchanged source is not
+    lexed and parsed again when only the code generation options differ.
+
+    The cache is written next to the output as <output dir>/<source>.neatast.
+    Like interface files, it is mapped into memory and addressed purely
+    by offset:
+
+      Header
+      Node[num_nodes]         the tree in preorder
+      char[strtab_size]       string table
+
+    Every node has the same size. Children follow their parent, and the
+    counts that say how many there are live in the parent, so the tree is
+    walked in a single pass with no pointers to fix up. The AST built from
+    the cache refers to the mapped string table for identifiers instead of
+    copying them, just as a parsed AST refers to the source.
+*/
+struct AstCache {
+  /** Map a cache file, returning NULL if it is missing, malformed or was
+      built from a source with a different hash.
+  */
+  static std::unique_ptr<AstCache> Map(const std::string& path, uint64_t hash);
+
+  /** Write the cache of a program. Returns false if the file could not be
+      written or the program has nodes the format cannot represent.
+  */
+  static bool Write(const ast::Program& program, uint64_t hash, const std::string& path);
+
+  /** Build the program. Its strings refer to the mapping, so the cache
+      must outlive it. Returns NULL if the tree is malformed.
+  */
+  std::unique_ptr<ast::Program> Read(llvm::LLVMContext& ctx) const;
+
+  struct Ref {
+    uint32_t offset_;
+    uint32_t size_;
+  };
+
+  struct Node {
+    uint32_t kind_;
+    Ref str_;
+    Ref type_;
+    int32_t a_;
+    int32_t b_;
+    int32_t c_;
+    /** Source line of functions and statements. */
+    uint32_t line_;
+  };
+
+  struct Header {
+    char magic_[8];
+    uint64_t hash_;
+    uint32_t num_nodes_;
+    uint32_t strtab_size_;
+  };
+
+private:
+  AstCache() {}
+  bool Validate(uint64_t hash) const;
+
+  const Header& header() const { return *reinterpret_cast<const Header*>(file_.data()); }
+  const Node *nodes() const { return reinterpret_cast<const Node*>(file_.data() + sizeof(Header)); }
+  const char *strtab() const { return reinterpret_cast<const char*>(nodes() + header().num_nodes_); }
+
+  MappedFile file_;
+};
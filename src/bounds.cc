@@ -0,0 +1,392 @@
+#include "bounds.h"
+#include "ast.h"
+#include "scope.h"
+#include <llvm/Constants.h>
+#include <llvm/GlobalVariable.h>
+#include <map>
+using namespace std;
+
+namespace {
+  const int64_t kMinInt = INT32_MIN;
+  const int64_t kMaxInt = INT32_MAX;
+
+  /** The value of a literal or of a named int constant. */
+  bool ConstantValue(const ast::Expression *expr, const Scope& scope, int64_t& value) {
+    if (auto lit = dynamic_cast<const ast::IntegerLiteral*>(expr)) {
+      value = lit->value_;
+      return true;
+    }
+    auto var = dynamic_cast<const ast::Variable*>(expr);
+    if (!var)
+      return false;
+    auto global = llvm::dyn_cast_or_null<llvm::GlobalVariable>(scope.get(var->ident_));
+    if (!global || !global->isConstant() || !global->hasInitializer())
+      return false;
+    auto c = llvm::dyn_cast<llvm::ConstantInt>(global->getInitializer());
+    if (!c)
+      return false;
+    value = c->getSExtValue();
+    return true;
+  }
+
+  /** A comparison of a variable with a literal or a named constant,
+      var op value, with the constant moved to the right.
+  */
+  enum Compare { LT, LE, GT, GE, EQ, NE };
+
+  bool MatchCompare(const ast::Expression *expr, const Scope& scope,
+                    llvm::StringRef& var, Compare& op, int64_t& value) {
+    auto bin = dynamic_cast<const ast::BinaryOperation*>(expr);
+    if (!bin)
+      return false;
+
+    int64_t unused;
+    bool swapped = false;
+    auto lhs = dynamic_cast<const ast::Variable*>(bin->LHS_.get());
+    if (!lhs || ConstantValue(lhs, scope, unused) ||
+        !ConstantValue(bin->RHS_.get(), scope, value)) {
+      lhs = dynamic_cast<const ast::Variable*>(bin->RHS_.get());
+      if (!lhs || ConstantValue(lhs, scope, unused) ||
+          !ConstantValue(bin->LHS_.get(), scope, value))
+        return false;
+      swapped = true;
+    }
+
+    llvm::StringRef oper = bin->oper_;
+    if (oper == "<")
+      op = swapped ? GT : LT;
+    else if (oper == "<=")
+      op = swapped ? GE : LE;
+    else if (oper == ">")
+      op = swapped ? LT : GT;
+    else if (oper == ">=")
+      op = swapped ? LE : GE;
+    else if (oper == "==")
+      op = EQ;
+    else if (oper == "!=")
+      op = NE;
+    else
+      return false;
+
+    var = lhs->ident_;
+    return true;
+  }
+
+  Compare Negate(Compare op) {
+    switch (op) {
+      case LT: return GE;
+      case LE: return GT;
+      case GT: return LE;
+      case GE: return LT;
+      case EQ: return NE;
+      case NE: return EQ;
+    }
+    return NE;
+  }
+
+  /** How a loop assigns a variable. */
+  struct Assignment {
+    Assignment() : up_(true), down_(true), nested_(false), step_(0) {}
+
+    /** Whether it is only ever incremented, or only decremented. */
+    bool up_;
+    bool down_;
+    /** Whether it is assigned in a nested loop. */
+    bool nested_;
+    /** The most it can move in one iteration. */
+    int64_t step_;
+  };
+
+  typedef map<string, Assignment> Assignments;
+
+  void Step(Assignments& assigned, const ast::Expression *lhs, int64_t delta,
+            bool known, bool nested) {
+    auto var = dynamic_cast<const ast::Variable*>(lhs);
+    if (!var)
+      return;
+    Assignment& a = assigned[var->ident_];
+    a.nested_ |= nested;
+    if (!known) {
+      a.up_ = a.down_ = false;
+    } else if (delta > 0) {
+      a.down_ = false;
+      a.step_ += delta;
+    } else if (delta < 0) {
+      a.up_ = false;
+      a.step_ -= delta;
+    }
+  }
+
+  void Collect(const ast::Expression *expr, bool nested, Assignments& assigned);
+
+  void Collect(const ast::Statement *stmt, bool nested, Assignments& assigned) {
+    if (auto var = dynamic_cast<const ast::VariableAssignment*>(stmt)) {
+      Collect(var->expr_.get(), nested, assigned);
+    } else if (auto expr = dynamic_cast<const ast::ExpressionStatement*>(stmt)) {
+      Collect(expr->expr_.get(), nested, assigned);
+    } else if (auto if_ = dynamic_cast<const ast::If*>(stmt)) {
+      Collect(if_->expr_.get(), nested, assigned);
+      for (auto& s : if_->then_stmts_)
+        Collect(s.get(), nested, assigned);
+      for (auto& s : if_->else_stmts_)
+        Collect(s.get(), nested, assigned);
+    } else if (auto switch_ = dynamic_cast<const ast::Switch*>(stmt)) {
+      Collect(switch_->expr_.get(), nested, assigned);
+      for (auto& c : switch_->cases_) {
+        for (auto& s : c.stmts_)
+          Collect(s.get(), nested, assigned);
+      }
+      for (auto& s : switch_->default_stmts_)
+        Collect(s.get(), nested, assigned);
+    } else if (auto while_ = dynamic_cast<const ast::While*>(stmt)) {
+      Collect(while_->expr_.get(), true, assigned);
+      for (auto& s : while_->stmts_)
+        Collect(s.get(), true, assigned);
+    } else if (auto region = dynamic_cast<const ast::Region*>(stmt)) {
+      for (auto& s : region->stmts_)
+        Collect(s.get(), nested, assigned);
+    } else if (auto parfor = dynamic_cast<const ast::Parfor*>(stmt)) {
+      Collect(parfor->lo_.get(), nested, assigned);
+      Collect(parfor->hi_.get(), nested, assigned);
+      for (auto& s : parfor->stmts_)
+        Collect(s.get(), true, assigned);
+      for (auto& reduction : parfor->reductions_) {
+        Assignment& a = assigned[reduction.var_];
+        a.up_ = a.down_ = false;
+        a.nested_ = true;
+      }
+    } else if (auto ret = dynamic_cast<const ast::Return*>(stmt)) {
+      Collect(ret->expr_.get(), nested, assigned);
+    }
+  }
+
+  void Collect(const ast::Expression *expr, bool nested, Assignments& assigned) {
+    if (!expr)
+      return;
+
+    if (auto op = dynamic_cast<const ast::UnaryOperation*>(expr)) {
+      if (op->oper_ == "++")
+        Step(assigned, op->expr_.get(), 1, true, nested);
+      else if (op->oper_ == "--")
+        Step(assigned, op->expr_.get(), -1, true, nested);
+      Collect(op->expr_.get(), nested, assigned);
+    } else if (auto op = dynamic_cast<const ast::BinaryOperation*>(expr)) {
+      auto lit = dynamic_cast<const ast::IntegerLiteral*>(op->RHS_.get());
+      if (op->oper_ == "=")
+        Step(assigned, op->LHS_.get(), 0, false, nested);
+      else if (op->oper_ == "+=")
+        Step(assigned, op->LHS_.get(), lit ? lit->value_ : 0, lit, nested);
+      else if (op->oper_ == "-=")
+        Step(assigned, op->LHS_.get(), lit ? -int64_t(lit->value_) : 0, lit, nested);
+      else if (op->oper_ == "*=" || op->oper_ == "/=")
+        Step(assigned, op->LHS_.get(), 0, false, nested);
+      Collect(op->LHS_.get(), nested, assigned);
+      Collect(op->RHS_.get(), nested, assigned);
+    } else if (auto call = dynamic_cast<const ast::CallOperation*>(expr)) {
+      for (auto& arg : call->args_)
+        Collect(arg.get(), nested, assigned);
+    } else if (auto index = dynamic_cast<const ast::IndexOperation*>(expr)) {
+      Collect(index->expr_.get(), nested, assigned);
+      Collect(index->index_.get(), nested, assigned);
+    } else if (auto field = dynamic_cast<const ast::FieldAccess*>(expr)) {
+      Collect(field->expr_.get(), nested, assigned);
+    }
+  }
+}
+
+bool RangeFacts::Get(llvm::Value *var, Range& range) const {
+  auto iter = ranges_.find(var);
+  if (iter == ranges_.end())
+    return false;
+  range = iter->second;
+  return true;
+}
+
+void RangeFacts::Set(llvm::Value *var, int64_t lo, int64_t hi) {
+  Range& range = ranges_[var];
+  range.lo_ = lo;
+  range.hi_ = hi;
+}
+
+void RangeFacts::Assign(llvm::Value *var, const ast::Expression *expr, const Scope& scope) {
+  Range range;
+  if (Bound(expr, scope, range))
+    Set(var, range.lo_, range.hi_);
+  else
+    Forget(var);
+}
+
+void RangeFacts::Add(llvm::Value *var, int64_t delta) {
+  auto iter = ranges_.find(var);
+  if (iter == ranges_.end())
+    return;
+  Range& range = iter->second;
+  range.lo_ += delta;
+  range.hi_ += delta;
+  if (range.lo_ < kMinInt || range.hi_ > kMaxInt)
+    ranges_.erase(iter);
+}
+
+void RangeFacts::Restrict(const ast::Expression *cond, const Scope& scope, bool taken) {
+  // a && b holds only if both do, and a || b fails only if both do;
+  // what a says no longer holds if b assigned anything
+  if (auto op = dynamic_cast<const ast::BinaryOperation*>(cond)) {
+    if (op->oper_ == (taken ? "&&" : "||")) {
+      Assignments assigned;
+      Collect(op->RHS_.get(), false, assigned);
+      if (assigned.empty())
+        Restrict(op->LHS_.get(), scope, taken);
+      Restrict(op->RHS_.get(), scope, taken);
+      return;
+    }
+  }
+  if (auto op = dynamic_cast<const ast::UnaryOperation*>(cond)) {
+    if (op->oper_ == "!") {
+      Restrict(op->expr_.get(), scope, !taken);
+      return;
+    }
+  }
+  // likely(c) and unlikely(c) only weight the branches on c
+  if (auto call = dynamic_cast<const ast::CallOperation*>(cond)) {
+    auto callee = dynamic_cast<const ast::Variable*>(call->expr_.get());
+    if (callee && (callee->ident_ == "likely" || callee->ident_ == "unlikely") &&
+        call->args_.size() == 1) {
+      Restrict(call->args_[0].get(), scope, taken);
+      return;
+    }
+  }
+
+  llvm::StringRef name;
+  Compare op;
+  int64_t value;
+  if (!MatchCompare(cond, scope, name, op, value))
+    return;
+  llvm::Value *var = scope.get(name);
+  if (!var)
+    return;
+
+  Range range = { kMinInt, kMaxInt };
+  Get(var, range);
+  switch (taken ? op : Negate(op)) {
+    case LT: range.hi_ = min(range.hi_, value - 1); break;
+    case LE: range.hi_ = min(range.hi_, value); break;
+    case GT: range.lo_ = max(range.lo_, value + 1); break;
+    case GE: range.lo_ = max(range.lo_, value); break;
+    case EQ: range.lo_ = range.hi_ = value; break;
+    case NE: return;
+  }
+  Set(var, range.lo_, range.hi_);
+}
+
+void RangeFacts::Join(const RangeFacts& other) {
+  for (auto iter = ranges_.begin(); iter != ranges_.end(); ) {
+    Range range;
+    if (other.Get(iter->first, range)) {
+      iter->second.lo_ = min(iter->second.lo_, range.lo_);
+      iter->second.hi_ = max(iter->second.hi_, range.hi_);
+      ++iter;
+    } else {
+      iter = ranges_.erase(iter);
+    }
+  }
+}
+
+bool RangeFacts::Bound(const ast::Expression *expr, const Scope& scope, Range& range) const {
+  int64_t value;
+  if (ConstantValue(expr, scope, value)) {
+    range.lo_ = range.hi_ = value;
+    return true;
+  } else if (auto var = dynamic_cast<const ast::Variable*>(expr)) {
+    return Get(scope.get(var->ident_), range);
+  }
+  return false;
+}
+
+bool RangeFacts::InBounds(const ast::Expression *index, const Scope& scope, uint64_t size) const {
+  Range range;
+  if (!Bound(index, scope, range))
+    return false;
+  return range.lo_ >= 0 && uint64_t(range.hi_) < size;
+}
+
+LoopRanges::LoopRanges(RangeFacts& facts, const ast::While& loop, const Scope& scope)
+  : facts_(facts), loop_(loop), scope_(scope), induction_(NULL) {
+  Assignments assigned;
+  Collect(loop.expr_.get(), false, assigned);
+  for (auto& stmt : loop.stmts_)
+    Collect(stmt.get(), false, assigned);
+
+  llvm::StringRef name;
+  Compare op;
+  int64_t bound;
+  auto iter = MatchCompare(loop.expr_.get(), scope, name, op, bound) ? assigned.find(name) : assigned.end();
+  llvm::Value *var = iter != assigned.end() ? scope.get(name) : NULL;
+  if (var && !iter->second.nested_) {
+    // the variable cannot wrap around before it fails the condition, so
+    // it never crosses the bound it started on
+    const Assignment& a = iter->second;
+    RangeFacts::Range entry = { kMinInt, kMaxInt };
+    facts.Get(var, entry);
+    if ((op == LT || op == LE) && a.up_) {
+      int64_t hi = op == LT ? bound - 1 : bound;
+      if (hi + a.step_ <= kMaxInt) {
+        induction_ = var;
+        induction_range_.lo_ = entry.lo_;
+        induction_range_.hi_ = hi;
+      }
+    } else if ((op == GT || op == GE) && a.down_) {
+      int64_t lo = op == GT ? bound + 1 : bound;
+      if (lo - a.step_ >= kMinInt) {
+        induction_ = var;
+        induction_range_.lo_ = lo;
+        induction_range_.hi_ = entry.hi_;
+      }
+    }
+  }
+
+  for (auto& a : assigned) {
+    if (llvm::Value *v = scope.get(a.first))
+      facts.Forget(v);
+  }
+  head_ = facts;
+}
+
+void LoopRanges::EnterBody() {
+  if (induction_)
+    facts_.Set(induction_, induction_range_.lo_, induction_range_.hi_);
+  else
+    facts_.Restrict(loop_.expr_.get(), scope_, true);
+}
+
+void LoopRanges::Exit() {
+  facts_ = head_;
+}
+
+ParforRanges::ParforRanges(RangeFacts& facts, const ast::Parfor& loop, const Scope& scope)
+  : facts_(facts), loop_(loop), scope_(scope), bounded_(false) {
+  Assignments assigned;
+  for (auto& stmt : loop.stmts_)
+    Collect(stmt.get(), false, assigned);
+
+  RangeFacts::Range lo, hi;
+  if (!assigned.count(loop.var_) && facts.Bound(loop.lo_.get(), scope, lo) &&
+      facts.Bound(loop.hi_.get(), scope, hi)) {
+    bounded_ = true;
+    var_range_.lo_ = lo.lo_;
+    var_range_.hi_ = hi.hi_ - 1;
+  }
+}
+
+void ParforRanges::EnterBody(RangeFacts& body, llvm::Value *var) const {
+  if (bounded_)
+    body.Set(var, var_range_.lo_, var_range_.hi_);
+}
+
+void ParforRanges::Exit() {
+  Assignments assigned;
+  Collect(&loop_, false, assigned);
+  for (auto& a : assigned) {
+    if (llvm::Value *v = scope_.get(a.first))
+      facts_.Forget(v);
+  }
+}
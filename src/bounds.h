@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+
+namespace llvm {
+  class Value;
+}
+
+namespace ast {
+  struct Expression;
+  struct Parfor;
+  struct While;
+}
+
+struct Scope;
+
+/** The ranges of int variables known at the current point of code
+    generation, used to leave out array bounds checks that cannot fail.
+
+    Code is generated in source order, so the facts are updated as each
+    assignment is generated: a literal or a named constant sets a
+    variable's range, adding a literal shifts it and anything else
+    forgets it. Branches of an if
+    start from the facts before it, and only the facts that hold at the
+    end of every branch that falls through survive the if. The condition
+    of an if restricts the range in each branch.
+
+    Loops are handled by LoopRanges.
+*/
+struct RangeFacts {
+  struct Range {
+    int64_t lo_;
+    int64_t hi_;
+  };
+
+  bool Get(llvm::Value *var, Range& range) const;
+  void Set(llvm::Value *var, int64_t lo, int64_t hi);
+  void Forget(llvm::Value *var) { ranges_.erase(var); }
+  void Clear() { ranges_.clear(); }
+
+  /** var = expr */
+  void Assign(llvm::Value *var, const ast::Expression *expr, const Scope& scope);
+
+  /** var += delta; forgets the range if it might overflow. */
+  void Add(llvm::Value *var, int64_t delta);
+
+  /** Restrict the ranges by a condition that is known to be true, or
+      known to be false when taken is false.
+  */
+  void Restrict(const ast::Expression *cond, const Scope& scope, bool taken);
+
+  /** Keep only what holds both here and in other. */
+  void Join(const RangeFacts& other);
+
+  /** The range of a literal, a named constant or a variable with a known
+      range.
+  */
+  bool Bound(const ast::Expression *expr, const Scope& scope, Range& range) const;
+
+  /** Whether an index is always within [0, size). */
+  bool InBounds(const ast::Expression *index, const Scope& scope, uint64_t size) const;
+
+private:
+  std::unordered_map<llvm::Value*, Range> ranges_;
+};
+
+/** Facts about the variables of a while loop.
+
+    Every variable assigned anywhere in the loop is forgotten at the loop
+    head, except an induction variable: one compared with a literal or a
+    named constant in the loop condition (i < n, i <= n, i > n or i >= n) that the loop only
+    ever moves towards the bound, by adding or subtracting literals
+    directly in the loop body rather than in a nested loop. Such a
+    variable keeps the bound it had when the loop was entered on the side
+    it moves away from, and gets the other bound from the condition.
+*/
+struct LoopRanges {
+  /** Forget what the loop may change; call before generating the
+      condition.
+  */
+  LoopRanges(RangeFacts& facts, const ast::While& loop, const Scope& scope);
+
+  /** Restrict the facts to the loop body once the condition is true. */
+  void EnterBody();
+
+  /** Restore the facts at the loop head, which are those that hold when
+      the loop exits, whether through the condition or a break.
+  */
+  void Exit();
+
+private:
+  RangeFacts& facts_;
+  const ast::While& loop_;
+  const Scope& scope_;
+  RangeFacts head_;
+
+  llvm::Value *induction_;
+  RangeFacts::Range induction_range_;
+};
+
+/** Facts about the variables of a parfor loop. The body of the loop is
+    generated as a function of its own, which starts out knowing only the
+    range of the loop variable: [lo, hi - 1] for the known ranges of the
+    bounds, if the body never assigns the variable. Every variable the
+    body assigns, including the reduction variables, is forgotten after
+    the loop.
+*/
+struct ParforRanges {
+  /** Call before generating the bounds. */
+  ParforRanges(RangeFacts& facts, const ast::Parfor& loop, const Scope& scope);
+
+  /** Set the range of the loop variable in the facts of the body. */
+  void EnterBody(RangeFacts& body, llvm::Value *var) const;
+
+  /** Forget what the loop may have changed. */
+  void Exit();
+
+private:
+  RangeFacts& facts_;
+  const ast::Parfor& loop_;
+  const Scope& scope_;
+
+  bool bounded_;
+  RangeFacts::Range var_range_;
+};
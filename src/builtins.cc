@@ -0,0 +1,443 @@
+#include "builtins.h"
+#include "ast.h"
+#include "codegen.h"
+#include "parse.h"
+#include "scope.h"
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Instructions.h>
+#include <llvm/Intrinsics.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/Support/MDBuilder.h>
+#include <string>
+#include <vector>
+using std::shared_ptr;
+using namespace llvm;
+
+namespace {
+  struct Call {
+    StringRef name_;
+    ast::CallOperation& call_;
+    IRBuilder<>& irb_;
+    Module& m_;
+    shared_ptr<Scope> scope_;
+
+    Value *Fail(const std::string& msg) const {
+      scope_->context().errs_.Error("'" + name_.str() + "': " + msg);
+      return NULL;
+    }
+
+    Value *Arg(size_t i) const {
+      return call_.args_[i]->Codegen(irb_, m_, scope_);
+    }
+  };
+
+  typedef Value *(*Handler)(const Call&);
+
+  Value *Shuffle(const Call& call) {
+    auto& args = call.call_.args_;
+    if (args.size() < 2)
+      return call.Fail("expected a vector and lane indices");
+
+    Value *a = call.Arg(0);
+    if (!a || !a->getType()->isVectorTy())
+      return call.Fail("expected a vector");
+
+    // a second vector operand supplies the lanes after a's
+    size_t first = 1;
+    Value *b = UndefValue::get(a->getType());
+    if (!dynamic_cast<ast::IntegerLiteral*>(args[1].get())) {
+      b = call.Arg(1);
+      if (!b || b->getType() != a->getType())
+        return call.Fail("expected a second vector of type " + TypeName(a->getType()));
+      first = 2;
+    }
+
+    unsigned width = cast<VectorType>(a->getType())->getNumElements();
+    unsigned lanes = first == 2 ? width * 2 : width;
+    std::vector<Constant*> mask;
+    for (size_t i = first; i < args.size(); ++i) {
+      auto lit = dynamic_cast<ast::IntegerLiteral*>(args[i].get());
+      if (!lit || lit->value_ < 0 || unsigned(lit->value_) >= lanes)
+        return call.Fail("lane indices must be literals below " + std::to_string(lanes));
+      mask.push_back(call.irb_.getInt32(lit->value_));
+    }
+    if (mask.empty())
+      return call.Fail("expected lane indices");
+    return call.irb_.CreateShuffleVector(a, b, ConstantVector::get(mask));
+  }
+
+  /** Reduce by folding the upper half of the vector onto the lower half
+      until one lane is left, which the backends match to horizontal
+      instructions where the target has them. Widths are powers of two.
+  */
+  Value *Reduce(const Call& call, StringRef op) {
+    if (call.call_.args_.size() != 1)
+      return call.Fail("expected one vector");
+    Value *v = call.Arg(0);
+    if (!v || !v->getType()->isVectorTy())
+      return call.Fail("expected a vector");
+
+    IRBuilder<>& irb = call.irb_;
+    unsigned width = cast<VectorType>(v->getType())->getNumElements();
+    Value *undef = UndefValue::get(v->getType());
+    for (unsigned n = width / 2; n > 0; n /= 2) {
+      std::vector<Constant*> mask;
+      for (unsigned i = 0; i < width; ++i) {
+        mask.push_back(i < n ? cast<Constant>(irb.getInt32(i + n)) : UndefValue::get(irb.getInt32Ty()));
+      }
+      Value *upper = irb.CreateShuffleVector(v, undef, ConstantVector::get(mask));
+      v = CombineReduction(irb, op, v, upper);
+    }
+    return irb.CreateExtractElement(v, irb.getInt32(0));
+  }
+
+  /** Entry points of runtime/region.cc. */
+  const char *const kRegionRefill = "neat_region_refill";
+  const char *const kRegionFree = "neat_region_free";
+
+  /** Allocations are aligned to 16 bytes, enough for any vector. */
+  const uint64_t kRegionAlign = 16;
+
+  /** Bump the region's pointer inline when the allocation fits in the
+      current chunk, and call the runtime for a new chunk when it does
+      not. A negative length is replaced by the largest size, which
+      never fits, so that it reaches the runtime, which rejects it;
+      rounding alone would turn small negative lengths into sizes that
+      do fit.
+  */
+  Value *Alloc(const Call& call) {
+    auto& args = call.call_.args_;
+    if (args.size() != 2 && args.size() != 3)
+      return call.Fail("expected a region, a length and an optional element type");
+
+    IRBuilder<>& irb = call.irb_;
+    LLVMContext& ctx = irb.getContext();
+    // a region opened in this function, or one passed in by reference
+    Type *region_ptr = PointerType::getUnqual(RegionType(ctx));
+    Value *region = args[0]->lvalue(irb, call.m_, call.scope_);
+    if (region && region->getType() == PointerType::getUnqual(region_ptr))
+      region = irb.CreateLoad(region);
+    if (!region || region->getType() != region_ptr)
+      return call.Fail("expected a region");
+
+    Type *elem = irb.getInt32Ty();
+    if (args.size() == 3) {
+      auto name = dynamic_cast<ast::Variable*>(args[2].get());
+      elem = name ? LookupType(ctx, name->ident_) : NULL;
+      if (!elem || (!elem->isIntegerTy() && !elem->isFloatingPointTy() && !elem->isVectorTy()))
+        return call.Fail("elements must be ints, floats, doubles or vectors");
+    }
+
+    Value *n = call.Arg(1);
+    if (!n || !n->getType()->isIntegerTy(32))
+      return call.Fail("the length must be an int");
+
+    Type *i64 = irb.getInt64Ty();
+    Value *bytes = irb.CreateMul(irb.CreateSExt(n, i64), ConstantExpr::getSizeOf(elem));
+    bytes = irb.CreateAnd(irb.CreateAdd(bytes, ConstantInt::get(i64, kRegionAlign - 1)),
+                          ConstantInt::get(i64, ~(kRegionAlign - 1)));
+    bytes = irb.CreateSelect(irb.CreateICmpSLT(n, irb.getInt32(0)),
+                             ConstantInt::get(i64, ~uint64_t(0)), bytes);
+
+    Value *cur_ptr = irb.CreateStructGEP(region, 0);
+    Value *cur = irb.CreateLoad(cur_ptr);
+    Value *end = irb.CreateLoad(irb.CreateStructGEP(region, 1));
+    Value *avail = irb.CreateSub(irb.CreatePtrToInt(end, i64), irb.CreatePtrToInt(cur, i64));
+
+    llvm::Function *f = irb.GetInsertBlock()->getParent();
+    BasicBlock *bump = BasicBlock::Create(ctx, "bump", f);
+    BasicBlock *refill = BasicBlock::Create(ctx, "refill", f);
+    BasicBlock *done = BasicBlock::Create(ctx, "", f);
+    BranchInst *br = irb.CreateCondBr(irb.CreateICmpULE(bytes, avail), bump, refill);
+    br->setMetadata(LLVMContext::MD_prof, MDBuilder(ctx).createBranchWeights(2000, 1));
+
+    irb.SetInsertPoint(bump);
+    irb.CreateStore(irb.CreateInBoundsGEP(cur, bytes), cur_ptr);
+    irb.CreateBr(done);
+
+    irb.SetInsertPoint(refill);
+    Type *params[] = { region->getType(), i64 };
+    Constant *fill = call.m_.getOrInsertFunction(
+      kRegionRefill, FunctionType::get(irb.getInt8PtrTy(), params, false));
+    Value *fresh = irb.CreateCall2(fill, region, bytes);
+    irb.CreateBr(done);
+
+    irb.SetInsertPoint(done);
+    PHINode *mem = irb.CreatePHI(irb.getInt8PtrTy(), 2);
+    mem->addIncoming(cur, bump);
+    mem->addIncoming(fresh, refill);
+    return irb.CreateBitCast(mem, PointerType::getUnqual(elem));
+  }
+
+  /** What a bit intrinsic computes for a constant, so that calls with
+      constant arguments fold here rather than waiting for the
+      optimizer, which does not run without -O.
+  */
+  uint64_t FoldBits(Intrinsic::ID id, const APInt& x) {
+    switch (id) {
+      case Intrinsic::ctpop: return x.countPopulation();
+      case Intrinsic::ctlz: return x.countLeadingZeros();
+      case Intrinsic::cttz: return x.countTrailingZeros();
+      default: return x.byteSwap().getZExtValue();
+    }
+  }
+
+  /** popcount, clz, ctz and bswap of an int, or lane by lane of a
+      vector of ints. clz and ctz of 0 are 32, which LZCNT and TZCNT
+      give directly and BSR and BSF need a select for.
+  */
+  Value *Bits(const Call& call, Intrinsic::ID id) {
+    if (call.call_.args_.size() != 1)
+      return call.Fail("expected one int");
+    Value *x = call.Arg(0);
+    if (!x || !x->getType()->getScalarType()->isIntegerTy(32))
+      return call.Fail("expected an int or a vector of ints");
+    if (ConstantInt *c = dyn_cast<ConstantInt>(x))
+      return ConstantInt::get(x->getType(), FoldBits(id, c->getValue()));
+
+    IRBuilder<>& irb = call.irb_;
+    Type *types[] = { x->getType() };
+    Value *f = Intrinsic::getDeclaration(&call.m_, id, types);
+    if (id == Intrinsic::ctlz || id == Intrinsic::cttz)
+      return irb.CreateCall2(f, x, irb.getFalse());
+    return irb.CreateCall(f, x);
+  }
+
+  /** There is no rotate intrinsic; the backends match this pattern of
+      shifts, which is defined for every amount, to a single ROL or ROR.
+      Amounts are taken modulo 32. Constants fold as the shifts do.
+  */
+  Value *Rotate(const Call& call, bool left) {
+    if (call.call_.args_.size() != 2)
+      return call.Fail("expected an int and an amount");
+    Value *x = call.Arg(0);
+    Value *n = call.Arg(1);
+    if (!x || !n || !x->getType()->getScalarType()->isIntegerTy(32) || n->getType() != x->getType())
+      return call.Fail("expected two ints or two vectors of ints");
+
+    IRBuilder<>& irb = call.irb_;
+    Constant *mask = ConstantInt::get(x->getType(), 31);
+    Value *by = irb.CreateAnd(n, mask);
+    Value *back = irb.CreateAnd(irb.CreateNeg(n), mask);
+    if (left)
+      return irb.CreateOr(irb.CreateShl(x, by), irb.CreateLShr(x, back));
+    return irb.CreateOr(irb.CreateLShr(x, by), irb.CreateShl(x, back));
+  }
+
+  /** A literal argument of a builtin within [lo, hi], or def if the
+      call has no such argument.
+  */
+  bool LiteralArg(const Call& call, size_t i, int lo, int hi, int def, int& value) {
+    auto& args = call.call_.args_;
+    value = def;
+    if (i >= args.size())
+      return true;
+    auto lit = dynamic_cast<ast::IntegerLiteral*>(args[i].get());
+    if (!lit || lit->value_ < lo || lit->value_ > hi)
+      return false;
+    value = lit->value_;
+    return true;
+  }
+
+  /** Fetch the cache line holding element i of array a. A prefetch
+      never faults, so i is not bounds checked and may run past the end,
+      as it usually does when fetching ahead in a loop.
+  */
+  Value *Prefetch(const Call& call) {
+    auto& args = call.call_.args_;
+    if (args.size() < 2 || args.size() > 4)
+      return call.Fail("expected an array, an index, and optionally write and locality");
+
+    int write, locality;
+    if (!LiteralArg(call, 2, 0, 1, 0, write))
+      return call.Fail("write must be the literal 0 or 1");
+    if (!LiteralArg(call, 3, 0, 3, 3, locality))
+      return call.Fail("locality must be a literal from 0, no reuse, to 3, keep in every cache");
+
+    // a local array, an array passed by reference, or a T[]
+    IRBuilder<>& irb = call.irb_;
+    Value *ptr = args[0]->lvalue(irb, call.m_, call.scope_);
+    Type *type = ptr ? cast<PointerType>(ptr->getType())->getElementType() : NULL;
+    if (type && type->isPointerTy()) {
+      ptr = irb.CreateLoad(ptr);
+      type = cast<PointerType>(type)->getElementType();
+    }
+    if (!type || type->isStructTy() || type->isFunctionTy())
+      return call.Fail("expected an array");
+
+    Value *i = call.Arg(1);
+    if (!i || !i->getType()->isIntegerTy(32))
+      return call.Fail("the index must be an int");
+    Value *addr;
+    if (type->isArrayTy()) {
+      Value *indices[] = { irb.getInt32(0), i };
+      addr = irb.CreateGEP(ptr, indices);
+    } else {
+      addr = irb.CreateGEP(ptr, i);
+    }
+
+    Value *f = Intrinsic::getDeclaration(&call.m_, Intrinsic::prefetch);
+    Value *operands[] = {
+      irb.CreateBitCast(addr, irb.getInt8PtrTy()), irb.getInt32(write), irb.getInt32(locality),
+      irb.getInt32(1)  // the data cache
+    };
+    irb.CreateCall(f, operands);
+    return irb.getInt32(0);
+  }
+
+  /** An int that is expected to equal a constant. Branches on it are
+      weighted for the expected value, and the value itself is unchanged.
+  */
+  Value *Expect(IRBuilder<>& irb, Module& m, Value *x, ConstantInt *expected) {
+    if (isa<Constant>(x))
+      return x;
+    Type *types[] = { x->getType() };
+    Value *f = Intrinsic::getDeclaration(&m, Intrinsic::expect, types);
+    return irb.CreateCall2(f, x, expected);
+  }
+
+  Value *ExpectValue(const Call& call) {
+    auto& args = call.call_.args_;
+    if (args.size() != 2)
+      return call.Fail("expected an int and its expected value");
+    Value *x = call.Arg(0);
+    if (!x || !x->getType()->isIntegerTy(32))
+      return call.Fail("expected an int");
+    auto lit = dynamic_cast<ast::IntegerLiteral*>(args[1].get());
+    if (!lit)
+      return call.Fail("the expected value must be a literal");
+    return Expect(call.irb_, call.m_, x, call.irb_.getInt32(lit->value_));
+  }
+
+  /** A condition as 1 or 0, expected to be true or false. */
+  Value *Likely(const Call& call, bool likely) {
+    if (call.call_.args_.size() != 1)
+      return call.Fail("expected a condition");
+    Value *cond = call.Arg(0);
+    if (!cond || !cond->getType()->isIntegerTy())
+      return call.Fail("expected an int condition");
+    IRBuilder<>& irb = call.irb_;
+    Value *bit = irb.CreateZExt(irb.CreateICmpNE(cond, ConstantInt::get(cond->getType(), 0)),
+                                irb.getInt32Ty());
+    return Expect(irb, call.m_, bit, irb.getInt32(likely));
+  }
+
+  /** Promise that a condition holds. The rest of the function is
+      generated knowing it: the ranges it implies remove bounds checks,
+      and code after a false condition is unreachable, which the
+      optimizer uses until it folds the branch away.
+  */
+  Value *Assume(const Call& call) {
+    if (call.call_.args_.size() != 1)
+      return call.Fail("expected a condition");
+    Value *cond = call.Arg(0);
+    if (!cond || !cond->getType()->isIntegerTy())
+      return call.Fail("expected an int condition");
+
+    IRBuilder<>& irb = call.irb_;
+    LLVMContext& ctx = irb.getContext();
+    llvm::Function *f = irb.GetInsertBlock()->getParent();
+    BasicBlock *holds = BasicBlock::Create(ctx, "assumed", f);
+    BasicBlock *never = BasicBlock::Create(ctx, "", f);
+    irb.CreateCondBr(irb.CreateICmpNE(cond, ConstantInt::get(cond->getType(), 0)), holds, never);
+    irb.SetInsertPoint(never);
+    irb.CreateUnreachable();
+    irb.SetInsertPoint(holds);
+
+    Scope& scope = *call.scope_;
+    scope.context().function_.ranges_.Restrict(call.call_.args_[0].get(), scope, true);
+    return irb.getInt32(0);
+  }
+
+  Value *Popcount(const Call& call) { return Bits(call, Intrinsic::ctpop); }
+  Value *Clz(const Call& call) { return Bits(call, Intrinsic::ctlz); }
+  Value *Ctz(const Call& call) { return Bits(call, Intrinsic::cttz); }
+  Value *Bswap(const Call& call) { return Bits(call, Intrinsic::bswap); }
+  Value *Rotl(const Call& call) { return Rotate(call, true); }
+  Value *Rotr(const Call& call) { return Rotate(call, false); }
+  Value *LikelyTrue(const Call& call) { return Likely(call, true); }
+  Value *LikelyFalse(const Call& call) { return Likely(call, false); }
+
+  Value *ReduceAdd(const Call& call) { return Reduce(call, "+"); }
+  Value *ReduceMul(const Call& call) { return Reduce(call, "*"); }
+  Value *ReduceMin(const Call& call) { return Reduce(call, "min"); }
+  Value *ReduceMax(const Call& call) { return Reduce(call, "max"); }
+
+  struct Builtin {
+    const char *name_;
+    Handler handler_;
+    /** Whether the builtin has no value and can only be a statement. */
+    bool statement_;
+  };
+
+  const Builtin kBuiltins[] = {
+    { "shuffle", Shuffle },
+    { "reduce_add", ReduceAdd },
+    { "reduce_mul", ReduceMul },
+    { "reduce_min", ReduceMin },
+    { "reduce_max", ReduceMax },
+    { "alloc", Alloc },
+    { "popcount", Popcount },
+    { "clz", Clz },
+    { "ctz", Ctz },
+    { "bswap", Bswap },
+    { "rotl", Rotl },
+    { "rotr", Rotr },
+    { "prefetch", Prefetch, true },
+    { "expect", ExpectValue },
+    { "likely", LikelyTrue },
+    { "unlikely", LikelyFalse },
+    { "assume", Assume, true },
+  };
+
+  const Builtin *Find(StringRef name) {
+    for (auto& builtin : kBuiltins) {
+      if (name == builtin.name_)
+        return &builtin;
+    }
+    return NULL;
+  }
+}
+
+Value *CombineReduction(IRBuilder<>& irb, StringRef op, Value *a, Value *b) {
+  bool fp = a->getType()->isFPOrFPVectorTy();
+  if (op == "+")
+    return fp ? irb.CreateFAdd(a, b) : irb.CreateAdd(a, b);
+  if (op == "*")
+    return fp ? irb.CreateFMul(a, b) : irb.CreateMul(a, b);
+  if (op == "min")
+    return irb.CreateSelect(fp ? irb.CreateFCmpOLT(a, b) : irb.CreateICmpSLT(a, b), a, b);
+  if (op == "max")
+    return irb.CreateSelect(fp ? irb.CreateFCmpOGT(a, b) : irb.CreateICmpSGT(a, b), a, b);
+  return NULL;
+}
+
+StructType *RegionType(LLVMContext& ctx) {
+  // a literal struct, so every module of a context shares it
+  Type *i8ptr = Type::getInt8PtrTy(ctx);
+  return StructType::get(i8ptr, i8ptr, i8ptr, NULL);
+}
+
+void FreeRegion(IRBuilder<>& irb, Module& m, Value *region) {
+  Constant *f = m.getOrInsertFunction(kRegionFree, irb.getVoidTy(), region->getType(), NULL);
+  irb.CreateCall(f, region);
+}
+
+bool IsBuiltin(StringRef name) {
+  return Find(name) != NULL;
+}
+
+bool IsStatementBuiltin(StringRef name) {
+  const Builtin *builtin = Find(name);
+  return builtin && builtin->statement_;
+}
+
+Value *CodegenBuiltin(StringRef name, ast::CallOperation& call, IRBuilder<>& irb,
+                      Module& m, shared_ptr<Scope> scope) {
+  const Builtin *builtin = Find(name);
+  if (!builtin)
+    return NULL;
+  Call c = { name, call, irb, m, scope };
+  return builtin->handler_(c);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/IRBuilder.h>
+#include <memory>
+
+namespace llvm {
+  class LLVMContext;
+  class Module;
+  class StructType;
+  class Value;
+}
+
+namespace ast {
+  struct CallOperation;
+}
+
+struct Scope;
+
+/** Combine two values of the same type with +, *, min or max, lane by
+    lane for vectors. Used by the reduce builtins and parfor reductions.
+*/
+llvm::Value *CombineReduction(llvm::IRBuilder<>& irb, llvm::StringRef op,
+                              llvm::Value *a, llvm::Value *b);
+
+/** The type of a region, laid out like struct neat_region in
+    runtime/region.h. Regions are passed to functions by reference.
+*/
+llvm::StructType *RegionType(llvm::LLVMContext& ctx);
+
+/** Give the chunks of the region at an address back to the runtime. */
+void FreeRegion(llvm::IRBuilder<>& irb, llvm::Module& m, llvm::Value *region);
+
+/** Whether a name refers to a function built into the language. Calls
+    resolve to builtins before functions in the module, so a builtin
+    cannot be redefined.
+*/
+bool IsBuiltin(llvm::StringRef name);
+
+/** Whether a builtin has no value, so that a call to it can only be a
+    statement of its own.
+*/
+bool IsStatementBuiltin(llvm::StringRef name);
+
+/** Generate a call to a builtin:
+
+      shuffle(a, i, ...)     lanes of a, in the order given
+      shuffle(a, b, i, ...)  lanes of a and b, where b's lanes follow a's
+      reduce_add(v)          the sum, product, minimum or maximum of the
+      reduce_mul(v)          lanes of a vector
+      reduce_min(v)
+      reduce_max(v)
+      alloc(r, n)            n zeroed ints from region r, as an int[]
+      alloc(r, n, T)         n zeroed elements of type T, as a T[]
+      popcount(x)            the number of bits set in x
+      clz(x)                 the number of leading or trailing zero
+      ctz(x)                 bits of x, 32 for 0
+      bswap(x)               x with its bytes reversed
+      rotl(x, n)             x rotated left or right by n modulo 32
+      rotr(x, n)
+      prefetch(a, i)         fetch element i of array a into the cache,
+      prefetch(a, i, w, l)   for writing if w is 1, with locality l
+                             from 0 to 3, the default
+      expect(x, c)           x, which is expected to be the literal c
+      likely(c)              1 or 0 for a condition expected to be true
+      unlikely(c)            or false
+      assume(c)              nothing; c is promised to hold
+
+    The bit builtins work on ints and lane by lane on vectors of ints,
+    and fold when their arguments are constants. Lane indices of
+    shuffles must be literals. prefetch and assume are statements and
+    give an i32 0 in place of a value. Returns NULL after reporting an
+    error if the call is malformed.
+*/
+llvm::Value *CodegenBuiltin(llvm::StringRef name, ast::CallOperation& call,
+                            llvm::IRBuilder<>& irb, llvm::Module& m,
+                            std::shared_ptr<Scope> scope);
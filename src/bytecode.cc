@@ -0,0 +1,504 @@
+
+#include "bytecode.h"
+#include "ast.h"
+#include "builtins.h"
+#include <llvm/DerivedTypes.h>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace bytecode {
+  void FunctionTable::Add(const ast::Function *f) {
+    index_[f->name_] = functions_.size();
+    functions_.push_back(f);
+  }
+
+  int FunctionTable::Find(llvm::StringRef name) const {
+    auto iter = index_.find(name);
+    return iter != index_.end() ? int(iter->second) : -1;
+  }
+
+  namespace {
+    /** Registers, constants and jump targets are 16-bit operands. */
+    const unsigned kMaxOperand = 0xffff;
+
+    bool IsInt(llvm::Type *type) {
+      return type->isIntegerTy(32);
+    }
+
+    bool IsSimple(const ast::Expression *expr) {
+      return dynamic_cast<const ast::IntegerLiteral*>(expr) ||
+             dynamic_cast<const ast::Variable*>(expr);
+    }
+
+    class Lowering {
+    public:
+      Lowering(Chunk& chunk, const FunctionTable& functions, const ast::Function& f)
+        : chunk_(chunk), functions_(functions), f_(f), next_reg_(0),
+          stmt_start_(0) {}
+
+      bool Function();
+      const string& reason() const { return reason_; }
+
+    private:
+      typedef vector<unique_ptr<ast::Statement>> Statements;
+
+      void Block(const Statements& stmts);
+      void Statement(const ast::Statement *stmt);
+      void While(const ast::While *while_);
+      void Switch(const ast::Switch *switch_);
+      void Return(const ast::Return *ret);
+      int Expression(const ast::Expression *expr);
+      int Unary(const ast::UnaryOperation *op);
+      int Binary(const ast::BinaryOperation *op);
+      int Logical(const ast::BinaryOperation *op);
+      int Call(const ast::CallOperation *call);
+      int Arguments(const ast::CallOperation *call, const ast::Function *callee);
+
+      int Lookup(llvm::StringRef name) const;
+      int LookupLvalue(const ast::Expression *expr);
+      int Temp();
+      size_t Emit(Instr::Op op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+      void Patch(size_t at) { chunk_.code_[at].b_ = chunk_.code_.size(); }
+      int Fail(const string& reason);
+
+      Chunk& chunk_;
+      const FunctionTable& functions_;
+      const ast::Function& f_;
+
+      std::vector<std::unordered_map<string, unsigned>> scopes_;
+      unsigned next_reg_;
+
+      /** First register not holding a variable in the current statement.
+          Registers below it may be assigned while an expression is
+          evaluated; registers above it are temporaries.
+      */
+      unsigned stmt_start_;
+
+      struct Loop {
+        size_t start_;
+        vector<size_t> breaks_;
+      };
+      vector<Loop> loops_;
+      string reason_;
+    };
+
+    bool Lowering::Function() {
+      if (f_.rettype_ && !f_.rettype_->isVoidTy() && !IsInt(f_.rettype_)) {
+        Fail("it returns a type other than int");
+        return false;
+      }
+      for (auto type : f_.type_args_) {
+        if (!IsInt(type)) {
+          Fail("it takes arguments of types other than int");
+          return false;
+        }
+      }
+
+      // arguments arrive in the first registers and share the scope of
+      // the function body
+      chunk_.num_args_ = f_.type_args_.size();
+      scopes_.resize(1);
+      for (auto& name : f_.name_args_) {
+        unsigned reg = Temp();
+        if (!name.empty())
+          scopes_.back()[name] = reg;
+      }
+
+      for (auto& stmt : f_.stmts_) {
+        Statement(stmt.get());
+      }
+      Emit(Instr::RETV);
+
+      if (chunk_.code_.size() > kMaxOperand)
+        Fail("it is too large");
+      return reason_.empty();
+    }
+
+    void Lowering::Block(const Statements& stmts) {
+      unsigned start = next_reg_;
+      scopes_.resize(scopes_.size() + 1);
+      for (auto& stmt : stmts) {
+        Statement(stmt.get());
+      }
+      scopes_.pop_back();
+      next_reg_ = start;
+    }
+
+    void Lowering::Statement(const ast::Statement *stmt) {
+      unsigned start = next_reg_;
+      stmt_start_ = start;
+
+      if (auto var = dynamic_cast<const ast::VariableAssignment*>(stmt)) {
+        if (var->type_ && !IsInt(var->type_)) {
+          Fail("it has locals of types other than int");
+          return;
+        }
+        // a declared int with no initializer starts out zero
+        ast::IntegerLiteral zero(0);
+        int val = Expression(var->expr_ ? var->expr_.get() : &zero);
+        next_reg_ = start;
+        // like the code generator, a name that is already in scope is
+        // not redefined
+        if (val < 0 || Lookup(var->name_) >= 0)
+          return;
+        int reg = Temp();
+        if (reg != val)
+          Emit(Instr::MOV, reg, val);
+        scopes_.back()[var->name_] = reg;
+        return;
+      } else if (auto expr = dynamic_cast<const ast::ExpressionStatement*>(stmt)) {
+        Expression(expr->expr_.get());
+      } else if (auto if_ = dynamic_cast<const ast::If*>(stmt)) {
+        int cond = Expression(if_->expr_.get());
+        next_reg_ = start;
+        size_t jz = Emit(Instr::JZ, cond);
+        Block(if_->then_stmts_);
+        if (!if_->else_stmts_.empty()) {
+          size_t jmp = Emit(Instr::JMP);
+          Patch(jz);
+          Block(if_->else_stmts_);
+          Patch(jmp);
+        } else {
+          Patch(jz);
+        }
+      } else if (auto switch_ = dynamic_cast<const ast::Switch*>(stmt)) {
+        Switch(switch_);
+      } else if (auto while_ = dynamic_cast<const ast::While*>(stmt)) {
+        While(while_);
+      } else if (auto ret = dynamic_cast<const ast::Return*>(stmt)) {
+        Return(ret);
+      } else if (dynamic_cast<const ast::Break*>(stmt)) {
+        if (!loops_.empty())
+          loops_.back().breaks_.push_back(Emit(Instr::JMP));
+      } else if (dynamic_cast<const ast::Continue*>(stmt)) {
+        if (!loops_.empty())
+          Emit(Instr::LOOP, 0, loops_.back().start_);
+      } else {
+        Fail("it uses an unsupported statement");
+      }
+      next_reg_ = start;
+    }
+
+    void Lowering::While(const ast::While *while_) {
+      unsigned start = next_reg_;
+      Loop loop;
+      loop.start_ = chunk_.code_.size();
+
+      int cond = Expression(while_->expr_.get());
+      next_reg_ = start;
+      size_t jz = Emit(Instr::JZ, cond);
+
+      loops_.push_back(loop);
+      Block(while_->stmts_);
+      Emit(Instr::LOOP, 0, loops_.back().start_);
+
+      Patch(jz);
+      for (size_t br : loops_.back().breaks_) {
+        Patch(br);
+      }
+      loops_.pop_back();
+    }
+
+    /** A switch is a chain of compares ahead of the cases, each of which
+        jumps to the end.
+    */
+    void Lowering::Switch(const ast::Switch *switch_) {
+      unsigned start = next_reg_;
+      int val = Expression(switch_->expr_.get());
+      if (val < 0)
+        return;
+
+      vector<vector<size_t>> jumps(switch_->cases_.size());
+      for (size_t i = 0; i < switch_->cases_.size(); ++i) {
+        for (int value : switch_->cases_[i].values_) {
+          unsigned mark = next_reg_;
+          ast::IntegerLiteral lit(value);
+          int k = Expression(&lit);
+          int ne = Temp();
+          if (k < 0 || ne < 0)
+            return;
+          Emit(Instr::NE, ne, val, k);
+          jumps[i].push_back(Emit(Instr::JZ, ne));
+          next_reg_ = mark;
+        }
+      }
+      size_t to_default = Emit(Instr::JMP);
+      next_reg_ = start;
+
+      vector<size_t> ends;
+      for (size_t i = 0; i < switch_->cases_.size(); ++i) {
+        for (size_t jz : jumps[i]) {
+          Patch(jz);
+        }
+        Block(switch_->cases_[i].stmts_);
+        ends.push_back(Emit(Instr::JMP));
+      }
+      Patch(to_default);
+      Block(switch_->default_stmts_);
+      for (size_t jmp : ends) {
+        Patch(jmp);
+      }
+    }
+
+    void Lowering::Return(const ast::Return *ret) {
+      auto call = dynamic_cast<const ast::CallOperation*>(ret->expr_.get());
+      auto callee = call ? dynamic_cast<const ast::Variable*>(call->expr_.get()) : NULL;
+      if (callee && callee->ident_ == f_.name_ && call->args_.size() == f_.name_args_.size()) {
+        // self recursion in tail position reuses the frame, as in the
+        // native code: evaluate every argument, then overwrite the
+        // parameters and jump back to the start
+        int base = Arguments(call, &f_);
+        if (base < 0)
+          return;
+        for (size_t i = 0; i < call->args_.size(); ++i) {
+          if (!f_.name_args_[i].empty())
+            Emit(Instr::MOV, i, base + i);
+        }
+        Emit(Instr::LOOP, 0, 0);
+        return;
+      }
+
+      if (!ret->expr_) {
+        Emit(Instr::RETV);
+        return;
+      }
+      int val = Expression(ret->expr_.get());
+      if (val >= 0)
+        Emit(Instr::RET, val);
+    }
+
+    int Lowering::Expression(const ast::Expression *expr) {
+      if (!expr)
+        return Fail("it has a missing expression");
+
+      if (auto lit = dynamic_cast<const ast::IntegerLiteral*>(expr)) {
+        if (chunk_.consts_.size() > kMaxOperand)
+          return Fail("it has too many constants");
+        int reg = Temp();
+        if (reg >= 0)
+          Emit(Instr::LOADK, reg, chunk_.consts_.size());
+        chunk_.consts_.push_back(lit->value_);
+        return reg;
+      } else if (auto var = dynamic_cast<const ast::Variable*>(expr)) {
+        if (functions_.Find(var->ident_) >= 0)
+          return Fail("it uses a function as a value");
+        int reg = Lookup(var->ident_);
+        return reg >= 0 ? reg : Fail("it refers to an unknown variable");
+      } else if (auto op = dynamic_cast<const ast::UnaryOperation*>(expr)) {
+        return Unary(op);
+      } else if (auto op = dynamic_cast<const ast::BinaryOperation*>(expr)) {
+        return Binary(op);
+      } else if (auto call = dynamic_cast<const ast::CallOperation*>(expr)) {
+        return Call(call);
+      }
+      return Fail("it uses an unsupported expression");
+    }
+
+    int Lowering::Unary(const ast::UnaryOperation *op) {
+      if (op->oper_ == "+")
+        return Expression(op->expr_.get());
+
+      if (op->oper_ == "-") {
+        int val = Expression(op->expr_.get());
+        int reg = Temp();
+        if (val < 0 || reg < 0)
+          return -1;
+        Emit(Instr::NEG, reg, val);
+        return reg;
+      }
+
+      if (op->oper_ == "!") {
+        ast::IntegerLiteral zero(0);
+        int zreg = Expression(&zero);
+        int val = Expression(op->expr_.get());
+        int reg = Temp();
+        if (zreg < 0 || val < 0 || reg < 0)
+          return -1;
+        Emit(Instr::EQ, reg, val, zreg);
+        return reg;
+      }
+
+      if (op->oper_ == "++" || op->oper_ == "--") {
+        int var = LookupLvalue(op->expr_.get());
+        if (var < 0)
+          return -1;
+        Emit(Instr::ADDI, var, var, op->oper_ == "++" ? 1 : uint16_t(-1));
+        return var;
+      }
+      return Fail("it uses the unsupported operator '" + op->oper_.str() + "'");
+    }
+
+    int Lowering::Binary(const ast::BinaryOperation *op) {
+      llvm::StringRef oper = op->oper_;
+      if (oper == "=" || oper == "+=" || oper == "-=") {
+        int var = LookupLvalue(op->LHS_.get());
+        int val = Expression(op->RHS_.get());
+        if (var < 0 || val < 0)
+          return -1;
+        if (oper == "=")
+          Emit(Instr::MOV, var, val);
+        else
+          Emit(oper == "+=" ? Instr::ADD : Instr::SUB, var, var, val);
+        return var;
+      }
+
+      if (oper == "&&" || oper == "||")
+        return Logical(op);
+
+      // a > b and a >= b are b < a and b <= a
+      Instr::Op code;
+      bool swap = false;
+      if (oper == "+")
+        code = Instr::ADD;
+      else if (oper == "-")
+        code = Instr::SUB;
+      else if (oper == "==")
+        code = Instr::EQ;
+      else if (oper == "!=")
+        code = Instr::NE;
+      else if (oper == "<" || oper == ">")
+        code = Instr::LT, swap = oper == ">";
+      else if (oper == "<=" || oper == ">=")
+        code = Instr::LE, swap = oper == ">=";
+      else
+        return Fail("it uses the unsupported operator '" + oper.str() + "'");
+
+      int LHS = Expression(op->LHS_.get());
+      if (LHS < 0)
+        return -1;
+
+      // the right operand may assign the variable the left one read;
+      // the native code loads the left operand first, so copy it
+      if (unsigned(LHS) < stmt_start_ && !IsSimple(op->RHS_.get())) {
+        int copy = Temp();
+        if (copy < 0)
+          return -1;
+        Emit(Instr::MOV, copy, LHS);
+        LHS = copy;
+      }
+
+      int RHS = Expression(op->RHS_.get());
+      int reg = Temp();
+      if (RHS < 0 || reg < 0)
+        return -1;
+      if (swap)
+        Emit(code, reg, RHS, LHS);
+      else
+        Emit(code, reg, LHS, RHS);
+      return reg;
+    }
+
+    int Lowering::Logical(const ast::BinaryOperation *op) {
+      // the result starts out as what the left operand decides when it
+      // decides alone, and is overwritten if the right one runs
+      bool and_ = op->oper_ == "&&";
+      ast::IntegerLiteral decided(and_ ? 0 : 1), zero(0);
+      int reg = Expression(&decided);
+      int zreg = Expression(&zero);
+      int LHS = Expression(op->LHS_.get());
+      if (reg < 0 || zreg < 0 || LHS < 0)
+        return -1;
+
+      size_t skip;
+      if (and_) {
+        skip = Emit(Instr::JZ, LHS);
+      } else {
+        size_t jz = Emit(Instr::JZ, LHS);
+        skip = Emit(Instr::JMP);
+        Patch(jz);
+      }
+      int RHS = Expression(op->RHS_.get());
+      if (RHS < 0)
+        return -1;
+      Emit(Instr::NE, reg, RHS, zreg);
+      Patch(skip);
+      return reg;
+    }
+
+    int Lowering::Call(const ast::CallOperation *call) {
+      auto var = dynamic_cast<const ast::Variable*>(call->expr_.get());
+      if (var && IsBuiltin(var->ident_))
+        return Fail("it calls the builtin '" + var->ident_.str() + "'");
+      int index = var ? functions_.Find(var->ident_) : -1;
+      if (index < 0)
+        return Fail("it calls an unknown function");
+
+      const ast::Function *callee = functions_.functions_[index];
+      if (callee->name_args_.size() != call->args_.size())
+        return Fail("it calls '" + callee->name_.str() + "' with the wrong number of arguments");
+
+      int base = Arguments(call, callee);
+      int reg = Temp();
+      if (base < 0 || reg < 0)
+        return -1;
+      Emit(Instr::CALL, reg, index, base);
+      return reg;
+    }
+
+    /** Evaluate the arguments of a call into consecutive registers and
+        return the first of them.
+    */
+    int Lowering::Arguments(const ast::CallOperation *call, const ast::Function *callee) {
+      int base = next_reg_;
+      for (size_t i = 0; i < call->args_.size(); ++i) {
+        if (Temp() < 0)
+          return -1;
+      }
+
+      for (size_t i = 0; i < call->args_.size(); ++i) {
+        int val = Expression(call->args_[i].get());
+        if (val < 0)
+          return -1;
+        if (unsigned(val) != base + i)
+          Emit(Instr::MOV, base + i, val);
+      }
+      return base;
+    }
+
+    int Lowering::Lookup(llvm::StringRef name) const {
+      for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+        auto iter = scope->find(name);
+        if (iter != scope->end())
+          return iter->second;
+      }
+      return -1;
+    }
+
+    int Lowering::LookupLvalue(const ast::Expression *expr) {
+      auto var = dynamic_cast<const ast::Variable*>(expr);
+      int reg = var ? Lookup(var->ident_) : -1;
+      return reg >= 0 ? reg : Fail("it assigns to something other than a variable");
+    }
+
+    int Lowering::Temp() {
+      if (next_reg_ > kMaxOperand)
+        return Fail("it needs too many registers");
+      if (next_reg_ + 1 > chunk_.num_regs_)
+        chunk_.num_regs_ = next_reg_ + 1;
+      return next_reg_++;
+    }
+
+    size_t Lowering::Emit(Instr::Op op, uint16_t a, uint16_t b, uint16_t c) {
+      chunk_.code_.push_back(Instr(op, a, b, c));
+      return chunk_.code_.size() - 1;
+    }
+
+    int Lowering::Fail(const string& reason) {
+      if (reason_.empty())
+        reason_ = reason;
+      return -1;
+    }
+  }
+
+  unique_ptr<Chunk> Lower(const ast::Function& f, const FunctionTable& functions,
+                          string& reason) {
+    auto chunk = unique_ptr<Chunk>(new Chunk);
+    Lowering lowering(*chunk, functions, f);
+    if (!lowering.Function()) {
+      reason = lowering.reason();
+      return NULL;
+    }
+    return chunk;
+  }
+}
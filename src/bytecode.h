@@ -0,0 +1,81 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ast {
+  struct Function;
+}
+
+/** A compact register-based bytecode for the interpreter tier.
+
+    Every function is lowered to a Chunk: a flat array of fixed-size
+    instructions operating on a frame of int registers. Arguments arrive
+    in the first registers, locals and temporaries follow. Jump targets
+    are instruction indices, so a chunk can be executed in place without
+    any relocation.
+*/
+namespace bytecode {
+  struct Instr {
+    enum Op {
+      LOADK,    // a = consts[b]
+      MOV,      // a = b
+      ADD,      // a = b + c
+      ADDI,     // a = b + int16_t(c)
+      SUB,      // a = b - c
+      NEG,      // a = -b
+      EQ,       // a = b == c
+      NE,       // a = b != c
+      LT,       // a = b < c
+      LE,       // a = b <= c
+      JMP,      // goto b
+      JZ,       // if a == 0 goto b
+      LOOP,     // count a back edge, goto b
+      CALL,     // a = functions[b](c, c+1, ...)
+      RET,      // return a
+      RETV,     // return
+      NUM_OPS
+    };
+
+    Instr(Op op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0)
+      : op_(op), a_(a), b_(b), c_(c) {}
+
+    uint16_t op_;
+    uint16_t a_;
+    uint16_t b_;
+    uint16_t c_;
+  };
+
+  struct Chunk {
+    Chunk() : num_args_(0), num_regs_(0) {}
+
+    std::vector<Instr> code_;
+    std::vector<int32_t> consts_;
+    unsigned num_args_;
+    unsigned num_regs_;
+  };
+
+  /** The functions of a program, which call instructions refer to by
+      their index in this table.
+  */
+  struct FunctionTable {
+    void Add(const ast::Function *f);
+    int Find(llvm::StringRef name) const;
+
+    std::vector<const ast::Function*> functions_;
+
+  private:
+    std::unordered_map<std::string, unsigned> index_;
+  };
+
+  /** Lower a function to bytecode. Returns NULL, with the reason, for
+      functions the interpreter cannot run, such as those using types
+      other than int; they go straight to the native tier.
+  */
+  std::unique_ptr<Chunk> Lower(const ast::Function& f, const FunctionTable& functions,
+                               std::string& reason);
+}
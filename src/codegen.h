@@ -0,0 +1,84 @@
+#pragma once
+
+#include "bounds.h"
+#include "options.h"
+#include <vector>
+
+namespace llvm {
+  class AllocaInst;
+  class BasicBlock;
+  class Function;
+  class MDNode;
+  class Value;
+}
+
+struct ConstEval;
+struct DebugInfo;
+struct Messages;
+struct ModuleGraph;
+struct Profile;
+struct Scope;
+
+/** State shared by the code generator for a single compilation.
+    The root scope holds a pointer to it and every derived scope
+    inherits that pointer.
+*/
+struct CodegenContext {
+  CodegenContext(const Options& options, Messages& errs)
+    : options_(options), errs_(errs), profile_(NULL), imports_(NULL),
+      consteval_(NULL), debug_info_(NULL), globals_(NULL), bounds_checks_(0),
+      bounds_checks_removed_(0) {}
+
+  const Options& options_;
+  Messages& errs_;
+
+  /** Profile instrumentation or feedback, or NULL when not in use. */
+  Profile *profile_;
+
+  /** Interfaces of the modules imported by this one. */
+  const ModuleGraph *imports_;
+
+  /** Evaluator for calls to pure functions with constant arguments, or
+      NULL when compile-time evaluation is disabled.
+  */
+  ConstEval *consteval_;
+
+  /** Line tables (-g), or NULL when not in use. */
+  DebugInfo *debug_info_;
+
+  /** The root scope, which holds the module's constants. The bodies of
+      parfor loops, generated as functions of their own, start from it.
+  */
+  Scope *globals_;
+
+  /** Array index checks generated, and left out because the index was
+      known to be in bounds.
+  */
+  unsigned bounds_checks_;
+  unsigned bounds_checks_removed_;
+
+  /** The function currently being generated. A self call in tail
+      position stores the new arguments into args_ (NULL for unnamed
+      arguments, which the body cannot refer to) and jumps to body_.
+      Failed bounds checks branch to trap_, created on first use.
+
+      regions_ holds the regions open at the current point, innermost
+      last, and loop_regions_ how many of them were open when each
+      enclosing loop started, so that leaving a loop or the function
+      early frees the regions it leaves.
+
+      debug_scope_ is the subprogram the function's lines belong to.
+  */
+  struct FunctionState {
+    FunctionState() : f_(NULL), body_(NULL), trap_(NULL), debug_scope_(NULL) {}
+    llvm::Function *f_;
+    llvm::BasicBlock *body_;
+    std::vector<llvm::AllocaInst*> args_;
+    llvm::BasicBlock *trap_;
+    RangeFacts ranges_;
+    std::vector<llvm::Value*> regions_;
+    std::vector<size_t> loop_regions_;
+    llvm::MDNode *debug_scope_;
+  };
+  FunctionState function_;
+};
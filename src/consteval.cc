@@ -0,0 +1,127 @@
+
+#include "consteval.h"
+#include "ast.h"
+#include <llvm/DerivedTypes.h>
+#include <string>
+using std::string;
+using std::vector;
+
+namespace {
+  /** Bytecode instructions one top-level evaluation may execute. */
+  const unsigned kMaxSteps = 1 << 20;
+
+  /** Nested calls one evaluation may make. */
+  const unsigned kMaxDepth = 256;
+}
+
+ConstEval::ConstEval(const ast::Program& program)
+  : steps_(0), folded_(0), gave_up_(0) {
+  for (auto& stmt : program.stmts_) {
+    if (auto f = dynamic_cast<const ast::Function*>(stmt.get()))
+      table_.Add(f);
+  }
+
+  size_t n = table_.functions_.size();
+  for (size_t i = 0; i < n; ++i) {
+    string reason;
+    chunks_.push_back(bytecode::Lower(*table_.functions_[i], table_, reason));
+    pure_.push_back(chunks_.back() != NULL);
+  }
+
+  // a function is impure if it calls an impure function, which may
+  // itself only be known once its callees are; iterate to a fixed point
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (size_t i = 0; i < n; ++i) {
+      if (!pure_[i])
+        continue;
+      for (auto& instr : chunks_[i]->code_) {
+        if (instr.op_ == bytecode::Instr::CALL && !pure_[instr.b_]) {
+          pure_[i] = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+bool ConstEval::IsPure(llvm::StringRef name) const {
+  int index = table_.Find(name);
+  return index >= 0 && pure_[index];
+}
+
+bool ConstEval::Evaluate(llvm::StringRef name, const vector<int32_t>& args, int32_t& result) {
+  int index = table_.Find(name);
+  if (index < 0 || !pure_[index])
+    return false;
+
+  const ast::Function *f = table_.functions_[index];
+  if (!f->rettype_ || !f->rettype_->isIntegerTy(32) || f->name_args_.size() != args.size())
+    return false;
+
+  auto key = std::make_pair(unsigned(index), args);
+  auto iter = cache_.find(key);
+  if (iter == cache_.end()) {
+    int32_t value = 0;
+    steps_ = 0;
+    bool ok = Run(index, args.data(), 0, value);
+    if (!ok)
+      ++gave_up_;
+    iter = cache_.insert(std::make_pair(key, std::make_pair(ok, value))).first;
+  }
+
+  if (!iter->second.first)
+    return false;
+  ++folded_;
+  result = iter->second.second;
+  return true;
+}
+
+bool ConstEval::Run(unsigned index, const int32_t *args, unsigned depth, int32_t& result) {
+  using bytecode::Instr;
+  if (depth >= kMaxDepth)
+    return false;
+
+  const bytecode::Chunk& chunk = *chunks_[index];
+  vector<int32_t> r(chunk.num_regs_);
+  std::copy(args, args + chunk.num_args_, r.begin());
+
+  // arithmetic wraps around like the generated code
+  for (size_t pc = 0; ; ) {
+    if (++steps_ > kMaxSteps)
+      return false;
+
+    const Instr& in = chunk.code_[pc++];
+    switch (in.op_) {
+      case Instr::LOADK: r[in.a_] = chunk.consts_[in.b_]; break;
+      case Instr::MOV:   r[in.a_] = r[in.b_]; break;
+      case Instr::ADD:   r[in.a_] = uint32_t(r[in.b_]) + uint32_t(r[in.c_]); break;
+      case Instr::ADDI:  r[in.a_] = uint32_t(r[in.b_]) + uint32_t(int16_t(in.c_)); break;
+      case Instr::SUB:   r[in.a_] = uint32_t(r[in.b_]) - uint32_t(r[in.c_]); break;
+      case Instr::NEG:   r[in.a_] = 0 - uint32_t(r[in.b_]); break;
+      case Instr::EQ:    r[in.a_] = r[in.b_] == r[in.c_]; break;
+      case Instr::NE:    r[in.a_] = r[in.b_] != r[in.c_]; break;
+      case Instr::LT:    r[in.a_] = r[in.b_] < r[in.c_]; break;
+      case Instr::LE:    r[in.a_] = r[in.b_] <= r[in.c_]; break;
+      case Instr::JMP:   pc = in.b_; break;
+      case Instr::JZ:    if (!r[in.a_]) pc = in.b_; break;
+      case Instr::LOOP:  pc = in.b_; break;
+      case Instr::CALL: {
+        int32_t value;
+        if (!Run(in.b_, &r[in.c_], depth + 1, value))
+          return false;
+        r[in.a_] = value;
+        break;
+      }
+      case Instr::RET:
+        result = r[in.a_];
+        return true;
+      case Instr::RETV:
+        result = 0;
+        return true;
+      default:
+        return false;
+    }
+  }
+}
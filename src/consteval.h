@@ -0,0 +1,57 @@
+#pragma once
+
+#include "bytecode.h"
+#include <llvm/ADT/StringRef.h>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace ast {
+  struct Program;
+}
+
+/** Compile-time evaluation of calls to pure functions.
+
+    A function is pure when the interpreter can run it (it only uses int
+    values and locals) and everything it calls is pure; neat has no
+    global state, so such a function always returns the same result for
+    the same arguments. A call to a pure function returning int whose
+    arguments are all integer literals, possibly negated, is evaluated
+    while generating code and replaced by its result.
+
+    Whether a loop terminates is not decided statically: evaluation runs
+    the function's bytecode with a step limit and a recursion limit, and
+    a call that exceeds either is left as a runtime call. Results, and
+    failures, are cached, so repeated calls with the same arguments are
+    evaluated once.
+*/
+struct ConstEval {
+  explicit ConstEval(const ast::Program& program);
+
+  bool IsPure(llvm::StringRef name) const;
+
+  /** Evaluate a call, returning false if the function is not pure or
+      evaluation hit a limit.
+  */
+  bool Evaluate(llvm::StringRef name, const std::vector<int32_t>& args, int32_t& result);
+
+  /** Calls replaced by their result, and the distinct calls, by
+      function and arguments, that were not because they hit a limit.
+  */
+  unsigned folded() const { return folded_; }
+  unsigned gave_up() const { return gave_up_; }
+
+private:
+  bool Run(unsigned index, const int32_t *args, unsigned depth, int32_t& result);
+
+  bytecode::FunctionTable table_;
+  std::vector<std::unique_ptr<bytecode::Chunk>> chunks_;
+  std::vector<bool> pure_;
+  /** Function and arguments to whether evaluation succeeded and its result. */
+  std::map<std::pair<unsigned, std::vector<int32_t>>, std::pair<bool, int32_t>> cache_;
+  unsigned steps_;
+  unsigned folded_;
+  unsigned gave_up_;
+};
@@ -0,0 +1,56 @@
+
+#include "debuginfo.h"
+#include "util.h"
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+#include <llvm/Analysis/DebugInfo.h>
+#include <llvm/Analysis/DIBuilder.h>
+#include <llvm/Support/DebugLoc.h>
+#include <llvm/Support/Dwarf.h>
+#include <unistd.h>
+using namespace llvm;
+using std::string;
+
+namespace {
+  /** The directory of a source file, absolute so that tools find the
+      file wherever they run.
+  */
+  string SourceDirectory(const string& path) {
+    string dir = DirName(path);
+    if (!path.empty() && path[0] == '/')
+      return dir;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+      return dir;
+    return dir == "." ? string(cwd) : string(cwd) + "/" + dir;
+  }
+}
+
+DebugInfo::DebugInfo(Module& m, const string& path, bool optimized)
+  : builder_(new DIBuilder(m)), optimized_(optimized) {
+  string file = BaseName(path);
+  string dir = SourceDirectory(path);
+  // neat has no DWARF language code of its own; its functions follow C's
+  // conventions, so debuggers treat it as C
+  builder_->createCompileUnit(dwarf::DW_LANG_C99, file, dir, "neatc", optimized, "", 0);
+  file_ = builder_->createFile(file, dir);
+  type_ = builder_->createSubroutineType(DIFile(file_),
+                                         builder_->getOrCreateArray(ArrayRef<Value*>()));
+}
+
+DebugInfo::~DebugInfo() {}
+
+MDNode *DebugInfo::BeginFunction(Function *f, unsigned line) {
+  return builder_->createFunction(DIFile(file_), f->getName(), f->getName(), DIFile(file_),
+                                  line, DIType(type_), f->hasLocalLinkage(), true, 0,
+                                  optimized_, f);
+}
+
+void DebugInfo::SetLine(IRBuilder<>& irb, MDNode *scope, unsigned line) {
+  if (scope && line)
+    irb.SetCurrentDebugLocation(DebugLoc::get(line, 0, scope));
+}
+
+void DebugInfo::Finish() {
+  builder_->finalize();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <llvm/Support/IRBuilder.h>
+#include <memory>
+#include <string>
+
+namespace llvm {
+  class DIBuilder;
+  class Function;
+  class MDNode;
+  class Module;
+}
+
+/** Line-table-only debug info (-g).
+
+    The module gets a compile unit for its source file, and each function
+    a subprogram with an empty signature. Code is attributed to the line
+    of the statement it was generated for, which is all perf, gdb
+    backtraces and sanitizers need to name a source line; describing
+    variables and types would cost far more and help profiling not at all.
+*/
+struct DebugInfo {
+  DebugInfo(llvm::Module& m, const std::string& path, bool optimized);
+  ~DebugInfo();
+
+  /** Describe a function declared at a line, returning the scope the
+      lines of its code belong to.
+  */
+  llvm::MDNode *BeginFunction(llvm::Function *f, unsigned line);
+
+  /** Attribute the code irb generates from now on to a line of a scope.
+      Unknown lines, 0, leave the location as it was.
+  */
+  static void SetLine(llvm::IRBuilder<>& irb, llvm::MDNode *scope, unsigned line);
+
+  /** Finish the compile unit, once every function is generated. */
+  void Finish();
+
+private:
+  std::unique_ptr<llvm::DIBuilder> builder_;
+  llvm::MDNode *file_;
+  llvm::MDNode *type_;
+  bool optimized_;
+};
@@ -0,0 +1,62 @@
+
+#include "instrument.h"
+#include "options.h"
+#include "util.h"
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/Module.h>
+#include <llvm/Support/IRBuilder.h>
+#include <vector>
+using namespace llvm;
+
+bool ShouldInstrument(const Options& options, StringRef name) {
+  if (!options.instrument_functions_)
+    return false;
+
+  for (auto& pattern : options.instrument_exclude_) {
+    if (MatchGlob(pattern, name))
+      return false;
+  }
+
+  if (options.instrument_include_.empty())
+    return true;
+
+  for (auto& pattern : options.instrument_include_) {
+    if (MatchGlob(pattern, name))
+      return true;
+  }
+  return false;
+}
+
+void InstrumentFunction(Function& f) {
+  Module& m = *f.getParent();
+  LLVMContext& ctx = m.getContext();
+  Type *i8ptr = Type::getInt8PtrTy(ctx);
+  FunctionType *hook = FunctionType::get(Type::getVoidTy(ctx), i8ptr, false);
+  Constant *enter = m.getOrInsertFunction("__neat_trace_enter", hook);
+  Constant *exit = m.getOrInsertFunction("__neat_trace_exit", hook);
+
+  // the runtime keeps the name pointer in its events, so the name must
+  // live as long as the program does
+  Constant *str = ConstantDataArray::getString(ctx, f.getName());
+  GlobalVariable *var = new GlobalVariable(m, str->getType(), true,
+                                           GlobalValue::PrivateLinkage,
+                                           str, "__neat_trace_name");
+  var->setUnnamedAddr(true);
+  Constant *name = ConstantExpr::getBitCast(var, i8ptr);
+
+  BasicBlock& entry = f.getEntryBlock();
+  IRBuilder<>(&entry, entry.getFirstInsertionPt()).CreateCall(enter, name);
+
+  std::vector<ReturnInst*> rets;
+  for (auto bb = f.begin(); bb != f.end(); ++bb) {
+    if (ReturnInst *ret = dyn_cast<ReturnInst>(bb->getTerminator()))
+      rets.push_back(ret);
+  }
+  for (auto ret : rets) {
+    IRBuilder<>(ret).CreateCall(exit, name);
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+  class Function;
+}
+
+struct Options;
+
+/** Whether -finstrument-functions and its name patterns select a function. */
+bool ShouldInstrument(const Options& options, llvm::StringRef name);
+
+/** Insert calls to the tracing runtime (runtime/trace.cc) at the entry of
+    a function and before each of its returns.
+*/
+void InstrumentFunction(llvm::Function& f);
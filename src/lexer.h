@@ -3,9 +3,18 @@
 #include <llvm/ADT/StringRef.h>
 #include <vector>
 
+struct Messages;
+
 struct Lexer {
-  Lexer(llvm::StringRef contents)
-    : contents_(contents), start_(contents.begin()) {}
+  Lexer(llvm::StringRef contents, Messages *errs = NULL)
+    : contents_(contents), start_(contents.begin()), errs_(errs),
+      line_pos_(NULL), line_(1) {}
+
+  /** Lex a piece of a larger buffer that starts at start, so that line
+      information is reported relative to the whole buffer.
+  */
+  Lexer(llvm::StringRef contents, const char *start, Messages *errs = NULL)
+    : contents_(contents), start_(start), errs_(errs), line_pos_(NULL), line_(1) {}
 
   struct Token {
     enum Type {
@@ -19,13 +28,25 @@ struct Lexer {
       IF,
       ELSE,
       WHILE,
+      PARFOR,
+      REGION,
+      SWITCH,
+      CASE,
+      DEFAULT,
       FN,
       VAR,
       RETURN,
       BREAK,
       CONTINUE,
       ARROW,
+      RANGE,
       PAREN,
+      ATTR,
+      IMPORT,
+      STRUCT,
+      CONST,
+      DOT,
+      STRING,
       UNKNOWN,
       TEOF
     };
@@ -56,6 +77,7 @@ struct Lexer {
 
   void SkipWhitespace();
   void ReadToken();
+  void InvalidCharacter(char ch);
   Token PeekToken() const { return cur_; }
 
   Token GetToken() {
@@ -98,8 +120,19 @@ struct Lexer {
 
   LineInfo GetLineInfo() const;
 
+  /** The line of the current token. Unlike GetLineInfo, which is meant
+      for diagnostics, this carries on counting from the previous call, so
+      asking for the line of every statement stays linear in the source.
+  */
+  size_t Line() const;
+
   llvm::StringRef contents_;
   llvm::StringRef::iterator start_;
   std::vector<llvm::StringRef> stack_;
   Token cur_;
+  Messages *errs_;
+
+  /** Where Line counted up to, and the line there. */
+  mutable const char *line_pos_;
+  mutable size_t line_;
 };
@@ -1,5 +1,7 @@
 
 #include "lexer.h"
+#include "parse.h"
+#include <algorithm>
 #include <ctype.h>
 #include <stdio.h>
 
@@ -18,7 +20,10 @@ void Lexer::ReadToken() {
   cur_.clear();
 
   if (contents_.empty()) {
+    // keep the position so errors at the end of input, or at the end of
+    // a piece being parsed in parallel, report the right location
     cur_.type_ = Token::TEOF;
+    cur_.val_ = contents_;
     return;
   }
 
@@ -28,28 +33,55 @@ void Lexer::ReadToken() {
     "if"   { get_token(p, Token::IF); return; }
     "else" { get_token(p, Token::ELSE); return; }
     "while" { get_token(p, Token::WHILE); return; }
+    "parfor" { get_token(p, Token::PARFOR); return; }
+    "region" { get_token(p, Token::REGION); return; }
+    "switch" { get_token(p, Token::SWITCH); return; }
+    "case" { get_token(p, Token::CASE); return; }
+    "default" { get_token(p, Token::DEFAULT); return; }
     "fn"   { get_token(p, Token::FN); return; }
     "var"  { get_token(p, Token::VAR); return; }
     "return" { get_token(p, Token::RETURN); return; }
     "break" { get_token(p, Token::BREAK); return; }
     "continue" { get_token(p, Token::CONTINUE); return; }
-    [{}]   { get_token(p, Token::BRACKET); return; }
+    "import" { get_token(p, Token::IMPORT); return; }
+    "struct" { get_token(p, Token::STRUCT); return; }
+    "const" { get_token(p, Token::CONST); return; }
+    ["] [^"\n\000]* ["] { get_token(p, Token::STRING); return; }
+    [{}\[\]] { get_token(p, Token::BRACKET); return; }
     [()]   { get_token(p, Token::PAREN); return; }
     "->"   { get_token(p, Token::ARROW); return; }
+    ".."   { get_token(p, Token::RANGE); return; }
+    "."    { get_token(p, Token::DOT); return; }
     ":"    { get_token(p, Token::COLON); return; }
     ";"    { get_token(p, Token::SEMICOLON); return; }
+    "@" ident { get_token(p, Token::ATTR); return; }
     "+"[+=]? { get_token(p, Token::OPER); return; }
     "-"[-=]? { get_token(p, Token::OPER); return; }
     "*"[=]?  { get_token(p, Token::OPER); return; }
     "/"[=]?  { get_token(p, Token::OPER); return; }
     "="[=]?  { get_token(p, Token::OPER); return; }
+    "<"[=]?  { get_token(p, Token::OPER); return; }
+    ">"[=]?  { get_token(p, Token::OPER); return; }
+    "!"[=]?  { get_token(p, Token::OPER); return; }
+    "&&"     { get_token(p, Token::OPER); return; }
+    "||"     { get_token(p, Token::OPER); return; }
+    ","      { get_token(p, Token::OPER); return; }
     ident  { get_token(p, Token::IDENT); return; }
     integer { get_token(p, Token::INT); return; }
-    [^] { fprintf(stderr, "invalid character: '%c'\n", *(p-1)); continue; }
+    [^] { InvalidCharacter(*(p-1)); continue; }
     */
   }
 }
 
+void Lexer::InvalidCharacter(char ch) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "invalid character: '%c'", ch);
+  if (errs_)
+    errs_->Warning(buf);
+  else
+    fprintf(stderr, "%s\n", buf);
+}
+
 void Lexer::SkipWhitespace() {
   const char *p = contents_.data();
   while (*p) {
@@ -106,3 +138,17 @@ Lexer::LineInfo Lexer::GetLineInfo() const {
 
   return { llvm::StringRef(pbeg, pend-pbeg), line, static_cast<size_t>(p-pbeg)+1 };
 }
+
+size_t Lexer::Line() const {
+  const char *ptr = cur_.val_.data();
+  if (!ptr)
+    return line_;
+  // backtracking moves the lexer back, so start over
+  if (!line_pos_ || ptr < line_pos_) {
+    line_pos_ = start_;
+    line_ = 1;
+  }
+  line_ += std::count(line_pos_, ptr, '\n');
+  line_pos_ = ptr;
+  return line_;
+}
@@ -0,0 +1,351 @@
+
+#include "link.h"
+#include "options.h"
+#include "parse.h"
+#include "target.h"
+#include <llvm/Attributes.h>
+#include <llvm/Constants.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Linker.h>
+#include <llvm/Module.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Target/TargetMachine.h>
+#include <atomic>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+using namespace llvm;
+using std::string;
+using std::vector;
+
+namespace {
+  /** Largest function, in instructions, that is imported into a caller. */
+  const double kImportLimit = 100;
+
+  /** Hot functions, by profile, get a larger import budget. */
+  const double kHotMultiplier = 3;
+
+  /** Each level of callees of an imported function gets a smaller budget. */
+  const double kImportDecay = 0.7;
+
+  struct FunctionSummary {
+    FunctionSummary()
+      : module_(0), size_(0), external_(false), importable_(false),
+        hot_(false), cold_(false) {}
+
+    unsigned module_;
+    unsigned size_;
+    bool external_;
+    bool importable_;
+    bool hot_;
+    bool cold_;
+    vector<string> callees_;
+  };
+
+  struct ModuleSummary {
+    std::unordered_map<string, FunctionSummary> functions_;
+    string err_;
+  };
+
+  /** Source module index to the functions imported from it. */
+  typedef std::map<unsigned, std::set<string>> ImportList;
+
+  Module *LoadModule(const string& path, LLVMContext& ctx, string& err) {
+    OwningPtr<MemoryBuffer> buf;
+    if (error_code ec = MemoryBuffer::getFile(path, buf)) {
+      err = path + ": " + ec.message();
+      return NULL;
+    }
+
+    Module *m = ParseBitcodeFile(buf.get(), ctx, &err);
+    if (!m)
+      err = path + ": " + err;
+    return m;
+  }
+
+  /** Whether a value refers to state private to its module, which a
+      copy of the referring function in another module would not share.
+  */
+  bool RefersToLocalState(const Value *v) {
+    if (const GlobalVariable *gv = dyn_cast<GlobalVariable>(v))
+      return gv->hasLocalLinkage() && !gv->isConstant();
+    if (const Function *f = dyn_cast<Function>(v))
+      return f->hasLocalLinkage();
+    if (const ConstantExpr *ce = dyn_cast<ConstantExpr>(v)) {
+      for (unsigned i = 0; i < ce->getNumOperands(); ++i) {
+        if (RefersToLocalState(ce->getOperand(i)))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  void Summarize(const Module& m, unsigned index, ModuleSummary& summary) {
+    for (auto f = m.begin(); f != m.end(); ++f) {
+      if (f->isDeclaration())
+        continue;
+
+      FunctionSummary& fs = summary.functions_[f->getName()];
+      fs.module_ = index;
+      fs.external_ = !f->hasLocalLinkage();
+      fs.importable_ = fs.external_;
+      fs.hot_ = f->hasFnAttr(Attribute::InlineHint);
+      fs.cold_ = f->hasFnAttr(Attribute::OptimizeForSize);
+
+      for (auto bb = f->begin(); bb != f->end(); ++bb) {
+        for (auto inst = bb->begin(); inst != bb->end(); ++inst) {
+          ++fs.size_;
+          if (const CallInst *call = dyn_cast<CallInst>(inst)) {
+            if (const Function *callee = call->getCalledFunction())
+              fs.callees_.push_back(callee->getName());
+          }
+          for (unsigned i = 0; i < inst->getNumOperands(); ++i) {
+            if (RefersToLocalState(inst->getOperand(i)))
+              fs.importable_ = false;
+          }
+        }
+      }
+    }
+  }
+
+  ImportList PlanImports(unsigned index, const vector<ModuleSummary>& summaries,
+                         const std::unordered_map<string, const FunctionSummary*>& defs) {
+    ImportList imports;
+    std::set<string> seen;
+    vector<std::pair<string, double>> worklist;
+    for (auto& fs : summaries[index].functions_) {
+      for (auto& callee : fs.second.callees_) {
+        worklist.push_back(std::make_pair(callee, kImportLimit));
+      }
+    }
+
+    while (!worklist.empty()) {
+      auto item = worklist.back();
+      worklist.pop_back();
+
+      auto iter = defs.find(item.first);
+      if (iter == defs.end())
+        continue;
+
+      const FunctionSummary& fs = *iter->second;
+      if (fs.module_ == index || !fs.importable_ || fs.cold_)
+        continue;
+
+      double limit = fs.hot_ ? item.second * kHotMultiplier : item.second;
+      if (fs.size_ > limit || !seen.insert(item.first).second)
+        continue;
+
+      imports[fs.module_].insert(item.first);
+      for (auto& callee : fs.callees_) {
+        worklist.push_back(std::make_pair(callee, item.second * kImportDecay));
+      }
+    }
+    return imports;
+  }
+
+  /** Strip a module down to the functions to import, which become
+      available_externally copies: visible to the optimizer, but never
+      emitted, since the module that defines them still does.
+  */
+  void ExtractImports(Module& m, const std::set<string>& names) {
+    // module constructors run from the module that defines them
+    if (GlobalVariable *ctors = m.getNamedGlobal("llvm.global_ctors"))
+      ctors->eraseFromParent();
+
+    vector<Function*> locals;
+    for (auto f = m.begin(); f != m.end(); ++f) {
+      if (f->isDeclaration())
+        continue;
+      if (names.count(f->getName())) {
+        f->setLinkage(GlobalValue::AvailableExternallyLinkage);
+      } else {
+        if (f->hasLocalLinkage())
+          locals.push_back(f);
+        f->deleteBody();
+      }
+    }
+
+    for (auto gv = m.global_begin(); gv != m.global_end(); ++gv) {
+      if (!gv->hasLocalLinkage() && !gv->isDeclaration()) {
+        gv->setInitializer(NULL);
+        gv->setLinkage(GlobalValue::ExternalLinkage);
+      }
+    }
+
+    // nothing imported refers to local functions or mutable globals, so
+    // with the other bodies gone they become unused; constant tables can
+    // refer to each other, so repeat until nothing else goes away
+    for (auto f : locals) {
+      f->removeDeadConstantUsers();
+      if (f->use_empty())
+        f->eraseFromParent();
+    }
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (auto gv = m.global_begin(); gv != m.global_end(); ) {
+        GlobalVariable *var = gv++;
+        var->removeDeadConstantUsers();
+        if (var->hasLocalLinkage() && var->use_empty()) {
+          var->eraseFromParent();
+          changed = true;
+        }
+      }
+    }
+  }
+
+  bool RunCommand(const vector<string>& args) {
+    vector<char*> argv;
+    for (auto& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0)
+      return false;
+    if (pid == 0) {
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+      return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  template <typename F>
+  void ParallelFor(size_t n, unsigned jobs, F f) {
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      for (size_t i; (i = next++) < n; ) {
+        f(i);
+      }
+    };
+
+    vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs && i < n; ++i) {
+      threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+}
+
+bool LinkProgram(const vector<string>& inputs, const string& output,
+                 const Options& options, Messages& errs) {
+  llvm_start_multithreaded();
+  // the target registry is not locked, so the target is registered here
+  // rather than by the first of the workers creating target machines
+  InitializeNativeTarget();
+  unsigned jobs = options.jobs_ ? options.jobs_ : std::thread::hardware_concurrency();
+  size_t n = inputs.size();
+
+  vector<ModuleSummary> summaries(n);
+  ParallelFor(n, jobs, [&](size_t i) {
+    LLVMContext ctx;
+    OwningPtr<Module> m(LoadModule(inputs[i], ctx, summaries[i].err_));
+    if (m)
+      Summarize(*m, i, summaries[i]);
+  });
+
+  std::unordered_map<string, const FunctionSummary*> defs;
+  bool ok = true;
+  for (auto& summary : summaries) {
+    if (!summary.err_.empty()) {
+      errs.Error("error: " + summary.err_);
+      ok = false;
+    }
+    for (auto& fs : summary.functions_) {
+      if (!fs.second.external_)
+        continue;
+      if (!defs.insert(std::make_pair(fs.first, &fs.second)).second) {
+        errs.Error("error: '" + fs.first + "' is defined in more than one module");
+        ok = false;
+      }
+    }
+  }
+  if (!ok)
+    return false;
+
+  vector<string> objects(n), failures(n);
+  ParallelFor(n, jobs, [&](size_t i) {
+    string& err = failures[i];
+    ImportList imports = PlanImports(i, summaries, defs);
+
+    LLVMContext ctx;
+    OwningPtr<Module> m(LoadModule(inputs[i], ctx, err));
+    if (!m)
+      return;
+
+    for (auto& import : imports) {
+      OwningPtr<Module> src(LoadModule(inputs[import.first], ctx, err));
+      if (!src)
+        return;
+      ExtractImports(*src, import.second);
+      if (Linker::LinkModules(m.get(), src.get(), Linker::DestroySource, &err)) {
+        err = inputs[i] + ": " + err;
+        return;
+      }
+    }
+
+    OwningPtr<TargetMachine> tm(CreateTargetMachine(options, err));
+    if (!tm) {
+      err = inputs[i] + ": " + err;
+      return;
+    }
+    ConfigureModule(*m, *tm);
+    Optimize(*m, options, tm.get());
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u.o", unsigned(i));
+    string object = output + suffix;
+    if (WriteModule(*m, tm.get(), object, err))
+      objects[i] = object;
+    else
+      err = object + ": " + err;
+  });
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!failures[i].empty()) {
+      errs.Error("error: " + failures[i]);
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    vector<string> args;
+    args.push_back("c++");
+    args.push_back("-o");
+    args.push_back(output);
+    args.insert(args.end(), objects.begin(), objects.end());
+    if (!options.runtime_.empty())
+      args.push_back(options.runtime_);
+    args.push_back("-pthread");
+
+    if (!RunCommand(args)) {
+      errs.Error("error: linking '" + output + "' failed");
+      ok = false;
+    }
+  }
+
+  for (auto& object : objects) {
+    if (!object.empty())
+      unlink(object.c_str());
+  }
+  return ok;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct Messages;
+struct Options;
+
+/** Link neat bitcode files into a native executable.
+
+    The link is done in three phases, in the style of ThinLTO:
+
+    1. Every input is summarized in parallel: the size of each function,
+       the functions it calls and whether a profile marked it hot or cold.
+    2. From the combined summaries, each module picks the functions from
+       other modules worth importing: small callees, with a larger budget
+       for hot ones and a shrinking budget for the callees of imported
+       functions.
+    3. Each module, along with copies of the functions it imports, is
+       optimized and compiled to an object file in parallel. The objects
+       are then linked with the runtime by the system compiler driver.
+
+    No phase loads more than one module plus its imports per thread.
+*/
+bool LinkProgram(const std::vector<std::string>& inputs, const std::string& output,
+                 const Options& options, Messages& errs);
@@ -0,0 +1,303 @@
+
+#include "module.h"
+#include "ast.h"
+#include "parse.h"
+#include "structs.h"
+#include "util.h"
+#include <llvm/DerivedTypes.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Module.h>
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+  const char kMagic[8] = { 'N', 'E', 'A', 'T', 'I', 'F', 0, 2 };
+}
+
+unique_ptr<Interface> Interface::Map(const string& path, uint64_t hash) {
+  auto iface = unique_ptr<Interface>(new Interface);
+  if (!iface->file_.Map(path) || iface->file_.size() < sizeof(Header))
+    return NULL;
+
+  iface->data_ = iface->file_.data();
+  iface->size_ = iface->file_.size();
+  return iface->Validate(hash) ? move(iface) : NULL;
+}
+
+unique_ptr<Interface> Interface::Build(const ast::Program& program, uint64_t hash) {
+  vector<StructRecord> structs;
+  vector<FieldRecord> fields;
+  vector<FunctionRecord> functions;
+  vector<Ref> args;
+  string strtab;
+  unordered_map<string, Ref> strings;
+
+  auto intern = [&](const string& str) {
+    auto iter = strings.find(str);
+    if (iter != strings.end())
+      return iter->second;
+    Ref ref = { uint32_t(strtab.size()), uint32_t(str.size()) };
+    strtab.append(str);
+    strings[str] = ref;
+    return ref;
+  };
+
+  for (auto& stmt : program.stmts_) {
+    auto decl = dynamic_cast<const ast::StructDecl*>(stmt.get());
+    if (!decl) continue;
+
+    const StructInfo& info = *decl->info_;
+    StructRecord record;
+    record.name_ = intern(info.name_);
+    record.fields_ = fields.size();
+    record.num_fields_ = info.names_.size();
+    record.flags_ = (info.soa_ ? kSoa : 0) | (info.ordered_ ? kOrdered : 0);
+    for (size_t i = 0; i < info.names_.size(); ++i) {
+      FieldRecord field = { intern(info.names_[i]), intern(TypeName(info.types_[i])) };
+      fields.push_back(field);
+    }
+    structs.push_back(record);
+  }
+
+  for (auto& stmt : program.stmts_) {
+    auto f = dynamic_cast<const ast::Function*>(stmt.get());
+    if (!f) continue;
+
+    FunctionRecord record;
+    record.name_ = intern(f->name_);
+    record.rettype_ = intern(f->rettype_ ? TypeName(f->rettype_) : "void");
+    record.args_ = args.size();
+    record.num_args_ = f->type_args_.size();
+    for (auto type : f->type_args_) {
+      args.push_back(intern(TypeName(type)));
+    }
+    functions.push_back(record);
+  }
+
+  Header header;
+  memcpy(header.magic_, kMagic, sizeof(kMagic));
+  header.hash_ = hash;
+  header.num_structs_ = structs.size();
+  header.num_fields_ = fields.size();
+  header.num_functions_ = functions.size();
+  header.num_args_ = args.size();
+  header.strtab_size_ = strtab.size();
+  header.reserved_ = 0;
+
+  auto iface = unique_ptr<Interface>(new Interface);
+  string& buf = iface->buffer_;
+  buf.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  buf.append(reinterpret_cast<const char*>(structs.data()),
+             structs.size() * sizeof(StructRecord));
+  buf.append(reinterpret_cast<const char*>(fields.data()),
+             fields.size() * sizeof(FieldRecord));
+  buf.append(reinterpret_cast<const char*>(functions.data()),
+             functions.size() * sizeof(FunctionRecord));
+  buf.append(reinterpret_cast<const char*>(args.data()), args.size() * sizeof(Ref));
+  buf.append(strtab);
+  iface->data_ = buf.data();
+  iface->size_ = buf.size();
+  return iface;
+}
+
+bool Interface::Write(const string& path) const {
+  // a concurrent compilation must never map a partially written interface
+  return WriteFileAtomic(path, llvm::StringRef(data_, size_));
+}
+
+const Interface::StructRecord *Interface::structs() const {
+  return reinterpret_cast<const StructRecord*>(data_ + sizeof(Header));
+}
+
+const Interface::FieldRecord *Interface::fields() const {
+  return reinterpret_cast<const FieldRecord*>(structs() + header().num_structs_);
+}
+
+const Interface::FunctionRecord *Interface::functions() const {
+  return reinterpret_cast<const FunctionRecord*>(fields() + header().num_fields_);
+}
+
+const Interface::Ref *Interface::args() const {
+  return reinterpret_cast<const Ref*>(functions() + header().num_functions_);
+}
+
+const char *Interface::strtab() const {
+  return reinterpret_cast<const char*>(args() + header().num_args_);
+}
+
+bool Interface::Validate(uint64_t hash) const {
+  const Header& h = header();
+  if (memcmp(h.magic_, kMagic, sizeof(kMagic)) != 0 || h.hash_ != hash)
+    return false;
+
+  uint64_t expected = sizeof(Header) +
+    uint64_t(h.num_structs_) * sizeof(StructRecord) +
+    uint64_t(h.num_fields_) * sizeof(FieldRecord) +
+    uint64_t(h.num_functions_) * sizeof(FunctionRecord) +
+    uint64_t(h.num_args_) * sizeof(Ref) + h.strtab_size_;
+  if (expected != size_)
+    return false;
+
+  auto valid = [&](const Ref& ref) {
+    return uint64_t(ref.offset_) + ref.size_ <= h.strtab_size_;
+  };
+  for (uint32_t i = 0; i < h.num_structs_; ++i) {
+    const StructRecord& s = structs()[i];
+    if (!valid(s.name_) || uint64_t(s.fields_) + s.num_fields_ > h.num_fields_)
+      return false;
+  }
+  for (uint32_t i = 0; i < h.num_fields_; ++i) {
+    if (!valid(fields()[i].name_) || !valid(fields()[i].type_))
+      return false;
+  }
+  for (uint32_t i = 0; i < h.num_functions_; ++i) {
+    const FunctionRecord& f = functions()[i];
+    if (!valid(f.name_) || !valid(f.rettype_) ||
+        uint64_t(f.args_) + f.num_args_ > h.num_args_)
+      return false;
+  }
+  for (uint32_t i = 0; i < h.num_args_; ++i) {
+    if (!valid(args()[i]))
+      return false;
+  }
+  return true;
+}
+
+bool Interface::Declare(llvm::Module& m, Messages& errs) const {
+  llvm::LLVMContext& ctx = m.getContext();
+  auto str = [&](const Ref& ref) {
+    return llvm::StringRef(strtab() + ref.offset_, ref.size_);
+  };
+
+  bool ok = true;
+  for (uint32_t i = 0; i < header().num_structs_; ++i) {
+    const StructRecord& s = structs()[i];
+    string name = str(s.name_).str();
+    vector<string> names;
+    vector<llvm::Type*> types;
+    bool known = true;
+    for (uint32_t j = 0; j < s.num_fields_; ++j) {
+      const FieldRecord& field = fields()[s.fields_ + j];
+      llvm::Type *type = LookupType(ctx, str(field.type_));
+      known = known && type;
+      names.push_back(str(field.name_).str());
+      types.push_back(type);
+    }
+    if (!known) {
+      errs.Error("error: unknown type in the interface of struct '" + name + "'");
+      ok = false;
+      continue;
+    }
+
+    // the importing module may declare the same struct to use it
+    bool soa = s.flags_ & kSoa, ordered = s.flags_ & kOrdered;
+    const StructInfo *info = FindStruct(ctx, name);
+    if (!info) {
+      DeclareStruct(ctx, name, names, types, soa, ordered);
+    } else if (info->names_ != names || info->types_ != types ||
+               info->soa_ != soa || info->ordered_ != ordered) {
+      errs.Error("error: struct '" + name + "' differs from its declaration in an imported module");
+      ok = false;
+    }
+  }
+
+  for (uint32_t i = 0; i < header().num_functions_; ++i) {
+    const FunctionRecord& f = functions()[i];
+    llvm::Type *rettype = LookupType(ctx, str(f.rettype_));
+    vector<llvm::Type*> params;
+    for (uint32_t j = 0; j < f.num_args_; ++j) {
+      llvm::Type *type = LookupType(ctx, str(args()[f.args_ + j]));
+      if (!type)
+        rettype = NULL;
+      params.push_back(type ? ParameterType(type) : NULL);
+    }
+
+    if (!rettype) {
+      errs.Error("error: unknown type in the interface of '" + str(f.name_).str() + "'");
+      ok = false;
+      continue;
+    }
+    m.getOrInsertFunction(str(f.name_), llvm::FunctionType::get(rettype, params, false));
+  }
+  return ok;
+}
+
+bool ModuleGraph::Load(const ast::Program& program, const string& path) {
+  vector<string> imports;
+  for (auto& stmt : program.stmts_) {
+    auto import = dynamic_cast<const ast::Import*>(stmt.get());
+    if (import && !interfaces_.count(import->path_)) {
+      interfaces_[import->path_] = NULL;
+      imports.push_back(import->path_);
+    }
+  }
+  if (imports.empty())
+    return true;
+
+  string dir = path == "<stdin>" ? "." : DirName(path);
+  size_t n = imports.size();
+  vector<unique_ptr<Interface>> results(n);
+  vector<Messages> msgs(n);
+  atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < n; ) {
+      const string& import = imports[i];
+      string source = import[0] == '/' ? import : dir + "/" + import;
+      results[i] = LoadModule(source, msgs[i]);
+    }
+  };
+
+  vector<thread> threads;
+  for (unsigned i = 1; i < jobs_ && i < n; ++i) {
+    threads.push_back(thread(worker));
+  }
+  worker();
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < n; ++i) {
+    errs_.Append(msgs[i]);
+    ok = ok && results[i];
+    interfaces_[imports[i]] = move(results[i]);
+  }
+  return ok;
+}
+
+const Interface *ModuleGraph::Find(const string& path) const {
+  auto iter = interfaces_.find(path);
+  return iter != interfaces_.end() ? iter->second.get() : NULL;
+}
+
+unique_ptr<Interface> ModuleGraph::LoadModule(const string& path, Messages& errs) {
+  string contents = ReadFile(path);
+  if (contents.empty()) {
+    errs.Error("error: could not read module '" + path + "'");
+    return NULL;
+  }
+
+  uint64_t hash = HashBytes(contents);
+  string iface_path = path + ".neati";
+  auto iface = Interface::Map(iface_path, hash);
+  if (iface)
+    return iface;
+
+  // parse in a private context, since LLVMContext is not thread safe
+  llvm::LLVMContext ctx;
+  auto program = ParseProgram(ctx, errs, path, contents);
+  if (!program) {
+    ForgetStructs(ctx);
+    return NULL;
+  }
+
+  iface = Interface::Build(*program, hash);
+  ForgetStructs(ctx);
+  if (!iface->Write(iface_path))
+    errs.Warning("warning: could not write interface '" + iface_path + "'");
+  return iface;
+}
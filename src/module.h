@@ -0,0 +1,135 @@
+#pragma once
+
+#include "util.h"
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+namespace llvm {
+  class Module;
+}
+
+namespace ast {
+  struct Program;
+}
+
+struct Messages;
+
+/** The binary interface of a module: the prototypes of the functions it
+    defines and the structs they may use. An importing module only needs
+    these to declare the functions it calls, so it never has to parse
+    the imported source.
+
+    Interface files are written next to the module source as
+    <source>.neati and are mapped into memory when read. Everything is
+    addressed by offset, so the mapped file is used in place:
+
+      Header
+      StructRecord[num_structs]     in declaration order
+      FieldRecord[num_fields]       indexed by StructRecord::fields
+      FunctionRecord[num_functions]
+      Ref[num_args]                 argument types, indexed by FunctionRecord::args
+      char[strtab_size]             string table
+
+    Types are stored by their source names, so the structs are declared
+    before the functions that use them. The header holds a hash of the
+    module source, and an interface whose hash does not match the
+    current source is rebuilt.
+*/
+struct Interface {
+  Interface() : data_(NULL), size_(0) {}
+
+  /** Map an interface file, returning NULL if it is missing, malformed
+      or was built from a source with a different hash.
+  */
+  static std::unique_ptr<Interface> Map(const std::string& path, uint64_t hash);
+
+  /** Build the interface of a parsed module. */
+  static std::unique_ptr<Interface> Build(const ast::Program& program, uint64_t hash);
+
+  bool Write(const std::string& path) const;
+
+  /** Declare the structs and functions of the interface in a module. A
+      struct the module already declares must have the same fields.
+  */
+  bool Declare(llvm::Module& m, Messages& errs) const;
+
+private:
+  struct Ref {
+    uint32_t offset_;
+    uint32_t size_;
+  };
+
+  struct Header {
+    char magic_[8];
+    uint64_t hash_;
+    uint32_t num_structs_;
+    uint32_t num_fields_;
+    uint32_t num_functions_;
+    uint32_t num_args_;
+    uint32_t strtab_size_;
+    uint32_t reserved_;
+  };
+
+  enum { kSoa = 1, kOrdered = 2 };
+
+  struct StructRecord {
+    Ref name_;
+    uint32_t fields_;
+    uint32_t num_fields_;
+    /** kSoa and kOrdered */
+    uint32_t flags_;
+  };
+
+  struct FieldRecord {
+    Ref name_;
+    Ref type_;
+  };
+
+  struct FunctionRecord {
+    Ref name_;
+    Ref rettype_;
+    uint32_t args_;
+    uint32_t num_args_;
+  };
+
+  bool Validate(uint64_t hash) const;
+
+  const Header& header() const { return *reinterpret_cast<const Header*>(data_); }
+  const StructRecord *structs() const;
+  const FieldRecord *fields() const;
+  const FunctionRecord *functions() const;
+  const Ref *args() const;
+  const char *strtab() const;
+
+  const char *data_;
+  size_t size_;
+  MappedFile file_;
+  std::string buffer_;
+};
+
+/** The modules imported by the module being compiled.
+    Only direct imports are loaded, and only their interfaces, so the
+    time to compile a module depends on its own size and the size of the
+    interfaces it imports. Imports whose interface is missing or stale
+    are parsed in parallel, each in its own LLVMContext.
+*/
+struct ModuleGraph {
+  ModuleGraph(Messages& errs, unsigned jobs) : errs_(errs), jobs_(jobs) {}
+
+  /** Load the interfaces of the imports of a program. The import paths
+      are relative to the directory of the program's source.
+  */
+  bool Load(const ast::Program& program, const std::string& path);
+
+  /** Find the interface of an import, by its path as written. */
+  const Interface *Find(const std::string& path) const;
+
+private:
+  std::unique_ptr<Interface> LoadModule(const std::string& path, Messages& errs);
+
+  Messages& errs_;
+  unsigned jobs_;
+  std::unordered_map<std::string, std::unique_ptr<Interface>> interfaces_;
+};
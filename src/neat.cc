@@ -0,0 +1,148 @@
+
+#include "neat.h"
+#include "parse.h"
+#include "perfmap.h"
+#include "tier.h"
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Threading.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+using namespace std;
+using namespace llvm;
+
+struct neat_context {
+  Options options_;
+  LLVMContext llvm_;
+  /** Created on the first compilation, around an empty module of its own;
+      programs are added to it and removed again when released.
+  */
+  unique_ptr<ExecutionEngine> ee_;
+  unordered_set<neat_program*> programs_;
+  string messages_;
+};
+
+struct neat_program {
+  neat_context *ctx_;
+  /** Owned by the execution engine while the program is compiled. */
+  Module *module_;
+  unordered_map<string, void*> functions_;
+};
+
+namespace {
+  bool StartEngine(neat_context *ctx) {
+    if (ctx->ee_)
+      return true;
+
+    string err;
+    ctx->ee_.reset(EngineBuilder(new Module("libneat", ctx->llvm_))
+                   .setErrorStr(&err)
+                   .setEngineKind(EngineKind::JIT)
+                   .setOptLevel(CodeGenOpt::Default)
+                   .create());
+    if (!ctx->ee_) {
+      ctx->messages_ = "error: could not start the JIT: " + err + "\n";
+      return false;
+    }
+    // everything is compiled up front, so no compilation is left to
+    // happen on the threads that call into the program
+    ctx->ee_->DisableLazyCompilation(true);
+    if (ctx->options_.perf_map_)
+      ctx->ee_->RegisterJITEventListener(PerfMapListener());
+    return true;
+  }
+}
+
+extern "C" neat_context *neat_context_create(unsigned opt_level) {
+  static once_flag once;
+  call_once(once, [] {
+    llvm_start_multithreaded();
+    InitializeNativeTarget();
+  });
+
+  neat_context *ctx = new neat_context;
+  ctx->options_.opt_level_ = opt_level > 3 ? 3 : opt_level;
+  // programs are small, so parsing them on several threads does not pay
+  ctx->options_.jobs_ = 1;
+  return ctx;
+}
+
+extern "C" void neat_context_destroy(neat_context *ctx) {
+  if (!ctx)
+    return;
+  while (!ctx->programs_.empty()) {
+    neat_release(*ctx->programs_.begin());
+  }
+  delete ctx;
+}
+
+extern "C" void neat_context_set_perf_map(neat_context *ctx, int enable) {
+  if (ctx->options_.perf_map_ == (enable != 0))
+    return;
+  ctx->options_.perf_map_ = enable != 0;
+  ctx->options_.debug_info_ = enable != 0;
+  if (ctx->ee_ && enable)
+    ctx->ee_->RegisterJITEventListener(PerfMapListener());
+  else if (ctx->ee_)
+    ctx->ee_->UnregisterJITEventListener(PerfMapListener());
+}
+
+extern "C" neat_program *neat_compile(neat_context *ctx, const char *name,
+                                      const char *source, size_t length) {
+  ctx->messages_.clear();
+  if (!StartEngine(ctx))
+    return NULL;
+
+  Parser parser(ctx->llvm_, name, ctx->options_);
+  auto msgs = parser.Parse(string(source, length), name);
+  for (auto& msg : msgs->messages()) {
+    ctx->messages_ += msg.msg() + "\n";
+  }
+  if (!*msgs)
+    return NULL;
+  parser.Optimize();
+
+  auto program = unique_ptr<neat_program>(new neat_program);
+  program->ctx_ = ctx;
+  program->module_ = parser.ReleaseModule();
+  MapRuntime(*ctx->ee_, *program->module_);
+  ctx->ee_->addModule(program->module_);
+
+  for (auto f = program->module_->begin(); f != program->module_->end(); ++f) {
+    if (!f->isDeclaration() && !f->hasLocalLinkage())
+      program->functions_[f->getName()] = ctx->ee_->getPointerToFunction(f);
+  }
+
+  ctx->programs_.insert(program.get());
+  return program.release();
+}
+
+extern "C" const char *neat_messages(const neat_context *ctx) {
+  return ctx->messages_.c_str();
+}
+
+extern "C" void *neat_function(const neat_program *program, const char *name) {
+  auto iter = program->functions_.find(name);
+  return iter != program->functions_.end() ? iter->second : NULL;
+}
+
+extern "C" void neat_release(neat_program *program) {
+  if (!program)
+    return;
+  neat_context *ctx = program->ctx_;
+  Module *m = program->module_;
+  for (auto f = m->begin(); f != m->end(); ++f) {
+    if (!f->isDeclaration())
+      ctx->ee_->freeMachineCodeForFunction(f);
+  }
+  ctx->ee_->removeModule(m);
+  delete m;
+  ctx->programs_.erase(program);
+  delete program;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+// The embedding interface of libneat: compile neat source to native code
+// in a running process and call it through function pointers.
+//
+//   neat_context *ctx = neat_context_create(2);
+//   neat_program *rules = neat_compile(ctx, "rules", src, strlen(src));
+//   if (!rules)
+//     fprintf(stderr, "%s", neat_messages(ctx));
+//   int32_t (*score)(int32_t) = (int32_t (*)(int32_t)) neat_function(rules, "score");
+//   ...
+//   neat_release(rules);
+//   neat_context_destroy(ctx);
+//
+// A context keeps LLVM and the JIT warm between compilations, so compiling
+// many small programs pays for the setup once. A context must only be used
+// by one thread at a time; use one context per thread to compile in
+// parallel. The functions of a compiled program may be called from any
+// thread until the program is released.
+//
+// Functions have the C calling convention and signature of their neat
+// declaration: int is int32_t, float and double are themselves, and arrays
+// and structs are passed as pointers to their first element.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct neat_context neat_context;
+typedef struct neat_program neat_program;
+
+/** Create a context compiling at an optimization level from 0 to 3. */
+neat_context *neat_context_create(unsigned opt_level);
+
+/** Destroy a context, releasing the programs still compiled in it. */
+void neat_context_destroy(neat_context *ctx);
+
+/** Describe the code compiled in the context from now on to perf, as
+    neatc -fperf-map does: symbols in /tmp/perf-<pid>.map, and symbols
+    and source lines in /tmp/jit-<pid>.dump for `perf inject --jit`.
+    Programs get line tables too, which leaves their code unchanged.
+*/
+void neat_context_set_perf_map(neat_context *ctx, int enable);
+
+/** Compile a program; name is used in diagnostics and to resolve its
+    imports, and as the source file in line tables. Returns NULL if the
+    source has errors.
+*/
+neat_program *neat_compile(neat_context *ctx, const char *name,
+                           const char *source, size_t length);
+
+/** The diagnostics of the last compilation in the context, one per line.
+    Valid until the next compilation.
+*/
+const char *neat_messages(const neat_context *ctx);
+
+/** The native code of a function of the program, or NULL if there is no
+    such function.
+*/
+void *neat_function(const neat_program *program, const char *name);
+
+/** Free the native code of a program. Its function pointers must not be
+    called afterwards.
+*/
+void neat_release(neat_program *program);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+namespace neat {
+  /** Owns a neat_context. */
+  class Context {
+  public:
+    explicit Context(unsigned opt_level = 2) : ctx_(neat_context_create(opt_level)) {}
+    ~Context() { neat_context_destroy(ctx_); }
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    neat_context *get() const { return ctx_; }
+    const char *messages() const { return neat_messages(ctx_); }
+    void set_perf_map(bool enable) { neat_context_set_perf_map(ctx_, enable); }
+
+  private:
+    neat_context *ctx_;
+  };
+
+  /** Owns a compiled program; false when the source had errors. */
+  class Program {
+  public:
+    Program(Context& ctx, const std::string& name, const std::string& source)
+      : program_(neat_compile(ctx.get(), name.c_str(), source.data(), source.size())) {}
+    ~Program() { neat_release(program_); }
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    explicit operator bool() const { return program_ != NULL; }
+
+    /** The function called name, as a pointer of type F, or NULL. */
+    template <typename F>
+    F function(const char *name) const {
+      return program_ ? reinterpret_cast<F>(neat_function(program_, name)) : NULL;
+    }
+
+  private:
+    neat_program *program_;
+  };
+}
+#endif
@@ -1,25 +1,231 @@
 
+#include "link.h"
+#include "options.h"
 #include "parse.h"
+#include "target.h"
+#include "tier.h"
+#include "util.h"
 #include <llvm/Support/raw_ostream.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
 using namespace std;
 
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [options] <file>\n", argv0);
+  fprintf(stderr, "       %s -link [options] <file.bc>... -o <executable>\n", argv0);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -o <file>          output: .bc bitcode, .o object, otherwise IR\n");
+  fprintf(stderr, "  -link              link bitcode files into an executable with\n");
+  fprintf(stderr, "                     cross-module importing\n");
+  fprintf(stderr, "  -run <file> [int args...]\n");
+  fprintf(stderr, "                     run main, interpreting functions until they\n");
+  fprintf(stderr, "                     are hot enough to compile\n");
+  fprintf(stderr, "  -fjit-threshold=<n>\n");
+  fprintf(stderr, "                     calls and loop iterations before a function is\n");
+  fprintf(stderr, "                     compiled (default: 1000, 0: compile at once)\n");
+  fprintf(stderr, "  -fno-jit           interpret everything\n");
+  fprintf(stderr, "  -fperf-map         describe JIT-compiled code to perf in\n");
+  fprintf(stderr, "                     /tmp/perf-<pid>.map and /tmp/jit-<pid>.dump\n");
+  fprintf(stderr, "  -fjit-stats        report each function compiled by the JIT\n");
+  fprintf(stderr, "  -fno-const-eval    do not evaluate calls to pure functions with\n");
+  fprintf(stderr, "                     constant arguments at compile time\n");
+  fprintf(stderr, "  -stats             report statistics about the compilation\n");
+  fprintf(stderr, "  -type-layout       report the size and layout of each struct\n");
+  fprintf(stderr, "  -fsyntax-only      only parse, reporting syntax errors\n");
+  fprintf(stderr, "  -fno-ast-cache     always parse, instead of loading the AST cached\n");
+  fprintf(stderr, "                     next to the output\n");
+  fprintf(stderr, "  -fno-bounds-check  do not check array indices at runtime\n");
+  fprintf(stderr, "  -fno-if-to-switch  do not generate chains of ifs comparing a\n");
+  fprintf(stderr, "                     variable with literals as switches\n");
+  fprintf(stderr, "  -g, -gline-tables-only\n");
+  fprintf(stderr, "                     emit DWARF line tables, but no variables\n");
+  fprintf(stderr, "  -O<level>          optimization level (0-3)\n");
+  fprintf(stderr, "  -j<threads>        threads for the front end (default: all cores)\n");
+  fprintf(stderr, "  -march=<cpu>       target cpu, or native for the host\n");
+  fprintf(stderr, "  -mcpu=<cpu>        same as -march\n");
+  fprintf(stderr, "  -mtriple=<triple>  target triple\n");
+  fprintf(stderr, "  -fprofile-generate[=<file>]\n");
+  fprintf(stderr, "                     instrument for profiling; link with libneatrt\n");
+  fprintf(stderr, "  -fprofile-use[=<file>]\n");
+  fprintf(stderr, "                     optimize using a recorded profile\n");
+  fprintf(stderr, "  -finstrument-functions[=<glob>,...]\n");
+  fprintf(stderr, "                     trace entry and exit of (matching) functions;\n");
+  fprintf(stderr, "                     link with libneatrt\n");
+  fprintf(stderr, "  -finstrument-functions-exclude=<glob>,...\n");
+  fprintf(stderr, "                     do not trace matching functions\n");
+  fprintf(stderr, "  -fwhole-program    make everything but main and exports internal\n");
+  fprintf(stderr, "                     and remove unused functions\n");
+  fprintf(stderr, "  -fexport=<name>,...\n");
+  fprintf(stderr, "                     keep functions external in whole-program mode\n");
+  fprintf(stderr, "  -Wtail-call        warn about tail calls that were not converted\n");
+}
+
+static void print_messages(const Messages& errs) {
+  for (auto& msg : errs.messages()) {
+    fprintf(stderr, "%s\n", msg.msg().c_str());
+  }
+}
+
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <file>\n", argv[0]);
-    return 1;
+  Options options;
+  vector<string> inputs;
+  const char *output = NULL;
+  bool link = false;
+  bool run = false;
+  bool ast_cache = true;
+  vector<int32_t> run_args;
+
+  // the runtime library is built next to neatc
+  string runtime = DirName(argv[0]) + "/libneatrt.a";
+  if (access(runtime.c_str(), R_OK) == 0)
+    options.runtime_ = runtime;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "-o") == 0 && i+1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(arg, "-link") == 0) {
+      link = true;
+    } else if (strcmp(arg, "-run") == 0) {
+      run = true;
+    } else if (strncmp(arg, "-O", 2) == 0) {
+      options.opt_level_ = arg[2] ? atoi(arg+2) : 2;
+      if (options.opt_level_ > 3)
+        options.opt_level_ = 3;
+    } else if (strncmp(arg, "-j", 2) == 0 && arg[2]) {
+      options.jobs_ = atoi(arg+2);
+    } else if (strncmp(arg, "-march=", 7) == 0) {
+      options.cpu_ = arg+7;
+    } else if (strncmp(arg, "-mcpu=", 6) == 0) {
+      options.cpu_ = arg+6;
+    } else if (strncmp(arg, "-mtriple=", 9) == 0) {
+      options.triple_ = arg+9;
+    } else if (strcmp(arg, "-fprofile-generate") == 0) {
+      options.profile_generate_ = "default.neatprof";
+    } else if (strncmp(arg, "-fprofile-generate=", 19) == 0) {
+      options.profile_generate_ = arg+19;
+    } else if (strcmp(arg, "-fprofile-use") == 0) {
+      options.profile_use_ = "default.neatprof";
+    } else if (strncmp(arg, "-fprofile-use=", 14) == 0) {
+      options.profile_use_ = arg+14;
+    } else if (strcmp(arg, "-finstrument-functions") == 0) {
+      options.instrument_functions_ = true;
+    } else if (strncmp(arg, "-finstrument-functions=", 23) == 0) {
+      options.instrument_functions_ = true;
+      for (auto& pattern : Split(arg+23, ',')) {
+        options.instrument_include_.push_back(pattern);
+      }
+    } else if (strncmp(arg, "-finstrument-functions-exclude=", 31) == 0) {
+      for (auto& pattern : Split(arg+31, ',')) {
+        options.instrument_exclude_.push_back(pattern);
+      }
+    } else if (strcmp(arg, "-fwhole-program") == 0) {
+      options.whole_program_ = true;
+    } else if (strncmp(arg, "-fexport=", 9) == 0) {
+      for (auto& name : Split(arg+9, ',')) {
+        options.exports_.push_back(name);
+      }
+    } else if (strcmp(arg, "-Wtail-call") == 0) {
+      options.warn_tail_calls_ = true;
+    } else if (strncmp(arg, "-fjit-threshold=", 16) == 0) {
+      options.jit_threshold_ = atoi(arg+16);
+    } else if (strcmp(arg, "-fno-jit") == 0) {
+      options.jit_ = false;
+    } else if (strcmp(arg, "-fjit-stats") == 0) {
+      options.jit_stats_ = true;
+    } else if (strcmp(arg, "-fno-const-eval") == 0) {
+      options.const_eval_ = false;
+    } else if (strcmp(arg, "-stats") == 0) {
+      options.stats_ = true;
+    } else if (strcmp(arg, "-type-layout") == 0) {
+      options.type_layout_ = true;
+    } else if (strcmp(arg, "-fno-bounds-check") == 0) {
+      options.bounds_check_ = false;
+    } else if (strcmp(arg, "-fno-if-to-switch") == 0) {
+      options.if_to_switch_ = false;
+    } else if (strcmp(arg, "-fsyntax-only") == 0) {
+      options.syntax_only_ = true;
+    } else if (strcmp(arg, "-g") == 0 || strcmp(arg, "-gline-tables-only") == 0) {
+      options.debug_info_ = true;
+    } else if (strcmp(arg, "-fperf-map") == 0) {
+      options.perf_map_ = true;
+      options.debug_info_ = true;
+    } else if (strcmp(arg, "-fno-ast-cache") == 0) {
+      ast_cache = false;
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      inputs.push_back(arg);
+      // everything after the program to run is passed to its main
+      if (run) {
+        for (++i; i < argc; ++i) {
+          run_args.push_back(atoi(argv[i]));
+        }
+      }
+    }
   }
 
-  Parser parser(argv[1]);
-  auto errs = parser.ParseFile(argv[1]);
-  for (auto& msg : errs->messages()) {
-    fprintf(stderr, "%s\n", msg.msg().c_str());
+  if (run) {
+    if (inputs.size() != 1) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    Messages errs;
+    TieredEngine engine(inputs[0], options, errs);
+    int32_t result = 0;
+    bool ok = engine.Load(ReadFile(inputs[0])) && engine.Run("main", run_args, result);
+    print_messages(errs);
+    return ok ? result : 1;
   }
 
-  if (!errs) {
+  if (link) {
+    if (inputs.empty() || !output) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    Messages errs;
+    bool ok = LinkProgram(inputs, output, options, errs);
+    print_messages(errs);
+    return ok ? 0 : 1;
+  }
+
+  if (inputs.size() != 1) {
+    usage(argv[0]);
     return 1;
   }
 
+  const string& path = inputs[0];
+  if (output && ast_cache)
+    options.ast_cache_ = DirName(output) + "/" + BaseName(path) + ".neatast";
+
+  Parser parser(path, options);
+  auto errs = parser.ParseFile(path);
+  print_messages(*errs);
+
+  if (!*errs) {
+    return 1;
+  }
+  if (options.syntax_only_)
+    return 0;
+
+  parser.Optimize();
+
+  if (output) {
+    string err;
+    if (!WriteModule(parser.module(), parser.target(), output, err)) {
+      fprintf(stderr, "error: %s\n", err.c_str());
+      return 1;
+    }
+    return 0;
+  }
+
   llvm::raw_fd_ostream fd(fileno(stdout), false);
   parser.module().print(fd, NULL);
   return 0;
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/** Settings that control how a program is compiled.
+    These are filled in from the command line by neatc and read by the
+    parser, the code generator and the optimizer.
+*/
+struct Options {
+  Options()
+    : opt_level_(0), instrument_functions_(false), whole_program_(false),
+      warn_tail_calls_(false), jobs_(0), jit_(true), jit_threshold_(1000),
+      jit_stats_(false), const_eval_(true), stats_(false),
+      bounds_check_(true), type_layout_(false), syntax_only_(false),
+      debug_info_(false), perf_map_(false), if_to_switch_(true) {}
+
+  /** Optimization level, 0 through 3. */
+  unsigned opt_level_;
+
+  /** Target triple. Empty selects the host triple. */
+  std::string triple_;
+
+  /** CPU to tune and select features for, from -march or -mcpu.
+      "native" selects the host CPU and all of its features.
+  */
+  std::string cpu_;
+
+  /** Profile file to write from an instrumented build (-fprofile-generate). */
+  std::string profile_generate_;
+
+  /** Profile file to optimize with (-fprofile-use). */
+  std::string profile_use_;
+
+  /** Call the tracing runtime on function entry and exit
+      (-finstrument-functions). When include patterns are given, only
+      functions matching one of them are instrumented; functions matching
+      an exclude pattern never are.
+  */
+  bool instrument_functions_;
+  std::vector<std::string> instrument_include_;
+  std::vector<std::string> instrument_exclude_;
+
+  /** Treat the module as the whole program (-fwhole-program). Only main
+      and the functions named by -fexport keep external linkage and the C
+      calling convention; everything else is internal, uses fastcc, and is
+      removed when nothing external can reach it.
+  */
+  bool whole_program_;
+  std::vector<std::string> exports_;
+
+  /** Warn about calls in tail position that could not be turned into a
+      loop or a guaranteed tail call (-Wtail-call).
+  */
+  bool warn_tail_calls_;
+
+  /** Number of threads the front end may use (-j). Zero uses one per
+      hardware thread.
+  */
+  unsigned jobs_;
+
+  /** Path of the runtime library (libneatrt.a) linked into executables. */
+  std::string runtime_;
+
+  /** Tiered execution (-run). Functions are interpreted until the calls
+      and loop back edges executed in them reach jit_threshold_, and are
+      then compiled with the JIT (-fjit-threshold; 0 compiles everything
+      on its first call). Without jit_ (-fno-jit) everything stays in the
+      interpreter. jit_stats_ reports each compilation (-fjit-stats).
+  */
+  bool jit_;
+  unsigned jit_threshold_;
+  bool jit_stats_;
+
+  /** Evaluate calls to pure functions with constant arguments while
+      generating code (-fno-const-eval disables it).
+  */
+  bool const_eval_;
+
+  /** Report statistics about the compilation (-stats). */
+  bool stats_;
+
+  /** Binary AST cache to load instead of parsing an unchanged source, or
+      to write after parsing. Empty disables the cache.
+  */
+  std::string ast_cache_;
+
+  /** Check array indices that are not known to be in bounds, trapping
+      when one is out of bounds (-fno-bounds-check disables it).
+  */
+  bool bounds_check_;
+
+  /** Report the size, alignment and field offsets of each struct
+      (-type-layout).
+  */
+  bool type_layout_;
+
+  /** Stop after parsing, reporting only syntax errors (-fsyntax-only). */
+  bool syntax_only_;
+
+  /** Emit DWARF line tables (-g, -gline-tables-only): every function gets
+      a subprogram and its code the line of the statement it came from,
+      with no variables or types. The generated code does not change, so
+      it can stay on in release builds for perf and other profilers.
+  */
+  bool debug_info_;
+
+  /** Tell perf about functions compiled by the JIT (-fperf-map), in
+      /tmp/perf-<pid>.map for symbols and in a jitdump file,
+      /tmp/jit-<pid>.dump, that `perf inject --jit` turns into symbols
+      and source lines. Implies debug_info_.
+  */
+  bool perf_map_;
+
+  /** Generate an if whose else holds only another if, when the chain
+      compares one int variable with literals at least three times, as
+      a switch on the variable (-fno-if-to-switch disables it).
+  */
+  bool if_to_switch_;
+
+  bool IsExported(const std::string& name) const {
+    if (!whole_program_ || name == "main")
+      return true;
+    for (auto& exported : exports_) {
+      if (exported == name)
+        return true;
+    }
+    return false;
+  }
+};
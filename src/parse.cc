@@ -1,11 +1,32 @@
 
 #include "ast.h"
+#include "astcache.h"
+#include "builtins.h"
+#include "codegen.h"
+#include "consteval.h"
+#include "debuginfo.h"
 #include "lexer.h"
+#include "module.h"
 #include "parse.h"
+#include "profile.h"
 #include "scope.h"
+#include "structs.h"
+#include "target.h"
 #include "util.h"
+#include <llvm/DerivedTypes.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Target/TargetMachine.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 
@@ -21,6 +42,10 @@ void Messages::Info(const string& msg) {
   msgs_.push_back(Message(msg, Message::INFO));
 }
 
+void Messages::Append(const Messages& other) {
+  msgs_.insert(msgs_.end(), other.msgs_.begin(), other.msgs_.end());
+}
+
 size_t Messages::Count(Message::Level level) const {
   size_t count = 0;
   for (auto& msg : msgs_) {
@@ -76,29 +101,83 @@ namespace {
           case '=': return 10;
           default:  return -1;
         }
+      case '!':
+        switch (ch2) {
+          case '=': return 10;
+          default:  return -1;
+        }
+      case '<':
+      case '>':
+        switch (ch2) {
+          case 0:
+          case '=': return 12;
+          default:  return -1;
+        }
+      case '|': return ch2 == '|' ? 6 : -1;
+      case '&': return ch2 == '&' ? 8 : -1;
       default: return -1;
     }
   }
 
+  /** An operator or group the expression parser has read the start of
+      and is waiting for the operand of.
+  */
+  struct Pending {
+    enum Kind {
+      PREFIX,  // oper_ applied to the next operand
+      BINARY,  // expr_ oper_ the next operand
+      PAREN,   // ( the next operand )
+      CALL,    // call_ with the next operand as an argument
+      INDEX    // expr_[the next operand]
+    };
+
+    Pending(Kind kind, llvm::StringRef oper = llvm::StringRef(), int prec = -1)
+      : kind_(kind), oper_(oper), prec_(prec) {}
+
+    Kind kind_;
+    llvm::StringRef oper_;
+    int prec_;
+    unique_ptr<ast::Expression> expr_;
+    unique_ptr<ast::CallOperation> call_;
+  };
+
   struct FileParser {
     FileParser(llvm::LLVMContext& ctx, Messages& errs,
                const string& filename, const string& contents)
-      : ctx_(ctx), filename_(filename), lexer_(contents), errs_(errs) {}
-
-    unique_ptr<ast::TopLevel> Parse();
+      : ctx_(ctx), filename_(filename), lexer_(contents, &errs), errs_(errs),
+        ctx_lock_(NULL) {}
+
+    /** Parse one piece of a larger buffer on a worker thread. The
+        LLVMContext is shared between the workers, so every access to it
+        goes through ctx_lock.
+    */
+    FileParser(llvm::LLVMContext& ctx, Messages& errs, const string& filename,
+               llvm::StringRef chunk, const char *start, mutex *ctx_lock)
+      : ctx_(ctx), filename_(filename), lexer_(chunk, start, &errs), errs_(errs),
+        ctx_lock_(ctx_lock) {}
+
+    unique_ptr<ast::Program> Parse();
     unique_ptr<ast::TopLevel> TopLevel();
+    unique_ptr<ast::TopLevel> Import();
+    unique_ptr<ast::TopLevel> Struct();
+    unique_ptr<ast::TopLevel> Const();
     unique_ptr<ast::TopLevel> Function();
     unique_ptr<ast::Statement> Statement();
     unique_ptr<ast::Statement> Var();
     unique_ptr<ast::Statement> If();
+    unique_ptr<ast::Statement> Switch();
+    bool IntLiteral(int& value);
     unique_ptr<ast::Statement> While();
+    bool LoopHints(ast::While& while_);
+    unique_ptr<ast::Statement> Parfor();
+    bool Reductions(ast::Parfor& parfor);
+    unique_ptr<ast::Statement> Region();
+    llvm::Type *Type();
+    llvm::Type *TypeSuffix(llvm::StringRef base);
     unique_ptr<ast::Statement> Return();
     unique_ptr<ast::Statement> Break();
     unique_ptr<ast::Statement> Continue();
-    unique_ptr<ast::Expression> Primary();
-    unique_ptr<ast::Expression> PrimaryRHS(unique_ptr<ast::Expression> LHS);
     unique_ptr<ast::Expression> Expression();
-    unique_ptr<ast::Expression> BinOpRHS(int prec, unique_ptr<ast::Expression> LHS);
 
     bool ExpectToken(Lexer::Token::Type type, llvm::StringRef val);
     bool ExpectToken(Lexer::Token::Type type);
@@ -106,25 +185,28 @@ namespace {
     void Error(const string& msg);
 
     llvm::Type *TranslateType(llvm::StringRef type) {
-      using llvm::Type;
-      if (type == "void")
-        return Type::getVoidTy(ctx_);
-      else if (type == "int")
-        return Type::getInt32Ty(ctx_);
-      else if (type == "float")
-        return Type::getFloatTy(ctx_);
-      else if (type == "double")
-        return Type::getDoubleTy(ctx_);
-      else return NULL;
+      unique_lock<mutex> guard;
+      if (ctx_lock_)
+        guard = unique_lock<mutex>(*ctx_lock_);
+      return LookupType(ctx_, type);
+    }
+
+    const StructInfo *DeclareStruct(llvm::StringRef name, const vector<string>& names,
+                                    const vector<llvm::Type*>& types, bool soa, bool ordered) {
+      unique_lock<mutex> guard;
+      if (ctx_lock_)
+        guard = unique_lock<mutex>(*ctx_lock_);
+      return ::DeclareStruct(ctx_, name, names, types, soa, ordered);
     }
 
     llvm::LLVMContext& ctx_;
     string filename_;
     Lexer lexer_;
     Messages& errs_;
+    mutex *ctx_lock_;
   };
 
-  unique_ptr<ast::TopLevel> FileParser::Parse() {
+  unique_ptr<ast::Program> FileParser::Parse() {
     lexer_.ReadToken();
     auto program = unique_ptr<ast::Program>(new ast::Program());
     unique_ptr<ast::TopLevel> stmt = NULL;
@@ -135,17 +217,185 @@ namespace {
   }
 
   unique_ptr<ast::TopLevel> FileParser::TopLevel() {
-    unique_ptr<ast::TopLevel> stmt = Function();
+    unique_ptr<ast::TopLevel> stmt = Import();
+    if (stmt) return stmt;
+    stmt = Struct();
+    if (stmt) return stmt;
+    stmt = Const();
+    if (stmt) return stmt;
+    stmt = Function();
     if (stmt) return stmt;
     return NULL;
   }
 
+  unique_ptr<ast::TopLevel> FileParser::Import() {
+    if (!lexer_.ExpectToken(Lexer::Token::IMPORT))
+      return NULL;
+
+    Lexer::Token t = lexer_.PeekToken();
+    if (t.type_ != Lexer::Token::STRING) {
+      Error("expected module path");
+      return NULL;
+    }
+    lexer_.ReadToken();
+
+    if (!ExpectToken(Lexer::Token::SEMICOLON))
+      return NULL;
+    llvm::StringRef path = t.val_.substr(1, t.val_.size()-2);
+    return unique_ptr<ast::TopLevel>(new ast::Import(path));
+  }
+
+  /** Parse a struct declaration, which may be preceded by the layout
+      attributes @soa and @ordered:
+
+        @soa struct Particle { x: float; y: float; alive: int; }
+  */
+  unique_ptr<ast::TopLevel> FileParser::Struct() {
+    bool soa = false, ordered = false;
+    for (;;) {
+      Lexer::Token t = lexer_.PeekToken();
+      if (t.type_ != Lexer::Token::ATTR)
+        break;
+      lexer_.ReadToken();
+
+      llvm::StringRef name = t.val_.drop_front(1);
+      if (name == "soa")
+        soa = true;
+      else if (name == "ordered")
+        ordered = true;
+      else {
+        Error("unknown struct attribute '" + name.str() + "'");
+        return NULL;
+      }
+    }
+
+    if (!lexer_.ExpectToken(Lexer::Token::STRUCT)) {
+      if (soa || ordered)
+        Error("expected struct");
+      return NULL;
+    }
+
+    Lexer::Token name = lexer_.PeekToken();
+    if (name.type_ != Lexer::Token::IDENT) {
+      Error("expected struct name");
+      return NULL;
+    }
+    lexer_.ReadToken();
+    if (TranslateType(name.val_)) {
+      Error("type '" + name.val_.str() + "' is already defined");
+      return NULL;
+    }
+
+    if (!ExpectToken(Lexer::Token::BRACKET, "{"))
+      return NULL;
+
+    vector<string> names;
+    vector<llvm::Type*> types;
+    while (!lexer_.ExpectToken(Lexer::Token::BRACKET, "}")) {
+      Lexer::Token field = lexer_.PeekToken();
+      if (field.type_ != Lexer::Token::IDENT) {
+        Error("expected field");
+        return NULL;
+      }
+      lexer_.ReadToken();
+      if (!ExpectToken(Lexer::Token::COLON))
+        return NULL;
+
+      llvm::Type *type = Type();
+      if (!type)
+        return NULL;
+      if (type->isVoidTy()) {
+        Error("fields cannot be void");
+        return NULL;
+      }
+      if (find(names.begin(), names.end(), field.val_.str()) != names.end()) {
+        Error("duplicate field '" + field.val_.str() + "'");
+        return NULL;
+      }
+      if (!ExpectToken(Lexer::Token::SEMICOLON))
+        return NULL;
+
+      names.push_back(field.val_);
+      types.push_back(type);
+    }
+
+    if (names.empty()) {
+      Error("a struct needs at least one field");
+      return NULL;
+    }
+
+    const StructInfo *info = DeclareStruct(name.val_, names, types, soa, ordered);
+    if (!info) {
+      Error("type '" + name.val_.str() + "' is already defined");
+      return NULL;
+    }
+    return unique_ptr<ast::TopLevel>(new ast::StructDecl(info));
+  }
+
+  /** Parse a constant: const n = 5;, const t = [1, 2, 3]; or
+      const t: int[256] = [1, 2, 3];.
+  */
+  unique_ptr<ast::TopLevel> FileParser::Const() {
+    if (!lexer_.ExpectToken(Lexer::Token::CONST))
+      return NULL;
+
+    Lexer::Token name = lexer_.PeekToken();
+    if (name.type_ != Lexer::Token::IDENT) {
+      Error("expected constant name");
+      return NULL;
+    }
+    lexer_.ReadToken();
+
+    llvm::Type *type = NULL;
+    if (lexer_.ExpectToken(Lexer::Token::COLON)) {
+      type = Type();
+      if (!type)
+        return NULL;
+      llvm::ArrayType *array = llvm::dyn_cast<llvm::ArrayType>(type);
+      if (!type->isIntegerTy(32) && !(array && array->getElementType()->isIntegerTy(32))) {
+        Error("constants are ints or arrays of ints");
+        return NULL;
+      }
+    }
+    if (!ExpectToken(Lexer::Token::OPER, "="))
+      return NULL;
+
+    vector<int> values;
+    bool list = lexer_.ExpectToken(Lexer::Token::BRACKET, "[");
+    if (type && list != type->isArrayTy()) {
+      Error(list ? "expected an int" : "expected a list of values");
+      return NULL;
+    }
+    do {
+      int value;
+      if (!IntLiteral(value))
+        return NULL;
+      values.push_back(value);
+    } while (list && lexer_.ExpectToken(Lexer::Token::OPER, ","));
+    if (list && !ExpectToken(Lexer::Token::BRACKET, "]"))
+      return NULL;
+    if (!ExpectToken(Lexer::Token::SEMICOLON))
+      return NULL;
+
+    if (!type)
+      type = TranslateType(list ? "int[" + std::to_string(values.size()) + "]" : "int");
+    else if (list && values.size() > llvm::cast<llvm::ArrayType>(type)->getNumElements()) {
+      Error("too many values for " + TypeName(type));
+      return NULL;
+    }
+
+    auto decl = unique_ptr<ast::ConstDecl>(new ast::ConstDecl(name.val_, type));
+    decl->values_ = move(values);
+    return move(decl);
+  }
+
   unique_ptr<ast::TopLevel> FileParser::Function() {
     if (!lexer_.ExpectToken(Lexer::Token::FN))
       return NULL;
 
     Lexer::Token t = lexer_.PeekToken();
     auto f = unique_ptr<ast::Function>(new ast::Function(t.val_));
+    f->line_ = lexer_.Line();
     lexer_.ReadToken();
 
     if (lexer_.ExpectToken(Lexer::Token::PAREN, "(")) {
@@ -162,15 +412,13 @@ namespace {
         lexer_.ReadToken();
 
         llvm::StringRef name;
+        llvm::Type *type;
         if (lexer_.ExpectToken(Lexer::Token::COLON)) {
           name = t.val_;
-          t = lexer_.PeekToken();
-          if (t.type_ != Lexer::Token::IDENT)
-            return NULL;
-          lexer_.ReadToken();
+          type = Type();
+        } else {
+          type = TypeSuffix(t.val_);
         }
-
-        llvm::Type *type = TranslateType(t.val_);
         if (!type)
           return NULL;
 
@@ -184,11 +432,13 @@ namespace {
     }
 
     if (lexer_.ExpectToken(Lexer::Token::ARROW)) {
-      t = lexer_.PeekToken();
-      f->rettype_ = TranslateType(t.val_);
+      f->rettype_ = Type();
       if (!f->rettype_)
         return NULL;
-      lexer_.ReadToken();
+      if (f->rettype_->isAggregateType()) {
+        Error("functions cannot return arrays or structs");
+        return NULL;
+      }
     }
 
     if (!lexer_.ExpectToken(Lexer::Token::BRACKET, "{"))
@@ -205,12 +455,21 @@ namespace {
   }
 
   unique_ptr<ast::Statement> FileParser::Statement() {
+    size_t line = lexer_.Line();
     unique_ptr<ast::Statement> stmt = NULL;
+    bool block = true;
     for (;;) {
       stmt = If();
-      if (stmt) return stmt;
+      if (stmt) break;
+      stmt = Switch();
+      if (stmt) break;
       stmt = While();
-      if (stmt) return stmt;
+      if (stmt) break;
+      stmt = Parfor();
+      if (stmt) break;
+      stmt = Region();
+      if (stmt) break;
+      block = false;
       stmt = Var();
       if (stmt) break;
       stmt = Return();
@@ -229,8 +488,10 @@ namespace {
       return NULL;
     }
 
-    if (!ExpectToken(Lexer::Token::SEMICOLON))
+    // blocks end at their closing brace, other statements at a semicolon
+    if (!block && !ExpectToken(Lexer::Token::SEMICOLON))
       return NULL;
+    stmt->line_ = line;
     return stmt;
   }
 
@@ -243,14 +504,26 @@ namespace {
       return NULL;
     lexer_.ReadToken();
 
-    if (!ExpectToken(Lexer::Token::OPER, "="))
-      return NULL;
+    // var name = expr; or var name: type; or var name: type = expr;
+    llvm::Type *type = NULL;
+    if (lexer_.ExpectToken(Lexer::Token::COLON)) {
+      type = Type();
+      if (!type)
+        return NULL;
+    }
 
-    auto expr = Expression();
-    if (!expr)
-      return NULL;
+    unique_ptr<ast::Expression> expr;
+    if (!type || lexer_.PeekToken().val_ == "=") {
+      if (!ExpectToken(Lexer::Token::OPER, "="))
+        return NULL;
+      expr = Expression();
+      if (!expr)
+        return NULL;
+    }
 
-    return unique_ptr<ast::Statement>(new ast::VariableAssignment(ident.val_, move(expr)));
+    auto var = unique_ptr<ast::VariableAssignment>(new ast::VariableAssignment(ident.val_, move(expr)));
+    var->type_ = type;
+    return move(var);
   }
 
   unique_ptr<ast::Statement> FileParser::If() {
@@ -283,11 +556,83 @@ namespace {
     return move(if_);
   }
 
+  /** Parse a switch: switch expr { case 1, 2: ... default: ... }. */
+  unique_ptr<ast::Statement> FileParser::Switch() {
+    if (!lexer_.ExpectToken(Lexer::Token::SWITCH))
+      return NULL;
+
+    auto switch_ = unique_ptr<ast::Switch>(new ast::Switch(Expression()));
+    if (!ExpectToken(Lexer::Token::BRACKET, "{"))
+      return NULL;
+
+    std::set<int> seen;
+    bool has_default = false;
+    for (;;) {
+      vector<unique_ptr<ast::Statement>> *stmts;
+      if (lexer_.ExpectToken(Lexer::Token::CASE)) {
+        switch_->cases_.push_back(ast::Switch::Case());
+        ast::Switch::Case& c = switch_->cases_.back();
+        do {
+          int value;
+          if (!IntLiteral(value))
+            return NULL;
+          if (!seen.insert(value).second) {
+            Error("duplicate case " + std::to_string(value));
+            return NULL;
+          }
+          c.values_.push_back(value);
+        } while (lexer_.ExpectToken(Lexer::Token::OPER, ","));
+        stmts = &c.stmts_;
+      } else if (lexer_.ExpectToken(Lexer::Token::DEFAULT)) {
+        if (has_default) {
+          Error("duplicate default");
+          return NULL;
+        }
+        has_default = true;
+        stmts = &switch_->default_stmts_;
+      } else {
+        break;
+      }
+      if (!ExpectToken(Lexer::Token::COLON))
+        return NULL;
+
+      unique_ptr<ast::Statement> stmt = NULL;
+      while ((stmt = Statement()) != NULL) {
+        stmts->push_back(move(stmt));
+      }
+    }
+
+    if (!ExpectToken(Lexer::Token::BRACKET, "}"))
+      return NULL;
+    return move(switch_);
+  }
+
+  /** Parse an integer literal, which may be negative, as case values
+      and the values of constants are.
+  */
+  bool FileParser::IntLiteral(int& value) {
+    bool negative = lexer_.ExpectToken(Lexer::Token::OPER, "-");
+    Lexer::Token n = lexer_.PeekToken();
+    if (n.type_ != Lexer::Token::INT) {
+      Error("expected an integer");
+      return false;
+    }
+    lexer_.ReadToken();
+    value = atoi(n.val_.str().c_str());
+    if (negative)
+      value = -value;
+    return true;
+  }
+
   unique_ptr<ast::Statement> FileParser::While() {
     if (!lexer_.ExpectToken(Lexer::Token::WHILE))
       return NULL;
 
-    auto while_ = unique_ptr<ast::While>(new ast::While(Expression()));
+    auto while_ = unique_ptr<ast::While>(new ast::While(NULL));
+    if (!LoopHints(*while_))
+      return NULL;
+
+    while_->expr_ = Expression();
     if (!ExpectToken(Lexer::Token::BRACKET, "{"))
       return NULL;
 
@@ -302,6 +647,211 @@ namespace {
     return move(while_);
   }
 
+  /** Parse the attributes between `while` and the loop condition.
+      Recognized attributes are @unroll(n) and @vectorize, which may be
+      given a width as @vectorize(n). They are accepted, but LLVM 3.1
+      does not act on them; see ast::While.
+  */
+  bool FileParser::LoopHints(ast::While& while_) {
+    for (;;) {
+      Lexer::Token t = lexer_.PeekToken();
+      if (t.type_ != Lexer::Token::ATTR)
+        return true;
+      lexer_.ReadToken();
+
+      unsigned value = 1;
+      if (lexer_.ExpectToken(Lexer::Token::PAREN, "(")) {
+        Lexer::Token n = lexer_.PeekToken();
+        if (n.type_ != Lexer::Token::INT) {
+          Error("expected integer");
+          return false;
+        }
+        lexer_.ReadToken();
+        value = atoi(n.val_.str().c_str());
+
+        if (!ExpectToken(Lexer::Token::PAREN, ")"))
+          return false;
+      }
+
+      llvm::StringRef name = t.val_.drop_front(1);
+      if (name == "unroll")
+        while_.unroll_ = value;
+      else if (name == "vectorize")
+        while_.vectorize_ = value;
+      else {
+        Error("unknown loop attribute '" + name.str() + "'");
+        return false;
+      }
+    }
+  }
+
+  /** Parse a parallel loop: parfor i in lo..hi, followed by optional
+      reductions and the body.
+  */
+  unique_ptr<ast::Statement> FileParser::Parfor() {
+    if (!lexer_.ExpectToken(Lexer::Token::PARFOR))
+      return NULL;
+
+    Lexer::Token ident = lexer_.PeekToken();
+    if (ident.type_ != Lexer::Token::IDENT) {
+      Error("expected loop variable");
+      return NULL;
+    }
+    lexer_.ReadToken();
+
+    if (!ExpectToken(Lexer::Token::IDENT, "in"))
+      return NULL;
+    auto lo = Expression();
+    if (!lo || !ExpectToken(Lexer::Token::RANGE))
+      return NULL;
+    auto hi = Expression();
+    if (!hi)
+      return NULL;
+
+    auto parfor = unique_ptr<ast::Parfor>(new ast::Parfor(ident.val_, move(lo), move(hi)));
+    if (!Reductions(*parfor))
+      return NULL;
+    if (!ExpectToken(Lexer::Token::BRACKET, "{"))
+      return NULL;
+
+    unique_ptr<ast::Statement> stmt = NULL;
+    while ((stmt = Statement()) != NULL) {
+      parfor->Append(move(stmt));
+    }
+
+    if (!ExpectToken(Lexer::Token::BRACKET, "}"))
+      return NULL;
+
+    return move(parfor);
+  }
+
+  /** Parse the reductions of a parfor, reduce(op: var, ...), where op
+      is +, *, min or max.
+  */
+  bool FileParser::Reductions(ast::Parfor& parfor) {
+    if (!lexer_.ExpectToken(Lexer::Token::IDENT, "reduce"))
+      return true;
+    if (!ExpectToken(Lexer::Token::PAREN, "("))
+      return false;
+
+    for (;;) {
+      Lexer::Token op = lexer_.PeekToken();
+      if (op.val_ != "+" && op.val_ != "*" && op.val_ != "min" && op.val_ != "max") {
+        Error("expected a reduction operator");
+        return false;
+      }
+      lexer_.ReadToken();
+      if (!ExpectToken(Lexer::Token::COLON))
+        return false;
+
+      Lexer::Token var = lexer_.PeekToken();
+      if (var.type_ != Lexer::Token::IDENT) {
+        Error("expected a reduction variable");
+        return false;
+      }
+      lexer_.ReadToken();
+
+      ast::Parfor::Reduction reduction = { op.val_, var.val_ };
+      parfor.reductions_.push_back(reduction);
+
+      if (lexer_.ExpectToken(Lexer::Token::PAREN, ")"))
+        return true;
+      if (!ExpectToken(Lexer::Token::OPER, ","))
+        return false;
+    }
+  }
+
+  /** Parse a region block: region r { ... }. */
+  unique_ptr<ast::Statement> FileParser::Region() {
+    if (!lexer_.ExpectToken(Lexer::Token::REGION))
+      return NULL;
+
+    Lexer::Token ident = lexer_.PeekToken();
+    if (ident.type_ != Lexer::Token::IDENT) {
+      Error("expected region name");
+      return NULL;
+    }
+    lexer_.ReadToken();
+    if (!ExpectToken(Lexer::Token::BRACKET, "{"))
+      return NULL;
+
+    auto region = unique_ptr<ast::Region>(new ast::Region(ident.val_));
+    unique_ptr<ast::Statement> stmt = NULL;
+    while ((stmt = Statement()) != NULL) {
+      region->Append(move(stmt));
+    }
+
+    if (!ExpectToken(Lexer::Token::BRACKET, "}"))
+      return NULL;
+
+    return move(region);
+  }
+
+  /** Parse a type: a type name or vector type followed by any number of
+      array dimensions, as in int[16], float[4][4] or vec<8, int>[64]. An
+      unsized array, int[], can only be an array of scalars or vectors.
+  */
+  llvm::Type *FileParser::Type() {
+    Lexer::Token t = lexer_.PeekToken();
+    if (t.type_ == Lexer::Token::REGION) {
+      lexer_.ReadToken();
+      return TranslateType("region");
+    }
+    if (t.type_ != Lexer::Token::IDENT) {
+      Error("expected type");
+      return NULL;
+    }
+    lexer_.ReadToken();
+    if (t.val_ != "vec")
+      return TypeSuffix(t.val_);
+
+    // vec<N, T>
+    if (!ExpectToken(Lexer::Token::OPER, "<"))
+      return NULL;
+    Lexer::Token n = lexer_.PeekToken();
+    if (n.type_ != Lexer::Token::INT) {
+      Error("expected vector width");
+      return NULL;
+    }
+    lexer_.ReadToken();
+    if (!ExpectToken(Lexer::Token::OPER, ","))
+      return NULL;
+    Lexer::Token elem = lexer_.PeekToken();
+    if (elem.type_ != Lexer::Token::IDENT) {
+      Error("expected type");
+      return NULL;
+    }
+    lexer_.ReadToken();
+    if (!ExpectToken(Lexer::Token::OPER, ">"))
+      return NULL;
+    return TypeSuffix("vec<" + n.val_.str() + ", " + elem.val_.str() + ">");
+  }
+
+  /** Parse the array dimensions after an already read type name. */
+  llvm::Type *FileParser::TypeSuffix(llvm::StringRef base) {
+    string name = base;
+    while (lexer_.ExpectToken(Lexer::Token::BRACKET, "[")) {
+      if (lexer_.ExpectToken(Lexer::Token::BRACKET, "]")) {
+        name += "[]";
+        break;
+      }
+      Lexer::Token n = lexer_.PeekToken();
+      if (n.type_ != Lexer::Token::INT || atoi(n.val_.str().c_str()) <= 0) {
+        Error("expected array size");
+        return NULL;
+      }
+      lexer_.ReadToken();
+      if (!ExpectToken(Lexer::Token::BRACKET, "]"))
+        return NULL;
+      name += "[" + n.val_.str() + "]";
+    }
+
+    llvm::Type *type = TranslateType(name);
+    if (!type)
+      Error("unknown type '" + name + "'");
+    return type;
+  }
+
   unique_ptr<ast::Statement> FileParser::Return() {
     if (!lexer_.ExpectToken(Lexer::Token::RETURN))
       return NULL;
@@ -320,92 +870,123 @@ namespace {
     return unique_ptr<ast::Statement>(new ast::Continue);
   }
 
-  unique_ptr<ast::Expression> FileParser::Primary() {
-    Lexer::Token t = lexer_.PeekToken();
-    switch (t.type_) {
-      case Lexer::Token::OPER:
-        lexer_.ReadToken();
-        return unique_ptr<ast::Expression>(new ast::UnaryOperation(t.val_, Primary()));
-      case Lexer::Token::PAREN: {
-        if (t.val_ != "(") return NULL;
-        lexer_.ReadToken();
+  /** Parse an expression with an explicit stack instead of recursion, so
+      that machine-generated expressions nested thousands of levels deep
+      take no more native stack than flat ones.
 
-        auto expr = Expression();
-        if (!expr || !ExpectToken(Lexer::Token::PAREN, ")"))
-          return NULL;
-        return expr;
-      }
-      case Lexer::Token::INT:
+      The loop alternates between reading an operand, pushing the prefix
+      operators and parentheses in front of it, and reading what follows
+      it: postfix calls, indexing and field access, then a binary operator.
+      Before a binary operator is pushed, the operators on the stack that
+      bind tighter are folded into the operand; when no operator follows,
+      the innermost open group is closed instead, or the expression ends.
+  */
+  unique_ptr<ast::Expression> FileParser::Expression() {
+    vector<Pending> stack;
+    unique_ptr<ast::Expression> operand;
+    for (;;) {
+      Lexer::Token t = lexer_.PeekToken();
+      if (t.type_ == Lexer::Token::OPER) {
         lexer_.ReadToken();
-        return PrimaryRHS(unique_ptr<ast::Expression>(new ast::IntegerLiteral(atoi(t.val_.str().c_str()))));
-      case Lexer::Token::IDENT:
+        stack.push_back(Pending(Pending::PREFIX, t.val_));
+        continue;
+      }
+      if (t.type_ == Lexer::Token::PAREN && t.val_ == "(") {
         lexer_.ReadToken();
-        return PrimaryRHS(unique_ptr<ast::Expression>(new ast::Variable(t.val_)));
-      default:
+        stack.push_back(Pending(Pending::PAREN));
+        continue;
+      }
+      if (t.type_ == Lexer::Token::INT)
+        operand.reset(new ast::IntegerLiteral(atoi(t.val_.str().c_str())));
+      else if (t.type_ == Lexer::Token::IDENT)
+        operand.reset(new ast::Variable(t.val_));
+      else
         return NULL;
-    }
-  }
+      lexer_.ReadToken();
 
-  unique_ptr<ast::Expression> FileParser::PrimaryRHS(unique_ptr<ast::Expression> LHS) {
-    for (;;) {
-      Lexer::Token t = lexer_.PeekToken();
-      switch (t.type_) {
-        case Lexer::Token::PAREN: {
-          if (t.val_ == "(") {
-            lexer_.ReadToken();
-
-            auto function = unique_ptr<ast::CallOperation>(new ast::CallOperation(move(LHS)));
-            bool need_comma = false;
-            for (;;) {
-              if (lexer_.ExpectToken(Lexer::Token::PAREN, ")"))
-                break;
-
-              if (need_comma) {
-                if (!ExpectToken(Lexer::Token::OPER, ","))
-                  return NULL;
-              }
-
-              need_comma = true;
-              function->args_.push_back(Expression());
-            }
-            LHS = move(function);
-            break;
+      // what follows the operand, until another operand is needed
+      bool postfix = true;
+      for (;;) {
+        t = lexer_.PeekToken();
+        if (postfix && t.type_ == Lexer::Token::PAREN && t.val_ == "(") {
+          lexer_.ReadToken();
+          auto call = unique_ptr<ast::CallOperation>(new ast::CallOperation(move(operand)));
+          if (lexer_.ExpectToken(Lexer::Token::PAREN, ")")) {
+            operand = move(call);
+            continue;
           }
-          return LHS;
+          stack.push_back(Pending(Pending::CALL));
+          stack.back().call_ = move(call);
+          break;
+        }
+        if (postfix && t.type_ == Lexer::Token::BRACKET && t.val_ == "[") {
+          lexer_.ReadToken();
+          stack.push_back(Pending(Pending::INDEX));
+          stack.back().expr_ = move(operand);
+          break;
+        }
+        if (postfix && t.type_ == Lexer::Token::DOT) {
+          lexer_.ReadToken();
+          Lexer::Token field = lexer_.PeekToken();
+          if (field.type_ != Lexer::Token::IDENT) {
+            Error("expected field");
+            return NULL;
+          }
+          lexer_.ReadToken();
+          operand.reset(new ast::FieldAccess(move(operand), field.val_));
+          continue;
         }
-        default:
-          return LHS;
-      }
-    }
-  }
-
-  unique_ptr<ast::Expression> FileParser::Expression() {
-    auto LHS = Primary();
-    if (!LHS) return NULL;
-    return BinOpRHS(0, move(LHS));
-  }
 
-  unique_ptr<ast::Expression> FileParser::BinOpRHS(int prec, unique_ptr<ast::Expression> LHS) {
-    for (;;) {
-      Lexer::Token t = lexer_.PeekToken();
-      int tok_prec = GetTokPrecedence(t);
-      if (tok_prec < prec)
-        return LHS;
+        // prefix operators apply to the operand alone
+        while (!stack.empty() && stack.back().kind_ == Pending::PREFIX) {
+          operand.reset(new ast::UnaryOperation(stack.back().oper_, move(operand)));
+          stack.pop_back();
+        }
 
-      llvm::StringRef binop = t.val_;
-      lexer_.ReadToken();
+        // fold the operators that bind at least as tightly; an odd
+        // precedence groups right-to-left, so an equal one stays pending
+        int prec = GetTokPrecedence(t);
+        while (!stack.empty() && stack.back().kind_ == Pending::BINARY &&
+               (stack.back().prec_ > prec || (stack.back().prec_ == prec && prec % 2 == 0))) {
+          Pending& binop = stack.back();
+          operand.reset(new ast::BinaryOperation(binop.oper_, move(binop.expr_), move(operand)));
+          stack.pop_back();
+        }
+        if (prec >= 0) {
+          lexer_.ReadToken();
+          stack.push_back(Pending(Pending::BINARY, t.val_, prec));
+          stack.back().expr_ = move(operand);
+          break;
+        }
 
-      auto RHS = Primary();
-      if (!RHS) return NULL;
+        if (stack.empty())
+          return operand;
 
-      t = lexer_.PeekToken();
-      int next_prec = GetTokPrecedence(t);
-      if (tok_prec < next_prec || (tok_prec == next_prec && tok_prec % 2)) {
-        RHS = BinOpRHS(tok_prec, move(RHS));
-        if (!RHS) return NULL;
+        Pending& group = stack.back();
+        if (group.kind_ == Pending::PAREN) {
+          if (!ExpectToken(Lexer::Token::PAREN, ")"))
+            return NULL;
+          stack.pop_back();
+          // a parenthesized expression is not called or indexed
+          postfix = false;
+        } else if (group.kind_ == Pending::CALL) {
+          group.call_->args_.push_back(move(operand));
+          if (!lexer_.ExpectToken(Lexer::Token::PAREN, ")")) {
+            if (!ExpectToken(Lexer::Token::OPER, ","))
+              return NULL;
+            break;
+          }
+          operand = move(group.call_);
+          stack.pop_back();
+          postfix = true;
+        } else {
+          if (!ExpectToken(Lexer::Token::BRACKET, "]"))
+            return NULL;
+          operand.reset(new ast::IndexOperation(move(group.expr_), move(operand)));
+          stack.pop_back();
+          postfix = true;
+        }
       }
-
-      LHS = unique_ptr<ast::Expression>(new ast::BinaryOperation(binop, move(LHS), move(RHS)));
     }
   }
 
@@ -425,6 +1006,147 @@ namespace {
     return true;
   }
 
+  /** Sources at least this large are split and parsed in parallel. */
+  const size_t kParallelParseThreshold = 1 << 20;
+
+  bool IsIdentChar(char ch) {
+    return isalnum(ch) || ch == '_';
+  }
+
+  /** Find offsets at which the source can be split into pieces that
+      parse independently, aiming for roughly equal pieces.
+
+      Functions start with the `fn` keyword, so a split is made before
+      an `fn` token outside of any braces. Comments are skipped the same
+      way Lexer::SkipWhitespace skips them, including nested block
+      comments, and string literals the way the lexer matches them, so
+      that braces and keywords inside either are ignored. A program with
+      unbalanced braces only splits at wrong places after the first
+      error, and the pieces after the first failed one are discarded
+      anyway.
+
+      Types are resolved while parsing, so no split is made before a
+      struct declaration: every struct is declared in the first piece,
+      which is parsed before the others.
+  */
+  vector<size_t> SplitTopLevel(llvm::StringRef contents, size_t pieces) {
+    vector<size_t> splits;
+    size_t target = contents.size() / pieces;
+    size_t next = target;
+    size_t depth = 0;
+
+    const char *begin = contents.begin();
+    const char *end = contents.end();
+    const char *p = begin;
+    while (p != end) {
+      if (*p == '/' && p+1 != end && p[1] == '/') {
+        while (p != end && *p != '\n')
+          ++p;
+        continue;
+      } else if (*p == '/' && p+1 != end && p[1] == '*') {
+        p += 2;
+        size_t comment_depth = 1;
+        while (p != end && comment_depth) {
+          if (*p == '*' && p+1 != end && p[1] == '/') {
+            p += 2;
+            --comment_depth;
+          } else if (*p == '/' && p+1 != end && p[1] == '*') {
+            p += 2;
+            ++comment_depth;
+          } else {
+            ++p;
+          }
+        }
+        continue;
+      }
+
+      if (*p == '"') {
+        const char *q = p + 1;
+        while (q != end && *q != '"' && *q != '\n' && *q)
+          ++q;
+        p = q != end && *q == '"' ? q + 1 : p + 1;
+        continue;
+      }
+
+      if (*p == '{') {
+        ++depth;
+      } else if (*p == '}') {
+        if (depth) --depth;
+      } else if (IsIdentChar(*p)) {
+        const char *q = p;
+        while (q != end && IsIdentChar(*q))
+          ++q;
+        size_t offset = p - begin;
+        llvm::StringRef word(p, q-p);
+        if (depth == 0 && word == "struct") {
+          splits.clear();
+          next = offset + target;
+        } else if (depth == 0 && offset >= next && word == "fn") {
+          splits.push_back(offset);
+          next = offset + target;
+        }
+        p = q;
+        continue;
+      }
+      ++p;
+    }
+    return splits;
+  }
+
+  /** Parse a large source on several threads.
+      The pieces are parsed into separate programs and messages, then
+      joined in source order. Parsing stops at the first piece that fails,
+      just as a sequential parse stops at the first bad top-level item, so
+      the diagnostics are the same as those of a sequential parse.
+  */
+  unique_ptr<ast::Program> ParseParallel(llvm::LLVMContext& ctx, Messages& errs,
+                                         const string& filename, const string& contents,
+                                         unsigned jobs) {
+    llvm::StringRef buffer(contents);
+    vector<size_t> splits = SplitTopLevel(buffer, jobs * 4);
+    splits.insert(splits.begin(), 0);
+    splits.push_back(buffer.size());
+
+    size_t n = splits.size() - 1;
+    vector<unique_ptr<ast::Program>> programs(n);
+    vector<Messages> msgs(n);
+    mutex ctx_lock;
+    atomic<size_t> next(0);
+
+    auto parse = [&](size_t i) {
+      llvm::StringRef chunk = buffer.slice(splits[i], splits[i+1]);
+      FileParser parser(ctx, msgs[i], filename, chunk, buffer.begin(), &ctx_lock);
+      programs[i] = parser.Parse();
+    };
+    auto worker = [&]() {
+      for (size_t i; (i = next++) < n; ) {
+        parse(i);
+      }
+    };
+
+    // the first piece declares the structs the others may refer to
+    parse(next++);
+    vector<thread> threads;
+    for (unsigned i = 1; i < jobs && i < n; ++i) {
+      threads.push_back(thread(worker));
+    }
+    worker();
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    auto program = unique_ptr<ast::Program>(new ast::Program());
+    for (size_t i = 0; i < n; ++i) {
+      errs.Append(msgs[i]);
+      if (!programs[i])
+        return NULL;
+      for (auto& stmt : programs[i]->stmts_) {
+        program->Append(move(stmt));
+      }
+    }
+    return program;
+  }
+
   void FileParser::Error(const string& msg) {
     char buf[4096];
     Lexer::LineInfo info = lexer_.GetLineInfo();
@@ -434,19 +1156,277 @@ namespace {
   }
 }
 
+Parser::Parser(const string& name, const Options& options)
+  : own_ctx_(new llvm::LLVMContext), ctx_(*own_ctx_),
+    module_(new llvm::Module(name, ctx_)), options_(options) {}
+
+Parser::Parser(llvm::LLVMContext& ctx, const string& name, const Options& options)
+  : ctx_(ctx), module_(new llvm::Module(name, ctx_)), options_(options) {}
+
+Parser::~Parser() {
+  ForgetStructs(ctx_);
+}
+
+bool Parser::ConfigureTarget(Messages& errs) {
+  if (target_)
+    return true;
+
+  string err;
+  target_.reset(CreateTargetMachine(options_, err));
+  if (!target_) {
+    // the host triple is only a default, so a missing backend is fatal
+    // only when a target was explicitly requested
+    if (options_.triple_.empty() && options_.cpu_.empty())
+      return true;
+    errs.Error("error: " + err);
+    return false;
+  }
+
+  ::ConfigureModule(*module_, *target_);
+  return true;
+}
+
+unique_ptr<ast::Program> ParseProgram(llvm::LLVMContext& ctx, Messages& errs,
+                                      const string& name, const string& contents,
+                                      unsigned jobs) {
+  if (jobs > 1 && contents.size() >= kParallelParseThreshold)
+    return ParseParallel(ctx, errs, name, contents, jobs);
+
+  FileParser parser(ctx, errs, name, contents);
+  return parser.Parse();
+}
+
+llvm::Type *LookupType(llvm::LLVMContext& ctx, llvm::StringRef name) {
+  using llvm::Type;
+  // T[] is the address of the first of any number of T
+  if (name.endswith("[]")) {
+    Type *elem = LookupType(ctx, name.substr(0, name.size() - 2));
+    if (!elem || elem->isVoidTy() || elem->isAggregateType() || elem->isPointerTy())
+      return NULL;
+    return llvm::PointerType::getUnqual(elem);
+  }
+
+  // T[a][b] is an array of a arrays of b T
+  size_t bracket = name.find('[');
+  if (bracket != llvm::StringRef::npos) {
+    Type *type = LookupType(ctx, name.substr(0, bracket));
+    if (!type || type->isVoidTy())
+      return NULL;
+
+    vector<uint64_t> dims;
+    for (llvm::StringRef rest = name.substr(bracket); !rest.empty(); ) {
+      size_t close = rest.find(']');
+      uint64_t n;
+      if (rest[0] != '[' || close == llvm::StringRef::npos ||
+          rest.slice(1, close).getAsInteger(10, n) || n == 0)
+        return NULL;
+      dims.push_back(n);
+      rest = rest.substr(close + 1);
+    }
+    // the innermost dimension of an array of @soa structs is a struct of
+    // arrays
+    uint64_t n;
+    const StructInfo *info = StructOf(type, n);
+    for (auto dim = dims.rbegin(); dim != dims.rend(); ++dim) {
+      if (info && !n && dim == dims.rbegin())
+        type = StructArrayType(*info, *dim);
+      else
+        type = llvm::ArrayType::get(type, *dim);
+    }
+    return type;
+  }
+
+  // vec<N, T> is a vector of N T, where N is a power of two
+  if (name.startswith("vec<") && name.endswith(">")) {
+    pair<llvm::StringRef, llvm::StringRef> parts = name.slice(4, name.size() - 1).split(", ");
+    Type *elem = LookupType(ctx, parts.second);
+    unsigned n;
+    if (!elem || !llvm::VectorType::isValidElementType(elem) ||
+        parts.first.getAsInteger(10, n) || n == 0 || (n & (n - 1)) != 0)
+      return NULL;
+    return llvm::VectorType::get(elem, n);
+  }
+
+  if (name == "region")
+    return RegionType(ctx);
+  else if (name == "void")
+    return Type::getVoidTy(ctx);
+  else if (name == "int")
+    return Type::getInt32Ty(ctx);
+  else if (name == "float")
+    return Type::getFloatTy(ctx);
+  else if (name == "double")
+    return Type::getDoubleTy(ctx);
+  else if (const StructInfo *info = FindStruct(ctx, name))
+    return info->type_;
+  else return NULL;
+}
+
+llvm::Type *ParameterType(llvm::Type *type) {
+  return type->isAggregateType() ? llvm::PointerType::getUnqual(type) : type;
+}
+
+string TypeName(llvm::Type *type) {
+  uint64_t n;
+  if (type->isArrayTy()) {
+    string dims;
+    while (llvm::ArrayType *array = llvm::dyn_cast<llvm::ArrayType>(type)) {
+      dims += "[" + llvm::utostr(array->getNumElements()) + "]";
+      type = array->getElementType();
+    }
+    // the struct of arrays is the innermost dimension
+    const StructInfo *info = StructOf(type, n);
+    if (info && n)
+      return info->name_ + dims + "[" + llvm::utostr(n) + "]";
+    return TypeName(type) + dims;
+  }
+
+  if (const StructInfo *info = StructOf(type, n))
+    return n ? info->name_ + "[" + llvm::utostr(n) + "]" : info->name_;
+
+  if (llvm::VectorType *vec = llvm::dyn_cast<llvm::VectorType>(type))
+    return "vec<" + llvm::utostr(vec->getNumElements()) + ", " + TypeName(vec->getElementType()) + ">";
+
+  if (type == RegionType(type->getContext()))
+    return "region";
+  llvm::PointerType *ptr = llvm::dyn_cast<llvm::PointerType>(type);
+  if (ptr && !ptr->getElementType()->isAggregateType() &&
+      !ptr->getElementType()->isPointerTy()) {
+    string elem = TypeName(ptr->getElementType());
+    return elem.empty() ? elem : elem + "[]";
+  }
+
+  if (type->isVoidTy())
+    return "void";
+  else if (type->isIntegerTy(32))
+    return "int";
+  else if (type->isFloatTy())
+    return "float";
+  else if (type->isDoubleTy())
+    return "double";
+  return string();
+}
+
 unique_ptr<Messages> Parser::Parse(const string& contents, const string& name) {
   auto msgs = unique_ptr<Messages>(new Messages);
-  FileParser parser(ctx_, *msgs, name, contents);
-  auto ast = parser.Parse();
-  if (!ast)
-    return msgs;
+  // expressions may be nested to any depth, and code generation recurses
+  // through them
+  RunWithStack(kTreeStackSize, [&]() { ParseAndGenerate(contents, name, *msgs); });
+  return msgs;
+}
+
+void Parser::ParseAndGenerate(const string& contents, const string& name, Messages& msgs) {
+  auto start = chrono::steady_clock::now();
+
+  // the AST from the cache refers to the mapping, so the cache is
+  // declared first to outlive it
+  unique_ptr<AstCache> cache;
+  unique_ptr<ast::Program> ast;
+  uint64_t hash = 0;
+  if (!options_.ast_cache_.empty()) {
+    hash = HashBytes(contents);
+    cache = AstCache::Map(options_.ast_cache_, hash);
+    if (cache)
+      ast = cache->Read(ctx_);
+  }
+
+  bool cached = ast != NULL;
+  if (!cached) {
+    ast = ParseProgram(ctx_, msgs, name, contents, jobs());
+    // the cache is only an optimization, so failing to write it is not
+    // worth a diagnostic
+    if (ast && !options_.ast_cache_.empty())
+      AstCache::Write(*ast, hash, options_.ast_cache_);
+  }
 
-  auto scope = shared_ptr<Scope>(new Scope);
-  ast->Codegen(module_, scope);
+  if (options_.stats_) {
+    chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "stats: %s in %.3f ms",
+             cached ? "loaded the AST cache" : "parsed", ms.count());
+    msgs.Info(buf);
+  }
+
+  if (ast && !options_.syntax_only_)
+    Generate(*ast, name, msgs);
+}
+
+bool Parser::Generate(ast::Program& program, const string& name, Messages& msgs) {
+  if (!ConfigureTarget(msgs))
+    return false;
+
+  ModuleGraph imports(msgs, jobs());
+  if (!imports.Load(program, name))
+    return false;
+
+  CodegenContext context(options_, msgs);
+  context.imports_ = &imports;
+  unique_ptr<Profile> profile;
+  if (!options_.profile_generate_.empty() || !options_.profile_use_.empty()) {
+    profile.reset(new Profile(*module_, options_, msgs));
+    if (!profile->Load())
+      return false;
+    context.profile_ = profile.get();
+  }
+
+  unique_ptr<ConstEval> consteval;
+  if (options_.const_eval_) {
+    consteval.reset(new ConstEval(program));
+    context.consteval_ = consteval.get();
+  }
+
+  unique_ptr<DebugInfo> debug_info;
+  if (options_.debug_info_) {
+    debug_info.reset(new DebugInfo(*module_, name, options_.opt_level_ > 0));
+    context.debug_info_ = debug_info.get();
+  }
+
+  auto scope = shared_ptr<Scope>(new Scope(&context));
+  program.Codegen(*module_, scope);
+  if (profile)
+    profile->Finish();
+  if (debug_info)
+    debug_info->Finish();
+
+  if (consteval && options_.stats_) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "stats: %u calls evaluated at compile time, "
+             "%u distinct calls left at the step or recursion limit",
+             consteval->folded(), consteval->gave_up());
+    msgs.Info(buf);
+  }
+
+  if (options_.type_layout_) {
+    // the module has the target's data layout, or the defaults without one
+    llvm::TargetData td(module_.get());
+    ReportStructLayouts(ctx_, td, msgs);
+  }
+
+  if (options_.stats_ && options_.bounds_check_) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "stats: %u bounds checks emitted, %u removed",
+             context.bounds_checks_, context.bounds_checks_removed_);
+    msgs.Info(buf);
+  }
+
+  if (options_.whole_program_) {
+    if (!module_->getFunction("main") && options_.exports_.empty())
+      msgs.Warning("warning: whole-program mode without main or exports; "
+                   "all functions will be removed");
+    StripDeadFunctions(*module_);
+  }
   return msgs;
 }
 
+unsigned Parser::jobs() const {
+  return options_.jobs_ ? options_.jobs_ : thread::hardware_concurrency();
+}
+
 unique_ptr<Messages> Parser::ParseFile(const string& path) {
   string contents = ReadFile(path);
   return Parse(contents, path);
 }
+
+void Parser::Optimize() {
+  ::Optimize(*module_, options_, target_.get());
+}
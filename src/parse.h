@@ -5,6 +5,16 @@
 #include <vector>
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
+#include "options.h"
+
+namespace llvm {
+  class TargetMachine;
+  class Type;
+}
+
+namespace ast {
+  struct Program;
+}
 
 struct Message {
   enum Level {
@@ -28,6 +38,7 @@ struct Messages {
   void Error(const std::string& msg);
   void Warning(const std::string& msg);
   void Info(const std::string& msg);
+  void Append(const Messages& other);
   size_t Count(Message::Level level = Message::ERROR) const;
 
   const std::vector<Message>& messages() const { return msgs_; }
@@ -40,17 +51,64 @@ private:
   std::vector<Message> msgs_;
 };
 
+/** Parse a source buffer into an AST. The AST refers to the contents,
+    which must outlive it. Returns NULL if the source has errors.
+*/
+std::unique_ptr<ast::Program> ParseProgram(llvm::LLVMContext& ctx, Messages& errs,
+                                           const std::string& name,
+                                           const std::string& contents,
+                                           unsigned jobs = 1);
+
+/** Translate the name of a type as written in source to its LLVM type,
+    or NULL for unknown types.
+*/
+llvm::Type *LookupType(llvm::LLVMContext& ctx, llvm::StringRef name);
+
+/** The LLVM type a parameter of a type is passed as. Arrays are passed
+    by reference, as a pointer to the caller's array.
+*/
+llvm::Type *ParameterType(llvm::Type *type);
+
+/** The source name of a type; the inverse of LookupType. */
+std::string TypeName(llvm::Type *type);
+
 struct Parser {
-  Parser(const std::string& name)
-    : module_(name, ctx_) {}
+  Parser(const std::string& name, const Options& options = Options());
+  /** Compile into a context that outlives the parser, so that many small
+      programs can share one warm context. Parsers sharing a context must
+      not run at the same time.
+  */
+  Parser(llvm::LLVMContext& ctx, const std::string& name, const Options& options = Options());
+  ~Parser();
 
   std::unique_ptr<Messages> Parse(const std::string& contents, const std::string& name = "<stdin>");
   std::unique_ptr<Messages> ParseFile(const std::string& path);
 
+  /** Generate code for an already parsed program into the module. */
+  bool Generate(ast::Program& program, const std::string& name, Messages& msgs);
+  void Optimize();
+
   llvm::LLVMContext& ctx() { return ctx_; }
-  llvm::Module& module() { return module_; }
+  llvm::Module& module() { return *module_; }
+
+  /** Hand the module over to a new owner, such as an execution engine.
+      The parser cannot generate code afterwards.
+  */
+  llvm::Module *ReleaseModule() { return module_.release(); }
+  const Options& options() const { return options_; }
+  llvm::TargetMachine *target() { return target_.get(); }
+
+  /** Threads the front end may use, from -j or the hardware. */
+  unsigned jobs() const;
 
 private:
-  llvm::LLVMContext ctx_;
-  llvm::Module module_;
+  bool ConfigureTarget(Messages& errs);
+  void ParseAndGenerate(const std::string& contents, const std::string& name, Messages& msgs);
+
+  /** Set when the parser has a context of its own. */
+  std::unique_ptr<llvm::LLVMContext> own_ctx_;
+  llvm::LLVMContext& ctx_;
+  std::unique_ptr<llvm::Module> module_;
+  Options options_;
+  std::unique_ptr<llvm::TargetMachine> target_;
 };
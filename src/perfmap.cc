@@ -0,0 +1,243 @@
+
+#include "perfmap.h"
+#include <llvm/Function.h>
+#include <llvm/Analysis/DebugInfo.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Support/DebugLoc.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace llvm;
+using std::string;
+
+namespace {
+  // the jitdump format is specified in perf's
+  // tools/perf/Documentation/jitdump-specification.txt
+  const uint32_t kJitdumpMagic = 0x4A695444;
+  const uint32_t kJitdumpVersion = 1;
+
+  enum RecordType {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2
+  };
+
+  struct FileHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t total_size_;
+    uint32_t elf_mach_;
+    uint32_t pad1_;
+    uint32_t pid_;
+    uint64_t timestamp_;
+    uint64_t flags_;
+  };
+
+  struct RecordHeader {
+    uint32_t id_;
+    uint32_t total_size_;
+    uint64_t timestamp_;
+  };
+
+  /** Followed by the function name, NUL-terminated, and the code. */
+  struct CodeLoad {
+    RecordHeader header_;
+    uint32_t pid_;
+    uint32_t tid_;
+    uint64_t vma_;
+    uint64_t code_addr_;
+    uint64_t code_size_;
+    uint64_t code_index_;
+  };
+
+  /** Followed by nr_entry_ DebugEntry. */
+  struct DebugInfoRecord {
+    RecordHeader header_;
+    uint64_t code_addr_;
+    uint64_t nr_entry_;
+  };
+
+  /** Followed by the source file name, NUL-terminated. */
+  struct DebugEntry {
+    uint64_t addr_;
+    int32_t lineno_;
+    int32_t discrim_;
+  };
+
+  uint32_t ElfMachine() {
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#elif defined(__powerpc64__)
+    return EM_PPC64;
+#else
+    return EM_NONE;
+#endif
+  }
+
+  /** perf orders jitdump records against samples by this clock, which
+      `perf record -k 1` selects.
+  */
+  uint64_t Timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  class PerfMap : public JITEventListener {
+  public:
+    PerfMap();
+
+    virtual void NotifyFunctionEmitted(const Function& f, void *code, size_t size,
+                                       const EmittedFunctionDetails& details);
+
+  private:
+    bool OpenDump(const string& path);
+    void WriteDebugInfo(const Function& f, void *code, const EmittedFunctionDetails& details);
+    void WriteCodeLoad(const string& name, void *code, size_t size);
+
+    std::mutex mu_;
+    FILE *map_;
+    FILE *dump_;
+    uint64_t index_;
+  };
+
+  PerfMap::PerfMap() : map_(NULL), dump_(NULL), index_(0) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+    map_ = fopen(path, "w");
+    if (!map_)
+      fprintf(stderr, "warning: could not write %s: %s\n", path, strerror(errno));
+
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    if (!OpenDump(path))
+      fprintf(stderr, "warning: could not write %s: %s\n", path, strerror(errno));
+  }
+
+  bool PerfMap::OpenDump(const string& path) {
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+      return false;
+    // perf finds the jitdump of a process by this executable mapping of
+    // it in the recording, so it stays mapped for as long as we run
+    long page = sysconf(_SC_PAGESIZE);
+    if (mmap(NULL, page, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    dump_ = fdopen(fd, "wb");
+    if (!dump_) {
+      close(fd);
+      return false;
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic_ = kJitdumpMagic;
+    header.version_ = kJitdumpVersion;
+    header.total_size_ = sizeof(header);
+    header.elf_mach_ = ElfMachine();
+    header.pid_ = getpid();
+    header.timestamp_ = Timestamp();
+    fwrite(&header, sizeof(header), 1, dump_);
+    fflush(dump_);
+    return true;
+  }
+
+  void PerfMap::NotifyFunctionEmitted(const Function& f, void *code, size_t size,
+                                      const EmittedFunctionDetails& details) {
+    std::lock_guard<std::mutex> guard(mu_);
+    string name = f.getName();
+    if (map_) {
+      fprintf(map_, "%llx %llx %s\n", (unsigned long long) (uintptr_t) code,
+              (unsigned long long) size, name.c_str());
+      fflush(map_);
+    }
+    if (dump_) {
+      // perf expects the lines of a function before its code
+      WriteDebugInfo(f, code, details);
+      WriteCodeLoad(name, code, size);
+      fflush(dump_);
+    }
+  }
+
+  void PerfMap::WriteDebugInfo(const Function& f, void *code,
+                               const EmittedFunctionDetails& details) {
+    struct Line {
+      uint64_t addr_;
+      unsigned line_;
+      string file_;
+    };
+    std::vector<Line> lines;
+    uint32_t size = sizeof(DebugInfoRecord);
+    // the file of the last scope a line was in; only kept for one
+    // function, since the metadata of a module that has been freed may
+    // be reused by the next one at the same address
+    const MDNode *last_scope = NULL;
+    string file;
+    for (auto& start : details.LineStarts) {
+      if (start.Loc.isUnknown() || start.Loc.getLine() == 0)
+        continue;
+      const MDNode *scope = start.Loc.getScope(f.getContext());
+      if (scope != last_scope) {
+        DIScope di(scope);
+        last_scope = scope;
+        file = di.getDirectory().str() + "/" + di.getFilename().str();
+      }
+      Line line = { start.Address, start.Loc.getLine(), file };
+      lines.push_back(line);
+      size += sizeof(DebugEntry) + file.size() + 1;
+    }
+    if (lines.empty())
+      return;
+
+    DebugInfoRecord record;
+    record.header_.id_ = JIT_CODE_DEBUG_INFO;
+    record.header_.total_size_ = size;
+    record.header_.timestamp_ = Timestamp();
+    record.code_addr_ = (uintptr_t) code;
+    record.nr_entry_ = lines.size();
+    fwrite(&record, sizeof(record), 1, dump_);
+    for (auto& line : lines) {
+      DebugEntry entry = { line.addr_, int32_t(line.line_), 0 };
+      fwrite(&entry, sizeof(entry), 1, dump_);
+      fwrite(line.file_.c_str(), line.file_.size() + 1, 1, dump_);
+    }
+  }
+
+  void PerfMap::WriteCodeLoad(const string& name, void *code, size_t size) {
+    CodeLoad record;
+    record.header_.id_ = JIT_CODE_LOAD;
+    record.header_.total_size_ = sizeof(record) + name.size() + 1 + size;
+    record.header_.timestamp_ = Timestamp();
+    record.pid_ = getpid();
+    record.tid_ = syscall(SYS_gettid);
+    record.vma_ = (uintptr_t) code;
+    record.code_addr_ = (uintptr_t) code;
+    record.code_size_ = size;
+    record.code_index_ = index_++;
+    fwrite(&record, sizeof(record), 1, dump_);
+    fwrite(name.c_str(), name.size() + 1, 1, dump_);
+    fwrite(code, size, 1, dump_);
+  }
+}
+
+JITEventListener *PerfMapListener() {
+  // leaked, since execution engines may still report code at exit
+  static PerfMap *listener = new PerfMap;
+  return listener;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+namespace llvm {
+  class JITEventListener;
+}
+
+/** The listener that describes JIT-compiled functions to perf
+    (-fperf-map), to register with every execution engine that should be
+    profiled. There is one per process, since perf reads one map and one
+    jitdump file per process, and it may be shared by execution engines
+    on several threads.
+
+    Each function is written as a line of /tmp/perf-<pid>.map, which perf
+    report reads as is, and as a code load record in /tmp/jit-<pid>.dump
+    with a copy of the code and, when the module has line tables (-g), a
+    debug record mapping its addresses to source lines. Recording with
+    `perf record -k 1` and running `perf inject --jit` on the result turns
+    the jitdump into symbols and source lines that outlive the process.
+
+    The work is a few writes per compiled function; running code pays
+    nothing.
+*/
+llvm::JITEventListener *PerfMapListener();
@@ -0,0 +1,267 @@
+
+#include "profile.h"
+#include "options.h"
+#include "parse.h"
+#include <llvm/Attributes.h>
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/Module.h>
+#include <llvm/Support/MDBuilder.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <stdio.h>
+using namespace llvm;
+using std::string;
+using std::vector;
+
+namespace {
+  const uint64_t kFNVOffset = 14695981039346656037ULL;
+  const uint64_t kFNVPrime = 1099511628211ULL;
+
+  /** Scale counts to fit in 32-bit branch weights. All weights are
+      offset by one so that a branch that was never taken still has a
+      small, nonzero probability.
+  */
+  vector<uint32_t> ScaleWeights(const vector<uint64_t>& counts) {
+    uint64_t max = 0;
+    for (uint64_t count : counts) {
+      if (count > max)
+        max = count;
+    }
+    uint64_t scale = max / UINT32_MAX + 1;
+    vector<uint32_t> weights;
+    for (uint64_t count : counts) {
+      weights.push_back(uint32_t(count / scale + 1));
+    }
+    return weights;
+  }
+}
+
+Profile::Profile(Module& m, const Options& options, Messages& errs)
+  : m_(m), options_(options), errs_(errs),
+    generate_(!options.profile_generate_.empty()),
+    counters_(NULL), num_counters_(0), max_entry_(0) {
+  cur_.f_ = NULL;
+}
+
+bool Profile::Load() {
+  if (generate_ || options_.profile_use_.empty())
+    return true;
+
+  const string& path = options_.profile_use_;
+  FILE *fd = fopen(path.c_str(), "r");
+  if (!fd) {
+    errs_.Error("error: could not open profile '" + path + "'");
+    return false;
+  }
+
+  char name[4096];
+  unsigned version;
+  if (fscanf(fd, "neat-profile %u", &version) != 1 || version != 1) {
+    fclose(fd);
+    errs_.Error("error: '" + path + "' is not a neat profile");
+    return false;
+  }
+
+  Record record;
+  unsigned long long hash, count, n;
+  while (fscanf(fd, "%4095s %llu %llu", name, &hash, &n) == 3) {
+    record.hash_ = hash;
+    record.counts_.clear();
+    for (unsigned long long i = 0; i < n; ++i) {
+      if (fscanf(fd, "%llu", &count) != 1)
+        break;
+      record.counts_.push_back(count);
+    }
+    if (record.counts_.size() != n)
+      break;
+
+    if (!record.counts_.empty() && record.counts_[0] > max_entry_)
+      max_entry_ = record.counts_[0];
+    records_[name] = record;
+  }
+
+  bool ok = feof(fd);
+  fclose(fd);
+  if (!ok) {
+    errs_.Error("error: '" + path + "' is truncated or corrupt");
+    return false;
+  }
+  return true;
+}
+
+void Profile::BeginFunction(IRBuilder<>& irb, Function *f) {
+  cur_.f_ = f;
+  cur_.hash_ = kFNVOffset;
+  cur_.begin_ = num_counters_;
+  cur_.count_ = 0;
+  branches_.clear();
+  Counter(irb, ENTRY);
+}
+
+void Profile::EndFunction() {
+  if (generate_) {
+    functions_.push_back(cur_);
+    cur_.f_ = NULL;
+    return;
+  }
+
+  auto iter = records_.find(cur_.f_->getName());
+  if (iter == records_.end()) {
+    cur_.f_ = NULL;
+    return;
+  }
+
+  const Record& record = iter->second;
+  if (record.hash_ != cur_.hash_ || record.counts_.size() != cur_.count_) {
+    errs_.Warning("warning: profile for '" + cur_.f_->getName().str() +
+                  "' does not match its source and was ignored");
+    cur_.f_ = NULL;
+    return;
+  }
+
+  MDBuilder md(m_.getContext());
+  for (auto& branch : branches_) {
+    vector<uint64_t> counts;
+    for (unsigned counter : branch.second) {
+      counts.push_back(record.counts_[counter]);
+    }
+    branch.first->setMetadata(LLVMContext::MD_prof,
+                              md.createBranchWeights(ScaleWeights(counts)));
+  }
+
+  // LLVM has no function entry counts, so use the entry counter to steer
+  // the inliner and the size optimizations instead
+  uint64_t entry = record.counts_[0];
+  if (entry == 0)
+    cur_.f_->addFnAttr(Attribute::OptimizeForSize);
+  else if (entry >= max_entry_ / 10)
+    cur_.f_->addFnAttr(Attribute::InlineHint);
+  cur_.f_ = NULL;
+}
+
+unsigned Profile::Counter(IRBuilder<>& irb, Kind kind) {
+  cur_.hash_ = (cur_.hash_ ^ kind) * kFNVPrime;
+  unsigned index = cur_.count_++;
+  if (generate_) {
+    ++num_counters_;
+    Increment(irb, cur_.begin_ + index);
+  }
+  return index;
+}
+
+unsigned Profile::EdgeCounter(BranchInst *br, unsigned succ, Kind kind) {
+  if (!generate_) {
+    IRBuilder<> irb(br);
+    return Counter(irb, kind);
+  }
+
+  LLVMContext& ctx = m_.getContext();
+  BasicBlock *dest = br->getSuccessor(succ);
+  BasicBlock *edge = BasicBlock::Create(ctx, "", br->getParent()->getParent());
+  br->setSuccessor(succ, edge);
+
+  IRBuilder<> irb(edge);
+  unsigned index = Counter(irb, kind);
+  irb.CreateBr(dest);
+  return index;
+}
+
+void Profile::BranchWeights(BranchInst *br, unsigned taken, unsigned not_taken) {
+  if (!generate_) {
+    vector<unsigned> counters;
+    counters.push_back(taken);
+    counters.push_back(not_taken);
+    branches_.push_back(std::make_pair(br, counters));
+  }
+}
+
+void Profile::SwitchWeights(SwitchInst *sw, const vector<unsigned>& counters) {
+  if (!generate_)
+    branches_.push_back(std::make_pair(sw, counters));
+}
+
+void Profile::Increment(IRBuilder<>& irb, unsigned index) {
+  // the real counter array is only created once its size is known, so
+  // until then the increments go through a placeholder
+  if (!counters_) {
+    counters_ = new GlobalVariable(m_, irb.getInt64Ty(), false,
+                                   GlobalValue::ExternalLinkage, NULL,
+                                   "__neat_prof_placeholder");
+  }
+
+  Value *ptr = irb.CreateConstGEP1_32(counters_, index);
+  Value *val = irb.CreateAdd(irb.CreateLoad(ptr), irb.getInt64(1));
+  irb.CreateStore(val, ptr);
+}
+
+void Profile::Finish() {
+  if (!generate_ || !counters_)
+    return;
+
+  LLVMContext& ctx = m_.getContext();
+  Type *i8ptr = Type::getInt8PtrTy(ctx);
+  Type *i32 = Type::getInt32Ty(ctx);
+  Type *i64 = Type::getInt64Ty(ctx);
+  Type *i64ptr = Type::getInt64PtrTy(ctx);
+
+  ArrayType *array = ArrayType::get(i64, num_counters_);
+  GlobalVariable *counters = new GlobalVariable(m_, array, false,
+                                                GlobalValue::InternalLinkage,
+                                                ConstantAggregateZero::get(array),
+                                                "__neat_prof_counters");
+  counters_->replaceAllUsesWith(ConstantExpr::getBitCast(counters, i64ptr));
+  counters_->eraseFromParent();
+  counters_ = NULL;
+
+  // struct neat_prof_function in runtime/profile.cc
+  Type *fields[] = { i8ptr, i64, i64ptr, i32 };
+  StructType *record = StructType::create(fields, "neat_prof_function");
+
+  vector<Constant*> records;
+  for (auto& fn : functions_) {
+    Constant *name = ConstantDataArray::getString(ctx, fn.f_->getName());
+    GlobalVariable *str = new GlobalVariable(m_, name->getType(), true,
+                                             GlobalValue::PrivateLinkage,
+                                             name, "__neat_prof_name");
+    Constant *idx[] = { ConstantInt::get(i32, 0), ConstantInt::get(i32, fn.begin_) };
+    Constant *vals[] = {
+      ConstantExpr::getBitCast(str, i8ptr),
+      ConstantInt::get(i64, fn.hash_),
+      ConstantExpr::getGetElementPtr(counters, idx),
+      ConstantInt::get(i32, fn.count_)
+    };
+    records.push_back(ConstantStruct::get(record, vals));
+  }
+
+  ArrayType *table_type = ArrayType::get(record, records.size());
+  GlobalVariable *table = new GlobalVariable(m_, table_type, true,
+                                             GlobalValue::InternalLinkage,
+                                             ConstantArray::get(table_type, records),
+                                             "__neat_prof_functions");
+
+  Constant *path = ConstantDataArray::getString(ctx, options_.profile_generate_);
+  GlobalVariable *path_var = new GlobalVariable(m_, path->getType(), true,
+                                                GlobalValue::PrivateLinkage,
+                                                path, "__neat_prof_path");
+
+  Type *params[] = { PointerType::getUnqual(record), i32, i8ptr };
+  Constant *reg = m_.getOrInsertFunction("__neat_prof_register",
+                                         FunctionType::get(Type::getVoidTy(ctx), params, false));
+
+  Function *init = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false),
+                                    GlobalValue::InternalLinkage,
+                                    "__neat_prof_init", &m_);
+  IRBuilder<> irb(BasicBlock::Create(ctx, "entry", init));
+  Value *args[] = {
+    irb.CreateConstGEP2_32(table, 0, 0),
+    irb.getInt32(records.size()),
+    irb.CreateConstGEP2_32(path_var, 0, 0)
+  };
+  irb.CreateCall(reg, args);
+  irb.CreateRetVoid();
+
+  appendToGlobalCtors(m_, init, 0);
+}
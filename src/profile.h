@@ -0,0 +1,112 @@
+#pragma once
+
+#include <llvm/Support/IRBuilder.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+  class BranchInst;
+  class Function;
+  class GlobalVariable;
+  class Instruction;
+  class Module;
+  class SwitchInst;
+}
+
+struct Messages;
+struct Options;
+
+/** Profile-guided optimization support.
+
+    With -fprofile-generate, every function entry and every branch of an
+    if, while or switch statement gets a 64-bit counter. The counters for the
+    whole module live in one contiguous array and are handed to the
+    runtime (libneatrt) by a module constructor. The runtime writes them
+    to the profile file when the program exits.
+
+    With -fprofile-use, the profile file is read back and the same
+    counters are used to attach branch weights and to mark hot and
+    never-executed functions.
+
+    Counters are numbered in code generation order within a function, and
+    each function carries a hash of its counter layout, so a profile
+    recorded for a function whose control flow has since changed is
+    ignored rather than misapplied.
+*/
+struct Profile {
+  enum Kind {
+    ENTRY,
+    IF_THEN,
+    IF_ELSE,
+    WHILE_BODY,
+    WHILE_EXIT,
+    SWITCH_CASE
+  };
+
+  Profile(llvm::Module& m, const Options& options, Messages& errs);
+
+  bool generating() const { return generate_; }
+
+  /** Read the profile file when in -fprofile-use mode. */
+  bool Load();
+
+  /** Start counting a function and add its entry counter. */
+  void BeginFunction(llvm::IRBuilder<>& irb, llvm::Function *f);
+  void EndFunction();
+
+  /** Allocate the next counter of the current function. When generating,
+      the counter is incremented at the insertion point.
+  */
+  unsigned Counter(llvm::IRBuilder<>& irb, Kind kind);
+
+  /** Allocate a counter for the edge from a branch to one of its
+      successors. When generating, the edge is split to hold the increment.
+  */
+  unsigned EdgeCounter(llvm::BranchInst *br, unsigned succ, Kind kind);
+
+  /** Weight a conditional branch by the counts of its two successors. */
+  void BranchWeights(llvm::BranchInst *br, unsigned taken, unsigned not_taken);
+
+  /** Weight a switch by the counts of its default and then of each of
+      its cases, in order.
+  */
+  void SwitchWeights(llvm::SwitchInst *sw, const std::vector<unsigned>& counters);
+
+  /** Emit the counter array and the runtime registration. */
+  void Finish();
+
+private:
+  struct Record {
+    uint64_t hash_;
+    std::vector<uint64_t> counts_;
+  };
+
+  struct FunctionState {
+    llvm::Function *f_;
+    uint64_t hash_;
+    unsigned begin_;
+    unsigned count_;
+  };
+
+  void Increment(llvm::IRBuilder<>& irb, unsigned index);
+
+  llvm::Module& m_;
+  const Options& options_;
+  Messages& errs_;
+  bool generate_;
+
+  // -fprofile-generate
+  llvm::GlobalVariable *counters_;
+  std::vector<FunctionState> functions_;
+  unsigned num_counters_;
+
+  // -fprofile-use
+  std::unordered_map<std::string, Record> records_;
+  uint64_t max_entry_;
+  std::vector<std::pair<llvm::Instruction*, std::vector<unsigned>>> branches_;
+
+  FunctionState cur_;
+};
@@ -1,9 +1,8 @@
 
 #include "scope.h"
-#include <llvm/Instructions.h>
 using namespace std;
 
-llvm::AllocaInst *Scope::get(llvm::StringRef name) const {
+llvm::Value *Scope::get(llvm::StringRef name) const {
   auto iter = vars_.find(name);
   if (iter != vars_.end())
     return iter->second;
@@ -16,7 +15,7 @@ bool Scope::has(llvm::StringRef name) const {
   return parent_ && parent_->has(name);
 }
 
-bool Scope::define(llvm::StringRef name, llvm::AllocaInst *var) {
+bool Scope::define(llvm::StringRef name, llvm::Value *var) {
   if (has(name))
     return false;
   vars_[name] = var;
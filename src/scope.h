@@ -8,15 +8,17 @@
 #include <utility>
 
 namespace llvm {
-  struct AllocaInst;
+  class Value;
 }
 
+struct CodegenContext;
+
 struct Scope : std::enable_shared_from_this<Scope> {
-  Scope() {}
+  Scope(CodegenContext *context) : context_(context) {}
 
-  llvm::AllocaInst *get(llvm::StringRef) const;
+  llvm::Value *get(llvm::StringRef) const;
   bool has(llvm::StringRef) const;
-  bool define(llvm::StringRef, llvm::AllocaInst*);
+  bool define(llvm::StringRef, llvm::Value*);
 
   typedef std::pair<llvm::BasicBlock*, llvm::BasicBlock*> Block;
   const Block *block(llvm::StringRef name = "") const;
@@ -24,13 +26,18 @@ struct Scope : std::enable_shared_from_this<Scope> {
   std::shared_ptr<Scope> derive() const;
   std::shared_ptr<Scope> derive(llvm::BasicBlock* start, llvm::BasicBlock* end) const;
 
+  CodegenContext& context() const { return *context_; }
+
 private:
-  Scope(const std::shared_ptr<const Scope>& parent) : parent_(parent) {}
+  Scope(const std::shared_ptr<const Scope>& parent)
+    : context_(parent->context_), parent_(parent) {}
   Scope(const std::shared_ptr<const Scope>& parent,
         llvm::BasicBlock *start, llvm::BasicBlock *end)
-    : parent_(parent), block_(new Block(start, end)) {}
+    : context_(parent->context_), parent_(parent), block_(new Block(start, end)) {}
+
+  CodegenContext *context_;
 
-  typedef std::unordered_map<std::string,llvm::AllocaInst*> VariableMap;
+  typedef std::unordered_map<std::string,llvm::Value*> VariableMap;
   VariableMap vars_;
 
   std::shared_ptr<const Scope> parent_;
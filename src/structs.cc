@@ -0,0 +1,210 @@
+
+#include "structs.h"
+#include "parse.h"
+#include <llvm/DerivedTypes.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Target/TargetData.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+using namespace std;
+using namespace llvm;
+
+namespace {
+  struct ContextStructs {
+    vector<unique_ptr<StructInfo>> structs_;
+    unordered_map<string, const StructInfo*> by_name_;
+  };
+
+  struct Element {
+    const StructInfo *info_;
+    uint64_t n_;
+  };
+
+  /** Structs are declared while parsing on several threads, and looked
+      up from code generation, so the registry has a lock of its own.
+  */
+  struct Registry {
+    mutex mu_;
+    unordered_map<LLVMContext*, ContextStructs> contexts_;
+    unordered_map<Type*, Element> by_type_;
+  };
+
+  Registry& registry() {
+    static Registry r;
+    return r;
+  }
+
+  /** The alignment a type has on the targets we support, where every
+      scalar and vector is aligned to its size. Only used to order
+      fields, before a target is known.
+  */
+  uint64_t NaturalAlignment(Type *type) {
+    if (ArrayType *array = dyn_cast<ArrayType>(type))
+      return NaturalAlignment(array->getElementType());
+    if (StructType *st = dyn_cast<StructType>(type)) {
+      uint64_t align = 1;
+      for (unsigned i = 0; i < st->getNumElements(); ++i) {
+        align = max(align, NaturalAlignment(st->getElementType(i)));
+      }
+      return align;
+    }
+    return max<uint64_t>(1, type->getPrimitiveSizeInBits() / 8);
+  }
+}
+
+int StructInfo::Slot(StringRef field) const {
+  for (size_t i = 0; i < names_.size(); ++i) {
+    if (names_[i] == field)
+      return slots_[i];
+  }
+  return -1;
+}
+
+const StructInfo *DeclareStruct(LLVMContext& ctx, StringRef name,
+                                const vector<string>& names,
+                                const vector<Type*>& types,
+                                bool soa, bool ordered) {
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.mu_);
+  ContextStructs& structs = r.contexts_[&ctx];
+  if (structs.by_name_.count(name))
+    return NULL;
+
+  auto info = unique_ptr<StructInfo>(new StructInfo);
+  info->name_ = name;
+  info->names_ = names;
+  info->types_ = types;
+  info->soa_ = soa;
+  info->ordered_ = ordered;
+
+  // a stable sort keeps the declared order among equally aligned fields
+  vector<unsigned> order;
+  for (unsigned i = 0; i < types.size(); ++i) {
+    order.push_back(i);
+  }
+  if (!ordered) {
+    stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return NaturalAlignment(types[a]) > NaturalAlignment(types[b]);
+    });
+  }
+
+  vector<Type*> fields;
+  info->slots_.resize(types.size());
+  for (unsigned slot = 0; slot < order.size(); ++slot) {
+    info->slots_[order[slot]] = slot;
+    fields.push_back(types[order[slot]]);
+  }
+  info->type_ = StructType::create(ctx, fields, name);
+
+  const StructInfo *result = info.get();
+  Element element = { result, 0 };
+  r.by_type_[info->type_] = element;
+  structs.by_name_[info->name_] = result;
+  structs.structs_.push_back(move(info));
+  return result;
+}
+
+const StructInfo *FindStruct(LLVMContext& ctx, StringRef name) {
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.mu_);
+  auto structs = r.contexts_.find(&ctx);
+  if (structs == r.contexts_.end())
+    return NULL;
+  auto iter = structs->second.by_name_.find(name);
+  return iter != structs->second.by_name_.end() ? iter->second : NULL;
+}
+
+const StructInfo *StructOf(Type *type, uint64_t& n) {
+  n = 0;
+  if (!type->isStructTy())
+    return NULL;
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.mu_);
+  auto iter = r.by_type_.find(type);
+  if (iter == r.by_type_.end())
+    return NULL;
+  n = iter->second.n_;
+  return iter->second.info_;
+}
+
+Type *StructArrayType(const StructInfo& info, uint64_t n) {
+  if (!info.soa_)
+    return ArrayType::get(info.type_, n);
+
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.mu_);
+  StructType *&type = info.soa_types_[n];
+  if (!type) {
+    // the arrays are in the same order as the fields of the struct
+    vector<Type*> arrays;
+    for (unsigned i = 0; i < info.type_->getNumElements(); ++i) {
+      arrays.push_back(ArrayType::get(info.type_->getElementType(i), n));
+    }
+    type = StructType::create(info.type_->getContext(), arrays,
+                              info.name_ + "[" + utostr(n) + "]");
+    Element element = { &info, n };
+    r.by_type_[type] = element;
+  }
+  return type;
+}
+
+void ForgetStructs(LLVMContext& ctx) {
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.mu_);
+  auto structs = r.contexts_.find(&ctx);
+  if (structs == r.contexts_.end())
+    return;
+  for (auto& info : structs->second.structs_) {
+    r.by_type_.erase(info->type_);
+    for (auto& soa : info->soa_types_) {
+      r.by_type_.erase(soa.second);
+    }
+  }
+  r.contexts_.erase(structs);
+}
+
+void ReportStructLayouts(LLVMContext& ctx, const TargetData& td, Messages& msgs) {
+  vector<const StructInfo*> structs;
+  {
+    Registry& r = registry();
+    lock_guard<mutex> guard(r.mu_);
+    for (auto& info : r.contexts_[&ctx].structs_) {
+      structs.push_back(info.get());
+    }
+  }
+
+  char buf[256];
+  for (const StructInfo *info : structs) {
+    const StructLayout *layout = td.getStructLayout(info->type_);
+    uint64_t declared = td.getTypeAllocSize(StructType::get(ctx, info->types_));
+    snprintf(buf, sizeof(buf), "layout: %s: %llu bytes, aligned to %u, %s",
+             info->name_.c_str(), (unsigned long long) layout->getSizeInBytes(),
+             layout->getAlignment(), info->soa_ ? "arrays are struct-of-arrays"
+                                                : "arrays are array-of-structs");
+    msgs.Info(buf);
+
+    if (declared != layout->getSizeInBytes()) {
+      snprintf(buf, sizeof(buf), "layout:   %llu bytes in declaration order",
+               (unsigned long long) declared);
+      msgs.Info(buf);
+    }
+
+    // fields in memory order
+    vector<unsigned> order(info->slots_.size());
+    for (unsigned i = 0; i < info->slots_.size(); ++i) {
+      order[info->slots_[i]] = i;
+    }
+    for (unsigned slot = 0; slot < order.size(); ++slot) {
+      Type *type = info->types_[order[slot]];
+      snprintf(buf, sizeof(buf), "layout:   %s: %s at %llu, %llu bytes, aligned to %u",
+               info->names_[order[slot]].c_str(), TypeName(type).c_str(),
+               (unsigned long long) layout->getElementOffset(slot),
+               (unsigned long long) td.getTypeAllocSize(type),
+               td.getABITypeAlignment(type));
+      msgs.Info(buf);
+    }
+  }
+}
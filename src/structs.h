@@ -0,0 +1,79 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class LLVMContext;
+  class StructType;
+  class TargetData;
+  class Type;
+}
+
+struct Messages;
+
+/** A struct declared in source:
+
+      struct Particle { pos: vec<4, float>; mass: float; id: int; }
+
+    A struct is an LLVM struct type whose fields are stored sorted by
+    alignment, largest first, which leaves no padding between fields
+    whose sizes are multiples of their alignments. Declaring it @ordered
+    keeps the declared order, for data shared with other languages.
+
+    An array of n structs is an array of the struct type, unless the
+    declaration is marked @soa: then it is stored as a struct of arrays,
+    one array of n for each field, so that a loop over one field of
+    every element reads contiguous memory.
+
+    Types are looked up by name while parsing, so structs are registered
+    per LLVMContext, in declaration order.
+*/
+struct StructInfo {
+  std::string name_;
+  /** The fields in declaration order. */
+  std::vector<std::string> names_;
+  std::vector<llvm::Type*> types_;
+  /** The position of each field in type_, by declaration order. */
+  std::vector<unsigned> slots_;
+  bool soa_;
+  bool ordered_;
+  llvm::StructType *type_;
+
+  /** The position of a field in type_, or -1 if there is no such field. */
+  int Slot(llvm::StringRef field) const;
+
+  /** The struct-of-arrays types created for @soa arrays, by length. */
+  mutable std::map<uint64_t, llvm::StructType*> soa_types_;
+};
+
+/** Declare a struct. Returns NULL if a struct of the same name is
+    already declared in the context.
+*/
+const StructInfo *DeclareStruct(llvm::LLVMContext& ctx, llvm::StringRef name,
+                                const std::vector<std::string>& names,
+                                const std::vector<llvm::Type*>& types,
+                                bool soa, bool ordered);
+
+/** The struct declared with a name, or NULL. */
+const StructInfo *FindStruct(llvm::LLVMContext& ctx, llvm::StringRef name);
+
+/** The struct a type is, or NULL. For the struct-of-arrays type of an
+    @soa array, the struct of its elements, and n is set to the length
+    of the array; n is 0 otherwise.
+*/
+const StructInfo *StructOf(llvm::Type *type, uint64_t& n);
+
+/** The type an array of n structs is stored as. */
+llvm::Type *StructArrayType(const StructInfo& info, uint64_t n);
+
+/** Drop the structs of a context that is about to be destroyed. */
+void ForgetStructs(llvm::LLVMContext& ctx);
+
+/** Report the size, alignment and field offsets of every struct, and
+    how much reordering the fields saved (-type-layout).
+*/
+void ReportStructLayouts(llvm::LLVMContext& ctx, const llvm::TargetData& td, Messages& msgs);
@@ -0,0 +1,132 @@
+
+#include "target.h"
+#include "options.h"
+#include <llvm/Module.h>
+#include <llvm/PassManager.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+using namespace llvm;
+
+TargetMachine *CreateTargetMachine(const Options& options, std::string& err) {
+  InitializeNativeTarget();
+
+  std::string triple = options.triple_.empty()
+    ? sys::getDefaultTargetTriple() : options.triple_;
+  const Target *target = TargetRegistry::lookupTarget(triple, err);
+  if (!target)
+    return NULL;
+
+  std::string cpu = options.cpu_;
+  SubtargetFeatures features;
+  if (cpu == "native") {
+    cpu = sys::getHostCPUName();
+
+    StringMap<bool> host;
+    if (sys::getHostCPUFeatures(host)) {
+      for (auto iter = host.begin(); iter != host.end(); ++iter) {
+        features.AddFeature(iter->getKey(), iter->getValue());
+      }
+    }
+  }
+
+  CodeGenOpt::Level level = CodeGenOpt::Default;
+  switch (options.opt_level_) {
+    case 0: level = CodeGenOpt::None; break;
+    case 1: level = CodeGenOpt::Less; break;
+    case 2: level = CodeGenOpt::Default; break;
+    default: level = CodeGenOpt::Aggressive; break;
+  }
+
+  // whole-program mode makes internal functions fastcc, which is the
+  // convention tail calls are guaranteed for
+  TargetOptions target_options;
+  target_options.GuaranteedTailCallOpt = options.whole_program_;
+  return target->createTargetMachine(triple, cpu, features.getString(),
+                                     target_options, Reloc::Default,
+                                     CodeModel::Default, level);
+}
+
+void ConfigureModule(Module& m, TargetMachine& tm) {
+  m.setTargetTriple(tm.getTargetTriple());
+  m.setDataLayout(tm.getTargetData()->getStringRepresentation());
+}
+
+void StripDeadFunctions(Module& m) {
+  PassManager pm;
+  pm.add(createGlobalDCEPass());
+  pm.run(m);
+}
+
+bool WriteModule(Module& m, TargetMachine *tm, const std::string& path, std::string& err) {
+  StringRef ext = StringRef(path).rsplit('.').second;
+  bool binary = ext == "bc" || ext == "o";
+  if (ext == "o" && !tm) {
+    err = "no target available to emit '" + path + "'";
+    return false;
+  }
+
+  tool_output_file out(path.c_str(), err, binary ? raw_fd_ostream::F_Binary : 0);
+  if (!err.empty())
+    return false;
+
+  if (ext == "bc") {
+    WriteBitcodeToFile(&m, out.os());
+  } else if (ext == "o") {
+    PassManager pm;
+    pm.add(new TargetData(*tm->getTargetData()));
+    formatted_raw_ostream fos(out.os());
+    if (tm->addPassesToEmitFile(pm, fos, TargetMachine::CGFT_ObjectFile)) {
+      err = "the target cannot emit object files";
+      return false;
+    }
+    pm.run(m);
+  } else {
+    m.print(out.os(), NULL);
+  }
+
+  out.keep();
+  return true;
+}
+
+void Optimize(Module& m, const Options& options, TargetMachine *tm) {
+  unsigned level = options.opt_level_;
+  if (level == 0)
+    return;
+
+  PassManagerBuilder builder;
+  builder.OptLevel = level;
+  builder.DisableUnrollLoops = level < 2;
+  builder.Vectorize = level >= 2;
+  if (level > 1)
+    builder.Inliner = createFunctionInliningPass(level > 2 ? 275 : 225);
+  else
+    builder.Inliner = createAlwaysInlinerPass();
+
+  FunctionPassManager fpm(&m);
+  PassManager mpm;
+  if (tm) {
+    fpm.add(new TargetData(*tm->getTargetData()));
+    mpm.add(new TargetData(*tm->getTargetData()));
+  }
+  builder.populateFunctionPassManager(fpm);
+  builder.populateModulePassManager(mpm);
+
+  fpm.doInitialization();
+  for (auto iter = m.begin(); iter != m.end(); ++iter) {
+    fpm.run(*iter);
+  }
+  fpm.doFinalization();
+  mpm.run(m);
+}
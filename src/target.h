@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+namespace llvm {
+  class Module;
+  class TargetMachine;
+}
+
+struct Options;
+
+/** Create a target machine for the triple and CPU in the options.
+    Returns NULL and fills in err if the target could not be found.
+*/
+llvm::TargetMachine *CreateTargetMachine(const Options& options, std::string& err);
+
+/** Set the triple and data layout of a module to match a target machine. */
+void ConfigureModule(llvm::Module& m, llvm::TargetMachine& tm);
+
+/** Remove the functions and globals that cannot be reached from the
+    externally visible ones. Used in whole-program mode before optimizing
+    so that no time is spent on unused code.
+*/
+void StripDeadFunctions(llvm::Module& m);
+
+/** Write a module to a file. The extension selects the format: .bc for
+    bitcode, .o for a native object (which needs a target machine), and
+    anything else for textual IR.
+*/
+bool WriteModule(llvm::Module& m, llvm::TargetMachine *tm, const std::string& path,
+                 std::string& err);
+
+/** Run the optimization pipeline for the level in the options.
+    The loop unroller and the vectorizer are enabled at -O2 and above.
+*/
+void Optimize(llvm::Module& m, const Options& options, llvm::TargetMachine *tm);
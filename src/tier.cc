@@ -0,0 +1,419 @@
+
+#include "tier.h"
+#include "ast.h"
+#include "perfmap.h"
+#include "util.h"
+#include "../runtime/parallel.h"
+#include "../runtime/region.h"
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/Instructions.h>
+#include <llvm/Module.h>
+#include <llvm/PassManager.h>
+#include <llvm/Analysis/Passes.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/Support/IRBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/Scalar.h>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+using namespace llvm;
+using std::string;
+using std::vector;
+
+#if defined(__GNUC__)
+#define NEAT_THREADED_DISPATCH 1
+#endif
+
+namespace {
+  /** Interpreter registers, for all frames together. */
+  const size_t kStackSize = 1 << 20;
+
+  /** Interpreter frames are C++ frames too, so recursion is bounded
+      well below what the native stack could hold.
+  */
+  const unsigned kMaxDepth = 20000;
+
+  Options EngineOptions(const Options& options) {
+    Options engine = options;
+    // the interpreter may call any function and calls native code
+    // through entries created after code generation, so every function
+    // has to stay in the module
+    engine.whole_program_ = false;
+    return engine;
+  }
+}
+
+TieredEngine::TieredEngine(const string& name, const Options& options, Messages& errs)
+  : options_(EngineOptions(options)), errs_(errs), name_(name),
+    parser_(name, options_), jit_failed_(false), sp_(0), depth_(0),
+    failed_(false) {}
+
+TieredEngine::~TieredEngine() {
+  // the execution engine owns the module it runs, but the module belongs
+  // to the parser
+  fpm_.reset();
+  if (ee_)
+    ee_->removeModule(&parser_.module());
+}
+
+bool TieredEngine::Load(const string& contents) {
+  contents_ = contents;
+  program_ = ParseProgram(parser_.ctx(), errs_, name_, contents_, parser_.jobs());
+  if (!program_)
+    return false;
+
+  for (auto& stmt : program_->stmts_) {
+    if (auto f = dynamic_cast<const ast::Function*>(stmt.get()))
+      table_.Add(f);
+  }
+
+  // lowering recurses through expressions, which may be nested to any
+  // depth
+  functions_.resize(table_.functions_.size());
+  RunWithStack(kTreeStackSize, [this]() {
+    for (size_t i = 0; i < functions_.size(); ++i) {
+      FunctionEntry& fn = functions_[i];
+      fn.ast_ = table_.functions_[i];
+      fn.chunk_ = bytecode::Lower(*fn.ast_, table_, fn.reason_);
+    }
+  });
+  return true;
+}
+
+bool TieredEngine::Run(StringRef function, const vector<int32_t>& args, int32_t& result) {
+  int index = table_.Find(function);
+  if (index < 0) {
+    errs_.Error("error: no function named '" + function.str() + "'");
+    return false;
+  }
+  if (functions_[index].ast_->name_args_.size() != args.size()) {
+    errs_.Error("error: wrong number of arguments for '" + function.str() + "'");
+    return false;
+  }
+
+  if (stack_.empty())
+    stack_.resize(kStackSize);
+  sp_ = 0;
+  depth_ = 0;
+  failed_ = false;
+  result = Call(index, args.data());
+  return !failed_;
+}
+
+int32_t TieredEngine::Call(unsigned index, const int32_t *args) {
+  FunctionEntry& fn = functions_[index];
+  if (fn.native_)
+    return fn.native_(args);
+
+  ++fn.heat_;
+  if (!fn.promoted_ && options_.jit_ &&
+      (!fn.chunk_ || fn.heat_ >= options_.jit_threshold_)) {
+    if (Promote(fn))
+      return fn.native_(args);
+  }
+
+  if (!fn.chunk_)
+    return Fail("error: '" + fn.ast_->name_.str() + "' cannot be interpreted: " + fn.reason_);
+  return Interpret(fn, args);
+}
+
+int32_t TieredEngine::Interpret(FunctionEntry& fn, const int32_t *args) {
+  using bytecode::Instr;
+  const bytecode::Chunk& chunk = *fn.chunk_;
+  if (sp_ + chunk.num_regs_ > stack_.size() || depth_ >= kMaxDepth)
+    return Fail("error: stack overflow in '" + fn.ast_->name_.str() + "'");
+
+  int32_t *r = &stack_[sp_];
+  sp_ += chunk.num_regs_;
+  ++depth_;
+  std::copy(args, args + chunk.num_args_, r);
+
+  const Instr *code = chunk.code_.data();
+  const Instr *ip = code;
+  const int32_t *consts = chunk.consts_.data();
+  int32_t result = 0;
+
+  // arithmetic wraps around like the native code, without relying on
+  // signed overflow
+#define U(x) uint32_t(x)
+
+#ifdef NEAT_THREADED_DISPATCH
+  // one indirect jump per handler, in the order of Instr::Op
+  static const void *const labels[Instr::NUM_OPS] = {
+    &&op_LOADK, &&op_MOV, &&op_ADD, &&op_ADDI, &&op_SUB, &&op_NEG, &&op_EQ,
+    &&op_NE, &&op_LT, &&op_LE, &&op_JMP, &&op_JZ, &&op_LOOP, &&op_CALL, &&op_RET, &&op_RETV,
+  };
+#define DISPATCH() goto *labels[ip->op_]
+#define OP(name) op_##name:
+#else
+#define DISPATCH() goto dispatch
+#define OP(name) case Instr::name:
+#endif
+
+  DISPATCH();
+#ifndef NEAT_THREADED_DISPATCH
+dispatch:
+  switch (ip->op_) {
+#endif
+  OP(LOADK)
+    r[ip->a_] = consts[ip->b_];
+    ++ip;
+    DISPATCH();
+  OP(MOV)
+    r[ip->a_] = r[ip->b_];
+    ++ip;
+    DISPATCH();
+  OP(ADD)
+    r[ip->a_] = U(r[ip->b_]) + U(r[ip->c_]);
+    ++ip;
+    DISPATCH();
+  OP(ADDI)
+    r[ip->a_] = U(r[ip->b_]) + U(int16_t(ip->c_));
+    ++ip;
+    DISPATCH();
+  OP(SUB)
+    r[ip->a_] = U(r[ip->b_]) - U(r[ip->c_]);
+    ++ip;
+    DISPATCH();
+  OP(NEG)
+    r[ip->a_] = 0 - U(r[ip->b_]);
+    ++ip;
+    DISPATCH();
+  OP(EQ)
+    r[ip->a_] = r[ip->b_] == r[ip->c_];
+    ++ip;
+    DISPATCH();
+  OP(NE)
+    r[ip->a_] = r[ip->b_] != r[ip->c_];
+    ++ip;
+    DISPATCH();
+  OP(LT)
+    r[ip->a_] = r[ip->b_] < r[ip->c_];
+    ++ip;
+    DISPATCH();
+  OP(LE)
+    r[ip->a_] = r[ip->b_] <= r[ip->c_];
+    ++ip;
+    DISPATCH();
+  OP(JMP)
+    ip = code + ip->b_;
+    DISPATCH();
+  OP(JZ)
+    ip = r[ip->a_] ? ip + 1 : code + ip->b_;
+    DISPATCH();
+  OP(LOOP)
+    ++fn.heat_;
+    ip = code + ip->b_;
+    DISPATCH();
+  OP(CALL)
+    r[ip->a_] = Call(ip->b_, r + ip->c_);
+    if (failed_)
+      goto done;
+    ++ip;
+    DISPATCH();
+  OP(RET)
+    result = r[ip->a_];
+    goto done;
+  OP(RETV)
+    goto done;
+#ifndef NEAT_THREADED_DISPATCH
+  default:
+    goto done;
+  }
+#endif
+
+#undef OP
+#undef DISPATCH
+#undef U
+
+done:
+  --depth_;
+  sp_ -= chunk.num_regs_;
+  return result;
+}
+
+int32_t TieredEngine::Fail(const string& msg) {
+  if (!failed_)
+    errs_.Error(msg);
+  failed_ = true;
+  return 0;
+}
+
+bool TieredEngine::Promote(FunctionEntry& fn) {
+  fn.promoted_ = true;
+  if (!StartJIT())
+    return false;
+
+  auto start = std::chrono::steady_clock::now();
+  string name = fn.ast_->name_;
+  llvm::Function *f = parser_.module().getFunction(name);
+  string err = "it has no code";
+  llvm::Function *entry = f && !f->isDeclaration() ? CreateEntry(f, err) : NULL;
+  if (!entry) {
+    errs_.Warning("warning: could not compile '" + name + "': " + err);
+    return false;
+  }
+
+  OptimizeReachable(f);
+  fn.native_ = reinterpret_cast<NativeEntry>(ee_->getPointerToFunction(entry));
+
+  if (options_.jit_stats_) {
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "' after %u calls and back edges (%.2f ms)", fn.heat_, ms.count());
+    errs_.Info("jit: compiled '" + name + buf);
+  }
+  return fn.native_ != NULL;
+}
+
+/** Generate the whole module and create the execution engine, the first
+    time any function is promoted.
+*/
+bool TieredEngine::StartJIT() {
+  if (ee_)
+    return true;
+  if (jit_failed_)
+    return false;
+  jit_failed_ = true;
+
+  auto start = std::chrono::steady_clock::now();
+  Module& m = parser_.module();
+  bool generated = false;
+  RunWithStack(kTreeStackSize, [&]() {
+    generated = parser_.Generate(*program_, name_, errs_);
+  });
+  if (!generated)
+    return false;
+
+  InitializeNativeTarget();
+  string err;
+  ee_.reset(EngineBuilder(&m)
+            .setErrorStr(&err)
+            .setEngineKind(EngineKind::JIT)
+            .setOptLevel(CodeGenOpt::Default)
+            .create());
+  if (!ee_) {
+    errs_.Error("error: could not start the JIT: " + err);
+    return false;
+  }
+
+  MapRuntime(*ee_, m);
+  if (options_.perf_map_)
+    ee_->RegisterJITEventListener(PerfMapListener());
+
+  // the native tier is always optimized; promoted functions are hot by
+  // definition, whatever the -O level
+  fpm_.reset(new FunctionPassManager(&m));
+  fpm_->add(new TargetData(*ee_->getTargetData()));
+  fpm_->add(createBasicAliasAnalysisPass());
+  fpm_->add(createPromoteMemoryToRegisterPass());
+  fpm_->add(createInstructionCombiningPass());
+  fpm_->add(createReassociatePass());
+  fpm_->add(createGVNPass());
+  fpm_->add(createCFGSimplificationPass());
+  fpm_->add(createLoopRotatePass());
+  fpm_->add(createLICMPass());
+  fpm_->add(createIndVarSimplifyPass());
+  fpm_->add(createLoopUnrollPass());
+  fpm_->add(createInstructionCombiningPass());
+  fpm_->add(createDeadStoreEliminationPass());
+  fpm_->add(createCFGSimplificationPass());
+  fpm_->doInitialization();
+
+  if (options_.jit_stats_) {
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "jit: generated the module (%.2f ms)", ms.count());
+    errs_.Info(buf);
+  }
+  jit_failed_ = false;
+  return true;
+}
+
+void MapRuntime(ExecutionEngine& ee, Module& m) {
+  // parfor loops and regions call into the runtime linked into neatc or
+  // libneat
+  const struct {
+    const char *name_;
+    void *addr_;
+  } runtime[] = {
+    { "neat_parfor", (void*) neat_parfor },
+    { "neat_parfor_lock", (void*) neat_parfor_lock },
+    { "neat_parfor_unlock", (void*) neat_parfor_unlock },
+    { "neat_region_refill", (void*) neat_region_refill },
+    { "neat_region_free", (void*) neat_region_free },
+  };
+  for (auto& fn : runtime) {
+    if (llvm::Function *f = m.getFunction(fn.name_))
+      ee.addGlobalMapping(f, fn.addr_);
+  }
+}
+
+/** Optimize a function and every function it can reach that has not
+    been optimized yet. The JIT compiles callees lazily, when they are
+    first called, so they must be optimized before any native code can
+    reach them. Functions passed as arguments, such as parfor bodies,
+    are reachable too.
+*/
+void TieredEngine::OptimizeReachable(llvm::Function *f) {
+  vector<llvm::Function*> worklist(1, f);
+  while (!worklist.empty()) {
+    llvm::Function *g = worklist.back();
+    worklist.pop_back();
+    if (g->isDeclaration() || !optimized_.insert(g).second)
+      continue;
+
+    fpm_->run(*g);
+    for (auto bb = g->begin(); bb != g->end(); ++bb) {
+      for (auto inst = bb->begin(); inst != bb->end(); ++inst) {
+        if (CallInst *call = dyn_cast<CallInst>(inst)) {
+          if (llvm::Function *callee = call->getCalledFunction())
+            worklist.push_back(callee);
+          for (unsigned i = 0; i < call->getNumArgOperands(); ++i) {
+            if (llvm::Function *arg = dyn_cast<llvm::Function>(call->getArgOperand(i)))
+              worklist.push_back(arg);
+          }
+        }
+      }
+    }
+  }
+}
+
+/** Create `i32 entry(i32* args)`, which unpacks the argument array,
+    calls the function with its own calling convention and returns its
+    result, or 0 for void functions.
+*/
+llvm::Function *TieredEngine::CreateEntry(llvm::Function *f, string& err) {
+  LLVMContext& ctx = f->getContext();
+  Type *i32 = Type::getInt32Ty(ctx);
+  Type *rettype = f->getReturnType();
+  if (!rettype->isVoidTy() && rettype != i32) {
+    err = "it returns a type other than int";
+    return NULL;
+  }
+
+  FunctionType *type = FunctionType::get(i32, PointerType::getUnqual(i32), false);
+  llvm::Function *entry = llvm::Function::Create(
+    type, GlobalValue::InternalLinkage, "__neat_entry_" + f->getName(), f->getParent());
+  IRBuilder<> irb(BasicBlock::Create(ctx, "", entry));
+
+  Value *argv = entry->arg_begin();
+  vector<Value*> args;
+  for (auto arg = f->arg_begin(); arg != f->arg_end(); ++arg) {
+    if (arg->getType() != i32) {
+      entry->eraseFromParent();
+      err = "it takes arguments of types other than int";
+      return NULL;
+    }
+    args.push_back(irb.CreateLoad(irb.CreateConstGEP1_32(argv, args.size())));
+  }
+
+  CallInst *call = irb.CreateCall(f, args);
+  call->setCallingConv(f->getCallingConv());
+  irb.CreateRet(rettype->isVoidTy() ? irb.getInt32(0) : call);
+  return entry;
+}
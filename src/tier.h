@@ -0,0 +1,105 @@
+#pragma once
+
+#include "bytecode.h"
+#include "parse.h"
+#include <llvm/ADT/StringRef.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace llvm {
+  class ExecutionEngine;
+  class Function;
+  class FunctionPassManager;
+  class Module;
+}
+
+namespace ast {
+  struct Function;
+  struct Program;
+}
+
+/** Point a module's calls into the runtime (parfor loops) at the copy
+    linked into this process, before the JIT compiles it.
+*/
+void MapRuntime(llvm::ExecutionEngine& ee, llvm::Module& m);
+
+/** Runs a program in two tiers (neatc -run).
+
+    Functions start out in the interpreter, which executes bytecode
+    lowered straight from the AST, so a program starts running without
+    waiting for LLVM. Every call and every loop back edge heats up the
+    function it happens in. Once a function reaches the threshold
+    (-fjit-threshold), the next call to it generates the module, optimizes
+    the function and what it calls, and compiles it with the JIT; from
+    then on calls go to the native code.
+
+    A function running in the interpreter is not replaced mid-call, so a
+    long loop in a function that is called only once stays in the
+    interpreter. Functions the interpreter cannot run are compiled on
+    their first call.
+*/
+struct TieredEngine {
+  TieredEngine(const std::string& name, const Options& options, Messages& errs);
+  ~TieredEngine();
+
+  /** Parse a program and lower its functions to bytecode. The engine
+      keeps its own copy of the contents, which the AST refers to.
+  */
+  bool Load(const std::string& contents);
+
+  /** Call a function of the program. Functions returning void give 0. */
+  bool Run(llvm::StringRef function, const std::vector<int32_t>& args, int32_t& result);
+
+private:
+  /** Native code is called through an entry that takes the arguments
+      as an array, so every function has the same C signature.
+  */
+  typedef int32_t (*NativeEntry)(const int32_t *args);
+
+  struct FunctionEntry {
+    FunctionEntry() : ast_(NULL), native_(NULL), heat_(0), promoted_(false) {}
+
+    const ast::Function *ast_;
+    std::unique_ptr<bytecode::Chunk> chunk_;
+    /** Why the function has no bytecode. */
+    std::string reason_;
+    NativeEntry native_;
+    /** Calls plus back edges executed in the interpreter. */
+    unsigned heat_;
+    /** Whether promotion to native code was attempted. */
+    bool promoted_;
+  };
+
+  int32_t Call(unsigned index, const int32_t *args);
+  int32_t Interpret(FunctionEntry& fn, const int32_t *args);
+  int32_t Fail(const std::string& msg);
+
+  bool Promote(FunctionEntry& fn);
+  bool StartJIT();
+  void OptimizeReachable(llvm::Function *f);
+  llvm::Function *CreateEntry(llvm::Function *f, std::string& err);
+
+  Options options_;
+  Messages& errs_;
+  std::string name_;
+  std::string contents_;
+  Parser parser_;
+  std::unique_ptr<ast::Program> program_;
+
+  bytecode::FunctionTable table_;
+  std::vector<FunctionEntry> functions_;
+
+  std::unique_ptr<llvm::ExecutionEngine> ee_;
+  std::unique_ptr<llvm::FunctionPassManager> fpm_;
+  std::unordered_set<llvm::Function*> optimized_;
+  bool jit_failed_;
+
+  /** Registers of the interpreter frames. */
+  std::vector<int32_t> stack_;
+  size_t sp_;
+  unsigned depth_;
+  bool failed_;
+};
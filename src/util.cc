@@ -1,6 +1,11 @@
 
 #include "util.h"
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 std::string ReadFile(const std::string& path) {
   FILE *fd = fopen(path.c_str(), "r");
@@ -18,3 +23,123 @@ std::string ReadFile(const std::string& path) {
   fclose(fd);
   return contents;
 }
+
+bool MatchGlob(llvm::StringRef pattern, llvm::StringRef str) {
+  // iterative matcher: remember the last star so that a failed match
+  // only backtracks to it instead of exploring every split
+  size_t p = 0, s = 0;
+  size_t star = llvm::StringRef::npos, mark = 0;
+  while (s < str.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+      ++p; ++s;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      mark = s;
+    } else if (star != llvm::StringRef::npos) {
+      p = star + 1;
+      s = ++mark;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+    ++p;
+  return p == pattern.size();
+}
+
+std::vector<std::string> Split(llvm::StringRef str, char sep) {
+  std::vector<std::string> parts;
+  while (!str.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> split = str.split(sep);
+    if (!split.first.empty())
+      parts.push_back(split.first.str());
+    str = split.second;
+  }
+  return parts;
+}
+
+uint64_t HashBytes(llvm::StringRef data) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (char ch : data) {
+    hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string DirName(const std::string& path) {
+  size_t pos = path.rfind('/');
+  if (pos == std::string::npos)
+    return ".";
+  return pos == 0 ? "/" : path.substr(0, pos);
+}
+
+std::string BaseName(const std::string& path) {
+  size_t pos = path.rfind('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+bool WriteFileAtomic(const std::string& path, llvm::StringRef data) {
+  std::string tmp = path + ".tmp";
+  FILE *fd = fopen(tmp.c_str(), "wb");
+  if (!fd)
+    return false;
+
+  bool ok = fwrite(data.data(), 1, data.size(), fd) == data.size();
+  ok = fclose(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+bool MappedFile::Map(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  data_ = static_cast<const char*>(map);
+  size_ = st.st_size;
+  return true;
+}
+
+namespace {
+  void *RunFunction(void *arg) {
+    (*static_cast<const std::function<void()>*>(arg))();
+    return NULL;
+  }
+}
+
+void RunWithStack(size_t size, const std::function<void()>& fn) {
+  pthread_attr_t attr;
+  pthread_t thread;
+  bool started = pthread_attr_init(&attr) == 0;
+  if (started) {
+    started = pthread_attr_setstacksize(&attr, size) == 0 &&
+      pthread_create(&thread, &attr, RunFunction,
+                     const_cast<std::function<void()>*>(&fn)) == 0;
+    pthread_attr_destroy(&attr);
+  }
+
+  if (started)
+    pthread_join(thread, NULL);
+  else
+    fn();
+}
@@ -1,5 +1,60 @@
 #pragma once
 
+#include <llvm/ADT/StringRef.h>
+#include <functional>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 std::string ReadFile(const std::string& path);
+
+/** Match a string against a glob pattern where `*` matches any run of
+    characters and `?` matches any single character.
+*/
+bool MatchGlob(llvm::StringRef pattern, llvm::StringRef str);
+
+/** 64-bit FNV-1a hash of a buffer. */
+uint64_t HashBytes(llvm::StringRef data);
+
+/** Directory part of a path, or "." if it has none. */
+std::string DirName(const std::string& path);
+
+/** File name part of a path. */
+std::string BaseName(const std::string& path);
+
+/** Write a file through a temporary that is renamed into place, so a
+    concurrent reader never sees a partially written file.
+*/
+bool WriteFileAtomic(const std::string& path, llvm::StringRef data);
+
+/** A read-only memory mapping of a whole file. */
+struct MappedFile {
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile();
+
+  bool Map(const std::string& path);
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char *data_;
+  size_t size_;
+};
+
+/** Split a string on a separator character, dropping empty pieces. */
+std::vector<std::string> Split(llvm::StringRef str, char sep);
+
+/** Stack size for walking syntax trees: their consumers recurse once per
+    level of nesting. Stack pages are only committed as they are touched.
+*/
+const size_t kTreeStackSize = size_t(1) << 30;
+
+/** Run fn on a new thread with a stack of the given size and wait for it
+    to finish. Runs it on the calling thread if no such thread can be
+    created.
+*/
+void RunWithStack(size_t size, const std::function<void()>& fn);